@@ -3,6 +3,8 @@
 #include <string>
 #include <vector>
 #include <cstring>
+#include <cctype>
+#include <cstdio>
 #include <cmath>
 #include <sys/time.h>
 
@@ -91,6 +93,97 @@ graphene_dtype_size(const DataType dtype){
 }
 
 /********************************************************************/
+// Fast number parsing, without std::istringstream.
+// Same rules as for reading numbers from std::istream are used:
+// leading spaces are skipped, optional sign, decimal digits,
+// whole string should be used, overflow is an error.
+
+// read decimal digits into an unsigned integer, move p.
+// Return false if there are no digits or on overflow.
+static bool
+read_uint(const char * & p, const char *e, uint64_t & v){
+  const char *p0 = p;
+  v = 0;
+  while (p<e && *p>='0' && *p<='9'){
+    uint64_t d = *p-'0';
+    if (v > (UINT64_MAX - d)/10) return false;
+    v = v*10 + d;
+    p++;
+  }
+  return p!=p0;
+}
+
+// parse signed integer in the range vmin..vmax
+static bool
+parse_int(const std::string & str, int64_t & v,
+          const int64_t vmin, const int64_t vmax){
+  const char *p = str.data(), *e = p + str.size();
+  while (p<e && isspace(*p)) p++;
+  bool neg = false;
+  if (p<e && (*p=='+' || *p=='-')) neg = (*p++ == '-');
+  uint64_t u;
+  if (!read_uint(p, e, u) || p!=e) return false;
+  if (neg){
+    if (u > (uint64_t)0 - (uint64_t)vmin) return false;
+    v = (int64_t)((uint64_t)0 - u);
+  }
+  else {
+    if (u > (uint64_t)vmax) return false;
+    v = u;
+  }
+  return true;
+}
+
+// parse unsigned integer (up to vmax), negative values are not allowed
+static bool
+parse_uint(const std::string & str, uint64_t & v, const uint64_t vmax){
+  const char *p = str.data(), *e = p + str.size();
+  while (p<e && isspace(*p)) p++;
+  if (p<e && *p=='+') p++;
+  return read_uint(p, e, v) && p==e && v<=vmax;
+}
+
+// parse floating point number (float or double)
+// with strtof/strtod, infinite values are not allowed
+template <typename T>
+static bool
+parse_float(const std::string & str, T & v, T (*conv)(const char *, char **)){
+  const char *p = str.c_str(), *e = p + str.size();
+  while (p<e && isspace(*p)) p++;
+  const char *b = p;
+  // check format: [+-]<digits>[.<digits>][e[+-]<digits>]
+  if (p<e && (*p=='+' || *p=='-')) p++;
+  size_t nd = 0; // number of mantissa digits
+  while (p<e && *p>='0' && *p<='9') {p++; nd++;}
+  if (p<e && *p=='.') {
+    p++;
+    while (p<e && *p>='0' && *p<='9') {p++; nd++;}
+  }
+  if (nd==0) return false;
+  if (p<e && (*p=='e' || *p=='E')) {
+    p++;
+    if (p<e && (*p=='+' || *p=='-')) p++;
+    if (p==e || *p<'0' || *p>'9') return false;
+    while (p<e && *p>='0' && *p<='9') p++;
+  }
+  if (p!=e) return false;
+
+  char *end;
+  v = conv(b, &end);
+  return end==e && !std::isinf(v);
+}
+
+// special values for floating point numbers: inf, +inf, -inf, nan
+// (case insensitive)
+template <typename T>
+static bool
+parse_float_special(const std::string & str, T & v){
+  if (strcasecmp(str.c_str(),"inf")==0 ||
+      strcasecmp(str.c_str(),"+inf")==0) { v = +INFINITY; return true; }
+  if (strcasecmp(str.c_str(),"-inf")==0) { v = -INFINITY; return true; }
+  if (strcasecmp(str.c_str(),"nan")==0)  { v = NAN; return true; }
+  return false;
+}
 
 std::string
 graphene_data_parse(const std::vector<std::string> & strs, const DataType dtype){
@@ -112,110 +205,156 @@ graphene_data_parse(const std::vector<std::string> & strs, const DataType dtype)
     std::string ret = std::string(graphene_dtype_size(dtype)*strs.size(), '\0');
     for (int i=0; i<strs.size(); i++){
 
-      std::istringstream s(strs[i]);
-      std::string tmp;
-      int ii;
+      int64_t  iv;
+      uint64_t uv;
+      bool ok;
       switch (dtype){
 
         case DATA_INT8:
-          // We can not read directly to int8_t because a byte
-          // will be read, not number. Let's read to larger
-          // integer, and check limits manually.
-          s >> ii;
-          if (ii<-128 || ii>127) throw Err()
-            << "Bad INT8 value: "  << strs[i];
-          ((int8_t *)ret.data())[i] = ii;
+          ok = parse_int(strs[i], iv, INT8_MIN, INT8_MAX);
+          ((int8_t *)ret.data())[i] = iv;
           break;
 
         case DATA_UINT8:
-          // Same as with DATA_INT8
-          s >> ii;
-          if (ii<0 || ii>255) throw Err()
-            << "Bad UINT8 value: " << strs[i];
-          ((uint8_t *)ret.data())[i] = ii;
+          ok = parse_uint(strs[i], uv, UINT8_MAX);
+          ((uint8_t *)ret.data())[i] = uv;
           break;
 
         case DATA_INT16:
-          // For int16 this is enough. Limits are detected properly.
-          s >> ((int16_t *)ret.data())[i];
+          ok = parse_int(strs[i], iv, INT16_MIN, INT16_MAX);
+          ((int16_t *)ret.data())[i] = iv;
           break;
 
         case DATA_UINT16:
-          // We have to check manually that input is non-negative.
-          if (s.peek()=='-') throw Err()
-            << "Bad UINT16 value: " << strs[i];
-          s >> ((uint16_t *)ret.data())[i];
+          ok = parse_uint(strs[i], uv, UINT16_MAX);
+          ((uint16_t *)ret.data())[i] = uv;
           break;
 
         case DATA_INT32:
-          s >> ((int32_t *)ret.data())[i];
+          ok = parse_int(strs[i], iv, INT32_MIN, INT32_MAX);
+          ((int32_t *)ret.data())[i] = iv;
           break;
 
         case DATA_UINT32:
-          if (s.peek()=='-') throw Err()
-            << "Bad UINT32 value: " << strs[i];
-          s >> ((uint32_t *)ret.data())[i];
+          ok = parse_uint(strs[i], uv, UINT32_MAX);
+          ((uint32_t *)ret.data())[i] = uv;
           break;
 
         case DATA_INT64:
-          // There is a question about -2^63. It can be put
-          // to the database and printed back, but it can
-          // not be written as -9223372036854775808l
-          s >> ((int64_t *)ret.data())[i];
+          // -2^63 can be put to the database and printed back,
+          // (but it can not be written as -9223372036854775808l in C)
+          ok = parse_int(strs[i], iv, INT64_MIN, INT64_MAX);
+          ((int64_t *)ret.data())[i] = iv;
           break;
 
         case DATA_UINT64:
-          if (s.peek()=='-') throw Err()
-            << "Bad UINT64 value: " << strs[i];
-          s >> ((uint64_t *)ret.data())[i]; break;
+          ok = parse_uint(strs[i], uv, UINT64_MAX);
+          ((uint64_t *)ret.data())[i] = uv;
+          break;
 
         case DATA_FLOAT:
-          if (strcasecmp(strs[i].c_str(),"inf")==0 ||
-              strcasecmp(strs[i].c_str(),"+inf")==0) {
-            ((float*)ret.data())[i] = +INFINITY;
-            getline(s, tmp); break;
-          }
-          if (strcasecmp(strs[i].c_str(),"-inf")==0) {
-            ((float*)ret.data())[i] = -INFINITY;
-            getline(s, tmp); break;
-          }
-          if (strcasecmp(strs[i].c_str(),"nan")==0) {
-            ((float*)ret.data())[i] = NAN;
-            getline(s, tmp); break;
-          }
-          s >> ((float *)ret.data())[i]; break;
+          ok = parse_float_special(strs[i], ((float*)ret.data())[i]) ||
+               parse_float(strs[i], ((float*)ret.data())[i], strtof);
+          break;
 
         case DATA_DOUBLE:
-          if (strcasecmp(strs[i].c_str(),"inf")==0 ||
-              strcasecmp(strs[i].c_str(),"+inf")==0) {
-            ((double*)ret.data())[i] = +INFINITY;
-            getline(s, tmp); break;
-          }
-          if (strcasecmp(strs[i].c_str(),"-inf")==0) {
-            ((double*)ret.data())[i] = -INFINITY;
-            getline(s, tmp); break;
-          }
-          if (strcasecmp(strs[i].c_str(),"nan")==0) {
-            ((double*)ret.data())[i] = NAN;
-            getline(s, tmp); break;
-          }
-          s >> ((double*)ret.data())[i]; break;
+          ok = parse_float_special(strs[i], ((double*)ret.data())[i]) ||
+               parse_float(strs[i], ((double*)ret.data())[i], strtod);
+          break;
+
         default: throw Err() << "Unexpected data format";
       }
 
-      if (s.bad() || s.fail() || !s.eof())
+      if (!ok)
         throw Err() << "Bad " << graphene_dtype_name(dtype) << " value: " << strs[i];
     }
     return ret;
   }
 }
 
+/********************************************************************/
+// Fast number formatting, without std::ostringstream.
+
+// append unsigned integer
+static void
+app_uint(std::string & out, uint64_t v){
+  char buf[20];
+  char *p = buf + sizeof(buf);
+  do { *--p = '0' + v%10; v/=10; } while (v);
+  out.append(p, buf + sizeof(buf) - p);
+}
+
+// append signed integer
+static void
+app_int(std::string & out, const int64_t v){
+  if (v>=0) return app_uint(out, v);
+  out.push_back('-');
+  app_uint(out, -(uint64_t)v);
+}
+
+// append floating point number, same as
+// std::ostream with std::setprecision(prec).
+static void
+app_float(std::string & out, const double v, const int prec){
+  char buf[32];
+  int n = snprintf(buf, sizeof(buf), "%.*g", prec, v);
+  out.append(buf, n);
+}
+
+void
+graphene_data_append(std::string & out, const GrapheneView & s,
+                     const size_t i, const DataType dtype){
+  switch (dtype){
+    // 1-byte values are printed as characters (as it was
+    // always done by std::ostream)
+    case DATA_INT8:   out.push_back(((int8_t   *)s.data())[i]); break;
+    case DATA_UINT8:  out.push_back(((uint8_t  *)s.data())[i]); break;
+    case DATA_INT16:  app_int(out,  ((int16_t  *)s.data())[i]); break;
+    case DATA_UINT16: app_uint(out, ((uint16_t *)s.data())[i]); break;
+    case DATA_INT32:  app_int(out,  ((int32_t  *)s.data())[i]); break;
+    case DATA_UINT32: app_uint(out, ((uint32_t *)s.data())[i]); break;
+    case DATA_INT64:  app_int(out,  ((int64_t  *)s.data())[i]); break;
+    case DATA_UINT64: app_uint(out, ((uint64_t *)s.data())[i]); break;
+    // No loss of information happens if we convert float and double
+    // numbers into strings with 9 and 17 significant digits.
+    // We use one less digit to have round values (3.1415 instead of 3.1415000
+    case DATA_FLOAT:  app_float(out, ((float  *)s.data())[i], 8); break;
+    case DATA_DOUBLE: app_float(out, ((double *)s.data())[i], 16); break;
+    default: throw Err() << "Unexpected data format";
+  }
+}
+
+double
+graphene_data_get(const GrapheneView & s, const size_t i, const DataType dtype){
+  switch (dtype){
+    case DATA_INT8:   return ((int8_t   *)s.data())[i];
+    case DATA_UINT8:  return ((uint8_t  *)s.data())[i];
+    case DATA_INT16:  return ((int16_t  *)s.data())[i];
+    case DATA_UINT16: return ((uint16_t *)s.data())[i];
+    case DATA_INT32:  return ((int32_t  *)s.data())[i];
+    case DATA_UINT32: return ((uint32_t *)s.data())[i];
+    case DATA_INT64:  return ((int64_t  *)s.data())[i];
+    case DATA_UINT64: return ((uint64_t *)s.data())[i];
+    case DATA_FLOAT:  return ((float    *)s.data())[i];
+    case DATA_DOUBLE: return ((double   *)s.data())[i];
+    default: throw Err() << "Unexpected data format";
+  }
+}
+
+void
+graphene_data_check(const GrapheneView & s, const DataType dtype){
+  if (dtype == DATA_TEXT) return;
+  if (s.size() < 1) throw Err() << "Some data expected";
+  if (s.size() % graphene_dtype_size(dtype) != 0)
+    throw Err() << "Bad " << graphene_dtype_name(dtype) << " data size: " << s.size();
+}
+
 std::vector<std::string>
-graphene_data_print(const std::string & s, const int col, const DataType dtype){
+graphene_data_print(const GrapheneView & s, const int col, const DataType dtype){
   std::vector<std::string> ret;
 
   if (dtype == DATA_TEXT) {
-    ret.push_back(s);
+    ret.push_back(s.str());
     return ret;
   }
 
@@ -229,26 +368,11 @@ graphene_data_print(const std::string & s, const int col, const DataType dtype){
   size_t c1=0, c2=cn;
   if (col!=-1) { c1=col; c2=col+1; }
 
+  ret.reserve(c2-c1);
   for (size_t i=c1; i<c2; i++){
     if (i>=cn) { ret.push_back("NaN"); continue;}
-    std::ostringstream ostr;
-    switch (dtype){
-      case DATA_INT8:   ostr << ((int8_t   *)s.data())[i]; break;
-      case DATA_UINT8:  ostr << ((uint8_t  *)s.data())[i]; break;
-      case DATA_INT16:  ostr << ((int16_t  *)s.data())[i]; break;
-      case DATA_UINT16: ostr << ((uint16_t *)s.data())[i]; break;
-      case DATA_INT32:  ostr << ((int32_t  *)s.data())[i]; break;
-      case DATA_UINT32: ostr << ((uint32_t *)s.data())[i]; break;
-      case DATA_INT64:  ostr << ((int64_t  *)s.data())[i]; break;
-      case DATA_UINT64: ostr << ((uint64_t *)s.data())[i]; break;
-      // No loss of information happens if we convert float and double
-      // numbers into strings with 9 and 17 significant digits.
-      // We use one less digit to have round values (3.1415 instead of 3.1415000
-      case DATA_FLOAT:  ostr << std::setprecision(8)  << ((float  *)s.data())[i]; break;
-      case DATA_DOUBLE: ostr << std::setprecision(16) << ((double *)s.data())[i]; break;
-      default: throw Err() << "Unexpected data format";
-    }
-    ret.push_back(ostr.str());
+    ret.push_back(std::string());
+    graphene_data_append(ret.back(), s, i, dtype);
   }
   return ret;
 }
@@ -327,84 +451,94 @@ std::string graphene_tfmt_name(const TimeFMT tfmt){
 
 /********************************************************************/
 
-uint64_t
-graphene_time_unpack_v1(const std::string & t){
-  if (t.size()!=sizeof(uint64_t))
-    throw Err() << "Broken database: wrong timestamp size: " << t.size();
-  return *(uint64_t *)t.data();
-}
-
-uint64_t
-graphene_time_unpack_v2(const std::string & t){
-  if (t.size()==sizeof(uint64_t))
-    return *(uint64_t *)t.data();
-  if (t.size()==sizeof(uint32_t)){
-    uint64_t v = (uint64_t)(*(uint32_t *)t.data())<<32;
-    if (v&0xFFFFFFFF > 999999999) throw Err()
-       << "Bad timestamp: too large nanosecond field";
-    return v;
+GrapheneTime
+graphene_time_unpack(const GrapheneView & t, const TimeType ttype){
+  switch (ttype){
+    case TIME_V1:
+      if (t.size()==sizeof(uint64_t))
+        return GrapheneTime(*(uint64_t *)t.data());
+      break;
+    case TIME_V2:
+      if (t.size()==sizeof(uint64_t))
+        return GrapheneTime(*(uint64_t *)t.data());
+      if (t.size()==sizeof(uint32_t))
+        return GrapheneTime((uint64_t)(*(uint32_t *)t.data())<<32);
+      break;
+    default: throw Err() << "Unknown time type: " << ttype;
   }
   throw Err() << "Broken database: wrong timestamp size: " << t.size();
 }
 
+size_t
+graphene_time_pack(const GrapheneTime & t, const TimeType ttype, char *buf){
+  switch (ttype){
+    case TIME_V1:
+      *(uint64_t *)buf = t.val();
+      return sizeof(uint64_t);
+    case TIME_V2:
+      if (t.val()&0xFFFFFFFF){
+        *(uint64_t *)buf = t.val();
+        return sizeof(uint64_t);
+      }
+      *(uint32_t *)buf = t.val()>>32;
+      return sizeof(uint32_t);
+  }
+  throw Err() << "Unknown time type: " << ttype;
+}
 
 std::string
-graphene_time_pack_v2(const uint64_t & t){
-  if (t&0xFFFFFFFF){
-    std::string ret(sizeof(uint64_t), '\0');
-    *(uint64_t *)ret.data() = t;
-    return ret;
-  }
-  else {
-    std::string ret(sizeof(uint32_t), '\0');
-    *(uint32_t *)ret.data() = t>>32;
-    return ret;
-  }
+graphene_time_pack(const GrapheneTime & t, const TimeType ttype){
+  char buf[sizeof(uint64_t)];
+  return std::string(buf, graphene_time_pack(t, ttype, buf));
 }
 
 /********************************************************************/
 bool
 graphene_time_parse_s(const std::string & str, uint64_t * t, const TimeType ttype){
 
-  int digits = (ttype == TIME_V2)? 9:3;
   uint64_t maxval = (ttype == TIME_V2)? (uint32_t)-1 : (uint64_t)-1;
+  // 10^(number of fractional digits)
+  uint64_t scale = (ttype == TIME_V2)? 1000000000 : 1000;
+
+  const char *p = str.data(), *e = p + str.size();
 
   // +/- suffixes
   int add=0;
-  std::istringstream s;
-  if (str.size()>0 && (str[str.size()-1] == '+' ||
-                           str[str.size()-1] == '-')){
-    add = str[str.size()-1]=='+'? +1:-1;
-    s.str(std::string(str.begin(), str.end()-1));
+  if (p<e && (e[-1] == '+' || e[-1] == '-')){
+    add = e[-1]=='+'? +1:-1;
+    e--;
   }
-  else s.str(str);
 
   // read numerical value
   uint64_t t1=0, t2=0;
-  if (s.peek()=='-') throw Err()
+  if (p<e && *p=='-') throw Err()
     << "Bad timestamp: positive value expected: " << str;
-  s >> t1; // read seconds
-  if (s.bad() || s.fail())
+
+  // read seconds
+  while (p<e && isspace(*p)) p++;
+  if (p<e && *p=='+') p++;
+  if (!read_uint(p, e, t1))
     throw Err() << "Bad timestamp: can't read seconds: " << str;
 
-  if (!s.eof()){
-    char c;
-    s >> c; // read decimal dot
-    if (s.bad() || s.fail() || c!='.')
+  if (p<e){
+    // read decimal dot
+    while (p<e && isspace(*p)) p++;
+    if (p==e || *p!='.')
       throw Err() << "Bad timestamp: can't read decimal dot: " << str;
-    s >> c;
-    int n=digits-1;
-    while (!s.eof()){
-      if (c<'0'||c>'9')
+    p++;
+    // read fractional part, skip extra digits
+    uint64_t n = scale/10;
+    for (; p<e; p++){
+      if (isspace(*p)) continue;
+      if (*p<'0' || *p>'9')
         throw Err() << "Bad timestamp: can't read fractional part: " << str;
-      if (n>=0) t2 += (c-'0') * pow(10,n);
-      s >> c;
-      n--;
+      t2 += (*p-'0')*n;
+      n/=10;
     }
   }
   // add +/-
   if (add==+1){
-    if (t2<pow(10,digits)-1) t2++;
+    if (t2<scale-1) t2++;
     else {
       t2=0;
       t1 = t1<maxval? t1+1: 0;
@@ -413,7 +547,7 @@ graphene_time_parse_s(const std::string & str, uint64_t * t, const TimeType ttyp
   if (add==-1){
     if (t2>0) t2--;
     else {
-      t2=pow(10,digits)-1;
+      t2=scale-1;
       t1 = t1>0? t1-1: maxval;
     }
   }
@@ -434,8 +568,8 @@ graphene_time_parse_s(const std::string & str, uint64_t * t, const TimeType ttyp
 
 
 
-std::string
-graphene_time_parse(const std::string & str, const TimeType ttype){
+GrapheneTime
+graphene_time_parse_t(const std::string & str, const TimeType ttype){
 
   if (str=="") throw Err() << "Empty timestamp";
 
@@ -457,8 +591,7 @@ graphene_time_parse(const std::string & str, const TimeType ttype){
       t = (uint64_t)tv.tv_sec << 32;
     }
     else if (strcasecmp(str.c_str(), "inf")==0){
-      t = (uint64_t)((uint32_t)-1)<<32;
-      t += (uint64_t)999999999;
+      t = GrapheneTime::max(ttype).val();
     }
     // YYYY-MM-DD HH:MM:SS.SS
     else if (str.size()>=10 && str[4] == '-' && str[7]=='-'){
@@ -488,7 +621,7 @@ graphene_time_parse(const std::string & str, const TimeType ttype){
     else {
       graphene_time_parse_s(str, &t, ttype);
     }
-    return graphene_time_pack_v2(t);
+    return GrapheneTime(t);
   }
 
   /// TIME_V1: uint64_t with unix time in milliseconds
@@ -507,36 +640,34 @@ graphene_time_parse(const std::string & str, const TimeType ttype){
       t = (uint64_t)tv.tv_sec*1000;
     }
     else if (strcasecmp(str.c_str(), "inf")==0){
-      t = (uint64_t)-1;
+      t = GrapheneTime::max(ttype).val();
     }
     else {
       graphene_time_parse_s(str, &t, ttype);
     }
-    std::string ret = std::string(sizeof(uint64_t), '\0');
-    *(uint64_t *)ret.data() = t;
-    return ret;
+    return GrapheneTime(t);
   }
 
   throw Err() << "Unknown time type: " << ttype;
 }
 
+std::string
+graphene_time_parse(const std::string & str, const TimeType ttype){
+  return graphene_time_pack(graphene_time_parse_t(str, ttype), ttype);
+}
 
 
 /********************************************************************/
 double
-graphene_time_diff(const std::string & t1, const std::string & t2,
+graphene_time_diff(const GrapheneTime & t1, const GrapheneTime & t2,
                    const TimeType ttype){
+  uint64_t v1 = t1.val(), v2 = t2.val();
   switch (ttype){
-    case TIME_V1: {
-      uint64_t v1 = graphene_time_unpack_v1(t1);
-      uint64_t v2 = graphene_time_unpack_v1(t2);
+    case TIME_V1:
       return v1>v2 ? (double)(v1-v2)/1000.0 :
                     -(double)(v2-v1)/1000.0;
-    }
     case TIME_V2: {
-      uint64_t v1 = graphene_time_unpack_v2(t1);
-      uint64_t v2 = graphene_time_unpack_v2(t2);
-      // difference in seconds and in milliseconds
+      // difference in seconds and in nanoseconds
       int64_t d1 = (int64_t)(v1 >> 32) - (int64_t)(v2 >> 32);
       int64_t d2 = (int64_t)(v1 & 0xFFFFFFFF) - (int64_t)(v2 & 0xFFFFFFFF);
       return (double)d1 + (double)d2*1e-9;
@@ -545,109 +676,132 @@ graphene_time_diff(const std::string & t1, const std::string & t2,
   throw Err() << "Unknown time type: " << ttype;
 }
 
-int
-graphene_time_cmp(const std::string & t1, const std::string & t2,
+GrapheneTime
+graphene_time_add(const GrapheneTime & t1, const GrapheneTime & t2,
                   const TimeType ttype){
+  uint64_t v1 = t1.val(), v2 = t2.val();
   switch (ttype){
     case TIME_V1: {
-      uint64_t v1 = graphene_time_unpack_v1(t1);
-      uint64_t v2 = graphene_time_unpack_v1(t2);
-      if (v1==v2) return 0;
-      return v1>v2 ? +1:-1;
-    }
-    case TIME_V2: {
-      uint64_t v1 = graphene_time_unpack_v2(t1);
-      uint64_t v2 = graphene_time_unpack_v2(t2);
-      // difference in seconds and in milliseconds
-      if (v1==v2) return 0;
-      return v1>v2 ? 1:-1;
-    }
-  }
-  throw Err() << "Unknown time type: " << ttype;
-}
-
-bool
-graphene_time_zero( const std::string & t, const TimeType ttype){
-  switch (ttype){
-    case TIME_V1: return graphene_time_unpack_v1(t)==0;
-    case TIME_V2: return graphene_time_unpack_v2(t)==0;
-  }
-  throw Err() << "Unknown time type: " << ttype;
-}
-
-std::string
-graphene_time_add(const std::string & t1, const std::string & t2,
-                  const TimeType ttype){
-  switch (ttype){
-    case TIME_V1: {
-      uint64_t v1 = graphene_time_unpack_v1(t1);
-      uint64_t v2 = graphene_time_unpack_v1(t2);
-      std::string ret(sizeof(uint64_t), '\0');
       uint64_t v = v1+v2;
       if (v<v1 || v<v2) throw Err() << "graphene_time_add overfull";
-      *(uint64_t *)ret.data() = v;
-      return ret;
+      return GrapheneTime(v);
     }
     case TIME_V2: {
-      uint64_t v1 = graphene_time_unpack_v2(t1);
-      uint64_t v2 = graphene_time_unpack_v2(t2);
       uint64_t sum1 = (v1 >> 32) + (v2 >> 32);
       uint64_t sum2 = (v1 & 0xFFFFFFFF) + (v2 & 0xFFFFFFFF);
       while (sum2 > 999999999) {sum2-=1000000000; sum1++;}
       if (sum1 >= ((uint64_t)1<<32) ) throw Err() << "graphene_time_add overfull";
-      return graphene_time_pack_v2((sum1<<32)+sum2);
+      return GrapheneTime((sum1<<32)+sum2);
     }
   }
   throw Err() << "Unknown time type: " << ttype;
 }
 
+uint64_t
+graphene_time_to_units(const GrapheneTime & t, const TimeType ttype){
+  return ttype==TIME_V2? t.sec(ttype)*1000000000 + t.nsec(ttype) : t.val();
+}
+
+GrapheneTime
+graphene_time_from_units(const uint64_t u, const TimeType ttype){
+  return ttype==TIME_V2?
+    GrapheneTime::make(u/1000000000, u%1000000000, ttype) : GrapheneTime(u);
+}
+
+void
+graphene_time_append(std::string & out, const GrapheneTime & t,
+                     const TimeType ttype){
+  if (ttype!=TIME_V1 && ttype!=TIME_V2)
+    throw Err() << "Unknown time type: " << ttype;
+  app_uint(out, t.sec(ttype));
+  // nanoseconds, always 9 digits
+  char buf[10];
+  uint32_t ns = t.nsec(ttype);
+  buf[0] = '.';
+  for (int i=9; i>0; i--) { buf[i] = '0' + ns%10; ns/=10; }
+  out.append(buf, sizeof(buf));
+}
+
 std::string
-graphene_time_print(const std::string & t, const TimeType ttype,
+graphene_time_print(const GrapheneTime & t, const TimeType ttype,
                     const TimeFMT tfmt, const std::string & t0){
 
   switch (tfmt){
 
-    case TFMT_DEF:
-      switch (ttype){
-        case TIME_V1: {
-          uint64_t v = graphene_time_unpack_v1(t);
-          std::ostringstream ss;
-          ss << v/1000;
-          //if (t%1000)
-          ss << "." << std::setw(9) << std::setfill('0') << (v%1000)*1000000;
-          return ss.str();
-        }
-        case TIME_V2: {
-          uint64_t v = graphene_time_unpack_v2(t);
-          std::ostringstream ss;
-          ss << (v>>32);
-          //if (t&0xFFFFFFFF)
-          ss << "." << std::setw(9) << std::setfill('0') << (v&0xFFFFFFFF);
-          return ss.str();
-        }
-        default: throw Err() << "Unknown time type: " << ttype;
-      }
+    case TFMT_DEF: {
+      std::string ret;
+      graphene_time_append(ret, t, ttype);
+      return ret;
+    }
 
     case TFMT_REL: {
-      std::string t0s = graphene_time_parse(t0, ttype);
-      std::ostringstream ss;
-      ss << std::fixed << std::setprecision(9)
-         << graphene_time_diff(t, t0s, ttype);
-      return ss.str();
+      GrapheneTime t0t = graphene_time_parse_t(t0, ttype);
+      char buf[32];
+      int n = snprintf(buf, sizeof(buf), "%.9f",
+                       graphene_time_diff(t, t0t, ttype));
+      return std::string(buf, n);
     }
 
     default: throw Err() << "Unknown time format " << tfmt;
   }
 }
 
+/********************************************************************/
+// versions for packed timestamps
+
+double
+graphene_time_diff(const GrapheneView & t1, const GrapheneView & t2,
+                   const TimeType ttype){
+  return graphene_time_diff(graphene_time_unpack(t1, ttype),
+                            graphene_time_unpack(t2, ttype), ttype);
+}
+
+int
+graphene_time_cmp(const GrapheneView & t1, const GrapheneView & t2,
+                  const TimeType ttype){
+  GrapheneTime v1 = graphene_time_unpack(t1, ttype);
+  GrapheneTime v2 = graphene_time_unpack(t2, ttype);
+  if (v1==v2) return 0;
+  return v1>v2 ? 1:-1;
+}
+
+bool
+graphene_time_zero(const GrapheneView & t, const TimeType ttype){
+  return graphene_time_unpack(t, ttype).zero();
+}
+
+std::string
+graphene_time_add(const GrapheneView & t1, const GrapheneView & t2,
+                  const TimeType ttype){
+  return graphene_time_pack(graphene_time_add(
+    graphene_time_unpack(t1, ttype), graphene_time_unpack(t2, ttype), ttype), ttype);
+}
+
+std::string
+graphene_time_print(const GrapheneView & t, const TimeType ttype,
+                    const TimeFMT tfmt, const std::string & t0){
+  return graphene_time_print(graphene_time_unpack(t, ttype), ttype, tfmt, t0);
+}
 
 /********************************************************************/
 
 std::string
 graphene_interpolate(
-        const std::string & k0,
-        const std::string & k1, const std::string & k2,
-        const std::string & v1, const std::string & v2,
+        const GrapheneView & k0,
+        const GrapheneView & k1, const GrapheneView & k2,
+        const GrapheneView & v1, const GrapheneView & v2,
+        const TimeType ttype, const DataType dtype){
+  return graphene_interpolate(
+     graphene_time_unpack(k0, ttype),
+     graphene_time_unpack(k1, ttype),
+     graphene_time_unpack(k2, ttype), v1, v2, ttype, dtype);
+}
+
+std::string
+graphene_interpolate(
+        const GrapheneTime & k0,
+        const GrapheneTime & k1, const GrapheneTime & k2,
+        const GrapheneView & v1, const GrapheneView & v2,
         const TimeType ttype, const DataType dtype){
 
   double dt1 = graphene_time_diff(k0,k1, ttype);
@@ -5,8 +5,26 @@
 #define GRAPHENE_DATA_H
 
 #include <string>
+#include <vector>
 #include <cstdint>
 
+/********************************************************************/
+// Non-owning view of packed data (timestamp or value) stored
+// somewhere else, e.g. in a database cursor buffer.
+// Can be constructed from std::string implicitly.
+class GrapheneView {
+  const char *d;
+  size_t n;
+  public:
+  GrapheneView(): d(NULL), n(0) {}
+  GrapheneView(const char *d_, const size_t n_): d(d_), n(n_) {}
+  GrapheneView(const std::string & s): d(s.data()), n(s.size()) {}
+
+  const char * data() const {return d;}
+  size_t size() const {return n;}
+  std::string str() const {return std::string(d, d+n);}
+};
+
 /********************************************************************/
 // Enum for the data type
 enum DataType { DATA_TEXT,
@@ -34,13 +52,33 @@ std::string graphene_data_parse(
   const DataType dtype
 );
 
+// Check packed data coming from outside (binary protocol): for
+// numerical types size should be a non-zero multiple of the type size.
+void graphene_data_check(const GrapheneView & s, const DataType dtype);
+
 // Print packed data for output
 std::vector<std::string> graphene_data_print(
-  const std::string & s,
+  const GrapheneView & s,
   const int col,
   const DataType dtype
 );
 
+// Append column i of packed numerical data to a string
+// (same format as in graphene_data_print, no range checks).
+void graphene_data_append(
+  std::string & out,
+  const GrapheneView & s,
+  const size_t i,
+  const DataType dtype
+);
+
+// Get column i of packed numerical data as a double value
+// (no range checks).
+double graphene_data_get(
+  const GrapheneView & s,
+  const size_t i,
+  const DataType dtype
+);
 
 /********************************************************************/
 
@@ -63,6 +101,106 @@ TimeFMT graphene_tfmt_parse(const std::string & s);
 // Convert TimeFMT to string.
 std::string graphene_tfmt_name(const TimeFMT tfmt);
 
+/********************************************************************/
+// Unpacked timestamp, a value type for time arithmetic.
+// For TIME_V2 high 32 bits contain seconds, low 32 bits contain
+// nanoseconds; for TIME_V1 it is number of milliseconds.
+// In both cases values can be compared directly.
+class GrapheneTime {
+  uint64_t v;
+  public:
+  constexpr GrapheneTime(): v(0) {}
+  constexpr explicit GrapheneTime(const uint64_t v_): v(v_) {}
+
+  // make timestamp from seconds and nanoseconds
+  // (for TIME_V1 sub-millisecond part is truncated)
+  static constexpr GrapheneTime make(
+      const uint64_t s, const uint32_t ns, const TimeType ttype){
+    return GrapheneTime(ttype==TIME_V2? (s<<32) + ns : s*1000 + ns/1000000); }
+
+  // largest possible timestamp
+  static constexpr GrapheneTime max(const TimeType ttype){
+    return GrapheneTime(ttype==TIME_V2?
+      ((uint64_t)0xFFFFFFFF<<32) + 999999999 : (uint64_t)-1); }
+
+  constexpr uint64_t val() const { return v; }
+
+  // seconds and nanoseconds
+  constexpr uint64_t sec(const TimeType ttype) const {
+    return ttype==TIME_V2? v>>32 : v/1000; }
+  constexpr uint32_t nsec(const TimeType ttype) const {
+    return ttype==TIME_V2? v&0xFFFFFFFF : (v%1000)*1000000; }
+
+  constexpr bool zero() const { return v==0; }
+  constexpr bool operator==(const GrapheneTime & t) const { return v==t.v; }
+  constexpr bool operator!=(const GrapheneTime & t) const { return v!=t.v; }
+  constexpr bool operator< (const GrapheneTime & t) const { return v<t.v; }
+  constexpr bool operator> (const GrapheneTime & t) const { return v>t.v; }
+  constexpr bool operator<=(const GrapheneTime & t) const { return v<=t.v; }
+  constexpr bool operator>=(const GrapheneTime & t) const { return v>=t.v; }
+};
+
+// Unpack time (4- or 8-byte database key).
+GrapheneTime graphene_time_unpack(
+  const GrapheneView & t,
+  const TimeType ttype);
+
+// Pack time into a buffer (at least 8 bytes), return number
+// of bytes written. TIME_V2 uses 4 bytes if nanosecond field is zero.
+size_t graphene_time_pack(
+  const GrapheneTime & t,
+  const TimeType ttype,
+  char *buf);
+
+// Pack time into a string.
+std::string graphene_time_pack(
+  const GrapheneTime & t,
+  const TimeType ttype);
+
+// Parse time without packing.
+GrapheneTime graphene_time_parse_t(
+  const std::string & str,
+  const TimeType ttype);
+
+// Time difference (t1-t2) in seconds.
+double graphene_time_diff(
+  const GrapheneTime & t1,
+  const GrapheneTime & t2,
+  const TimeType ttype);
+
+// Add two timestamps, throw error on overflow.
+GrapheneTime graphene_time_add(
+  const GrapheneTime & t1,
+  const GrapheneTime & t2,
+  const TimeType ttype);
+
+// Timestamp as a linear number of ms (TIME_V1) or ns (TIME_V2).
+uint64_t graphene_time_to_units(
+  const GrapheneTime & t,
+  const TimeType ttype);
+
+// Timestamp from a number of ms (TIME_V1) or ns (TIME_V2).
+GrapheneTime graphene_time_from_units(
+  const uint64_t u,
+  const TimeType ttype);
+
+// Append timestamp to a string (default format).
+void graphene_time_append(
+  std::string & out,
+  const GrapheneTime & t,
+  const TimeType ttype);
+
+// Print timestamp.
+// t0 is the reference time for relative output (non-parsed text string!).
+std::string graphene_time_print(
+  const GrapheneTime & t,
+  const TimeType ttype,
+  const TimeFMT tfmt = TFMT_DEF,
+  const std::string & t0 = "");
+
+/********************************************************************/
+// Same functions for packed timestamps.
+
 
 // Parse and pack time.
 // Data is coming from user interface as a string.
@@ -77,33 +215,33 @@ std::string graphene_time_parse(
 // Calculate time difference (t1-t2) for two packed times,
 // return number of seconds as double value
 double graphene_time_diff(
-  const std::string & t1,
-  const std::string & t2,
+  const GrapheneView & t1,
+  const GrapheneView & t2,
   const TimeType ttype);
 
 // Return -1, 0 or 1 if t1<t2, t1==t2, t1>t2
 int graphene_time_cmp(
-  const std::string & t1,
-  const std::string & t2,
+  const GrapheneView & t1,
+  const GrapheneView & t2,
   const TimeType ttype);
 
 // Check if time is zero
 bool graphene_time_zero(
-  const std::string & t,
+  const GrapheneView & t,
   const TimeType ttype);
 
 // Add two timestamps represented as packed strings, return
 // result as a packed string.
 std::string graphene_time_add(
-  const std::string & t1,
-  const std::string & t2,
+  const GrapheneView & t1,
+  const GrapheneView & t2,
   const TimeType ttype);
 
 
 // Print timestamp.
 // t0 is the reference time for relative output (non-parsed text string!).
 std::string graphene_time_print(
-  const std::string & t,
+  const GrapheneView & t,
   const TimeType ttype,
   const TimeFMT tfmt = TFMT_DEF,
   const std::string & t0 = "");
@@ -112,12 +250,19 @@ std::string graphene_time_print(
 /********************************************************************/
 
 // Interpolate data (for FLOAT and DOUBLE values).
-// Arguments k0,k1,k2,v1,v2 and return value are packed strings!
+// Arguments k0,k1,k2,v1,v2 and return value are packed data!
+
+std::string graphene_interpolate(
+        const GrapheneView & k0,
+        const GrapheneView & k1, const GrapheneView & k2,
+        const GrapheneView & v1, const GrapheneView & v2,
+        const TimeType ttype, const DataType dtype);
 
+// Same with unpacked timestamps.
 std::string graphene_interpolate(
-        const std::string & k0,
-        const std::string & k1, const std::string & k2,
-        const std::string & v1, const std::string & v2,
+        const GrapheneTime & k0,
+        const GrapheneTime & k1, const GrapheneTime & k2,
+        const GrapheneView & v1, const GrapheneView & v2,
         const TimeType ttype, const DataType dtype);
 
 /********************************************************************/
@@ -334,6 +334,17 @@ int main() {
     assert_err(graphene_data_parse_str("1e88", DATA_FLOAT),
       "Bad FLOAT value: 1e88");
 
+    assert_err(graphene_data_parse_str("1e", DATA_FLOAT),
+      "Bad FLOAT value: 1e");
+
+    assert_err(graphene_data_parse_str("0x10", DATA_FLOAT),
+      "Bad FLOAT value: 0x10");
+
+    // underflow is not an error
+    s = graphene_data_parse_str("+1.5e-60 .5", DATA_FLOAT);
+    assert_eq(graphene_data_print_str(s,0,DATA_FLOAT), "0");
+    assert_eq(graphene_data_print_str(s,1,DATA_FLOAT), "0.5");
+
     assert_err(graphene_data_parse_str("", DATA_FLOAT),
       "Some data expected");
 
@@ -358,6 +369,14 @@ int main() {
       assert_eq(isnan(f[5]), true);
     }
 
+    // check packed data
+    graphene_data_check(s, DATA_DOUBLE);
+    graphene_data_check(std::string(), DATA_TEXT);
+    assert_err(graphene_data_check(std::string(), DATA_DOUBLE),
+      "Some data expected");
+    assert_err(graphene_data_check(s.substr(0,12), DATA_DOUBLE),
+      "Bad DOUBLE data size: 12");
+
     assert_err(graphene_data_parse_str("1 a", DATA_DOUBLE),
       "Bad DOUBLE value: a");
 
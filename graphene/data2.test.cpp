@@ -73,6 +73,12 @@ int main() {
     assert_err(graphene_time_parse("1.a", tt),
       "Bad timestamp: can't read fractional part: 1.a");
 
+    assert_err(graphene_time_parse("1.-2", tt),
+      "Bad timestamp: can't read fractional part: 1.-2");
+
+    assert_eq(graphene_time_print(graphene_time_parse(" +1 .5", tt), tt),
+      "1.500000000");
+
     assert_err(graphene_time_parse("", tt),
       "Empty timestamp");
 
@@ -518,6 +524,43 @@ int main() {
        graphene_time_parse("123.456", tt), tt, TFMT_REL, "12.345"),
        "111.111000000");
 
+    /**************************************************************/
+    // Unpacked timestamps
+    /**************************************************************/
+
+    tt = TIME_V1;
+    assert_eq(GrapheneTime::make(1000, 999000000, tt).val(), 1000999);
+    assert_eq(GrapheneTime::make(1000, 999999, tt).val(), 1000000);
+    assert_eq(GrapheneTime::max(tt).val(), (uint64_t)-1);
+    assert_eq(GrapheneTime(1000999).sec(tt), 1000);
+    assert_eq(GrapheneTime(1000999).nsec(tt), 999000000);
+    assert_eq(graphene_time_pack(GrapheneTime(1000999), tt), graphene_time_parse("1000.999", tt));
+    assert_eq(graphene_time_unpack(graphene_time_parse("1000.999", tt), tt).val(), 1000999);
+    assert_eq(graphene_time_parse_t("1000.999", tt).val(), 1000999);
+    assert_err(graphene_time_unpack(std::string(4, '\0'), tt),
+      "Broken database: wrong timestamp size: 4");
+
+    tt = TIME_V2;
+    assert_eq(GrapheneTime::make(1, 2, tt).val(), (1l<<32) + 2);
+    assert_eq(GrapheneTime::max(tt).val(), (max<<32) + 999999999);
+    assert_eq(GrapheneTime((1l<<32) + 2).sec(tt), 1);
+    assert_eq(GrapheneTime((1l<<32) + 2).nsec(tt), 2);
+    assert_eq(graphene_time_pack(GrapheneTime(1l<<32), tt).size(), 4);
+    assert_eq(graphene_time_pack(GrapheneTime((1l<<32) + 2), tt).size(), 8);
+    assert_eq(graphene_time_unpack(graphene_time_parse("1", tt), tt).val(), 1l<<32);
+    assert_eq(graphene_time_unpack(graphene_time_parse("1+", tt), tt).val(), (1l<<32) + 1);
+    assert_err(graphene_time_unpack(std::string(2, '\0'), tt),
+      "Broken database: wrong timestamp size: 2");
+
+    assert_eq(GrapheneTime(1) < GrapheneTime(2), true);
+    assert_eq(GrapheneTime(2) == GrapheneTime(2), true);
+    assert_eq(GrapheneTime().zero(), true);
+    assert_eq(graphene_time_add(GrapheneTime::make(1, 999999999, tt),
+      GrapheneTime::make(0, 1, tt), tt).val(), 2l<<32);
+    assert_err(graphene_time_add(GrapheneTime::max(tt),
+      GrapheneTime::make(1, 0, tt), tt), "graphene_time_add overfull");
+    assert_eq(graphene_time_print(GrapheneTime::make(1, 2, tt), tt), "1.000000002");
+
     /**************************************************************/
     // SPP text
     /**************************************************************/
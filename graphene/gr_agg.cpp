@@ -0,0 +1,249 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "gr_agg.h"
+#include "err/err.h"
+
+AggMode
+graphene_agg_parse(const std::string & s){
+  if (strcasecmp(s.c_str(), "none")==0)   return AGG_NONE;
+  if (strcasecmp(s.c_str(), "min")==0)    return AGG_MIN;
+  if (strcasecmp(s.c_str(), "max")==0)    return AGG_MAX;
+  if (strcasecmp(s.c_str(), "mean")==0)   return AGG_MEAN;
+  if (strcasecmp(s.c_str(), "first")==0)  return AGG_FIRST;
+  if (strcasecmp(s.c_str(), "last")==0)   return AGG_LAST;
+  if (strcasecmp(s.c_str(), "count")==0)  return AGG_COUNT;
+  if (strcasecmp(s.c_str(), "minmax")==0) return AGG_MINMAX;
+  if (strcasecmp(s.c_str(), "interp")==0) return AGG_INTERP;
+  throw Err() << "Unknown aggregation mode: " << s;
+}
+
+std::string
+graphene_agg_name(const AggMode agg){
+  switch (agg) {
+    case AGG_NONE:   return "none";
+    case AGG_MIN:    return "min";
+    case AGG_MAX:    return "max";
+    case AGG_MEAN:   return "mean";
+    case AGG_FIRST:  return "first";
+    case AGG_LAST:   return "last";
+    case AGG_COUNT:  return "count";
+    case AGG_MINMAX: return "minmax";
+    case AGG_INTERP: return "interp";
+    default: throw Err() << "Unknown aggregation mode: " << agg;
+  }
+}
+
+/***********************************************************/
+GrapheneAggData::GrapheneAggData(const DataType dtype_):
+    dtype(dtype_), ds(graphene_dtype_size(dtype_)), nrec(0) {}
+
+void
+GrapheneAggData::clear(){
+  nrec = 0;
+  vmin.clear(); vmax.clear();
+  sum.clear(); nnum.clear();
+}
+
+void
+GrapheneAggData::upd(const size_t i, const char *pmin, const char *pmax,
+                     const double s, const uint64_t n){
+  // new column
+  if (i >= ncol()){
+    vmin.append(pmin, ds);
+    vmax.append(pmax, ds);
+    sum.push_back(s);
+    nnum.push_back(n);
+    return;
+  }
+  double x0 = graphene_data_get(vmin, i, dtype);
+  double x1 = graphene_data_get(GrapheneView(pmin, ds), 0, dtype);
+  if (!std::isnan(x1) && (std::isnan(x0) || x1<x0))
+    memcpy(&vmin[i*ds], pmin, ds);
+
+  x0 = graphene_data_get(vmax, i, dtype);
+  x1 = graphene_data_get(GrapheneView(pmax, ds), 0, dtype);
+  if (!std::isnan(x1) && (std::isnan(x0) || x1>x0))
+    memcpy(&vmax[i*ds], pmax, ds);
+
+  sum[i] += s;
+  nnum[i] += n;
+}
+
+void
+GrapheneAggData::add(const GrapheneView & v){
+  nrec++;
+  if (dtype == DATA_TEXT) return;
+  size_t n = v.size()/ds;
+  for (size_t i=0; i<n; i++){
+    const char *p = v.data() + i*ds;
+    double x = graphene_data_get(v, i, dtype);
+    bool nan = std::isnan(x);
+    upd(i, p, p, nan? 0:x, nan? 0:1);
+  }
+}
+
+void
+GrapheneAggData::add_packed(const GrapheneView & r, const int col){
+  if (r.size() < sizeof(uint64_t))
+    throw Err() << "Broken rollup record";
+  size_t rs = 2*ds + sizeof(double) + sizeof(uint64_t); // size per column
+  size_t n = (dtype == DATA_TEXT)? 0 : (r.size()-sizeof(uint64_t))/rs;
+  if (r.size() != sizeof(uint64_t) + n*rs)
+    throw Err() << "Broken rollup record";
+
+  nrec += *(uint64_t *)r.data();
+  const char *pmin = r.data() + sizeof(uint64_t);
+  const char *pmax = pmin + n*ds;
+  const double   *ps = (const double *)(pmax + n*ds);
+  const uint64_t *pn = (const uint64_t *)(ps + n);
+  size_t c1=0, c2=n;
+  if (col>=0) { c1=col; c2=std::min((size_t)col+1, n); }
+  for (size_t i=c1; i<c2; i++)
+    upd(i-c1, pmin + i*ds, pmax + i*ds, ps[i], pn[i]);
+}
+
+std::string
+GrapheneAggData::pack() const {
+  std::string ret((char *)&nrec, sizeof(nrec));
+  ret += vmin;
+  ret += vmax;
+  ret.append((char *)sum.data(), sum.size()*sizeof(double));
+  ret.append((char *)nnum.data(), nnum.size()*sizeof(uint64_t));
+  return ret;
+}
+
+std::string
+GrapheneAggData::mean() const {
+  std::vector<double> m(ncol());
+  for (size_t i=0; i<m.size(); i++)
+    m[i] = nnum[i]? sum[i]/nnum[i] : NAN;
+  return std::string((char *)m.data(), m.size()*sizeof(double));
+}
+
+std::string
+GrapheneAggData::minmax() const {
+  std::string v(2*vmin.size(), '\0');
+  for (size_t i=0; i<ncol(); i++){
+    memcpy(&v[2*i*ds],     &vmin[i*ds], ds);
+    memcpy(&v[(2*i+1)*ds], &vmax[i*ds], ds);
+  }
+  return v;
+}
+
+/***********************************************************/
+GrapheneAgg::GrapheneAgg(GrapheneFormatter & out_, const AggMode mode_, const int col_,
+             const GrapheneTime & t1, const GrapheneTime & dt,
+             const TimeType ttype_, const DataType dtype_):
+    out(out_), mode(mode_), col(col_),
+    u1(graphene_time_to_units(t1, ttype_)),
+    du(graphene_time_to_units(dt, ttype_)),
+    have(false), ub(0), data(dtype_), ttype(ttype_), dtype(dtype_) {
+
+  if (mode == AGG_NONE || mode == AGG_INTERP)
+    throw Err() << "Aggregation mode expected";
+
+  if (dtype == DATA_TEXT &&
+      mode != AGG_FIRST && mode != AGG_LAST && mode != AGG_COUNT)
+    throw Err() << "Can not do " << graphene_agg_name(mode)
+                << " aggregation of TEXT data";
+}
+
+GrapheneTime
+GrapheneAgg::get_dt() const {
+  return graphene_time_from_units(du, ttype);
+}
+
+GrapheneTime
+GrapheneAgg::get_bucket(const GrapheneTime &k) const {
+  uint64_t u = graphene_time_to_units(k, ttype);
+  return graphene_time_from_units(du? u1 + (u - u1)/du*du : u1, ttype);
+}
+
+void
+GrapheneAgg::set_bucket(const GrapheneTime &k){
+  uint64_t u = graphene_time_to_units(k, ttype);
+  uint64_t b = du? u1 + (u - u1)/du*du : 0;
+  if (have && b != ub) flush();
+  if (!have){
+    have = true;
+    ub = b;
+    tb = du? graphene_time_from_units(b, ttype) : k;
+    data.clear();
+  }
+}
+
+void
+GrapheneAgg::proc_point(const GrapheneTime &k, const GrapheneView &v,
+                        const TimeType ttype_, const DataType dtype_) {
+
+  set_bucket(k);
+
+  // select the column
+  GrapheneView sel = v;
+  size_t ds = graphene_dtype_size(dtype);
+  if (dtype != DATA_TEXT){
+    if (v.size() % ds != 0)
+      throw Err() << "Broken database: wrong data length";
+    if (col>=0)
+      sel = (col+1)*ds <= v.size()?
+        GrapheneView(v.data() + col*ds, ds) : GrapheneView(v.data(), 0);
+  }
+
+  switch (mode){
+    case AGG_FIRST:
+      if (data.nrec==0) { tfirst = k; vfirst.assign(sel.data(), sel.size()); }
+      data.nrec++;
+      return;
+    case AGG_LAST:
+      tlast = k; vlast.assign(sel.data(), sel.size());
+      data.nrec++;
+      return;
+    default:
+      data.add(sel);
+  }
+}
+
+void
+GrapheneAgg::proc_rollup(const GrapheneTime &k, const GrapheneView &r) {
+  if (!use_rollup())
+    throw Err() << "Can not use rollup records for "
+                << graphene_agg_name(mode) << " aggregation";
+  set_bucket(k);
+  data.add_packed(r, col);
+}
+
+void
+GrapheneAgg::flush() {
+  if (!have) return;
+  have = false;
+
+  switch (mode){
+    case AGG_FIRST:
+      out.proc_point(tfirst, vfirst, ttype, dtype);
+      break;
+    case AGG_LAST:
+      out.proc_point(tlast, vlast, ttype, dtype);
+      break;
+    case AGG_COUNT:
+      out.proc_point(tb, GrapheneView((char *)&data.nrec, sizeof(data.nrec)),
+                     ttype, DATA_UINT64);
+      break;
+    case AGG_MIN:
+      out.proc_point(tb, data.vmin, ttype, dtype);
+      break;
+    case AGG_MAX:
+      out.proc_point(tb, data.vmax, ttype, dtype);
+      break;
+    case AGG_MINMAX:
+      out.proc_point(tb, data.minmax(), ttype, dtype);
+      break;
+    case AGG_MEAN:
+      out.proc_point(tb, data.mean(), ttype, DATA_DOUBLE);
+      break;
+    default: break;
+  }
+}
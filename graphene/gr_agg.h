@@ -0,0 +1,136 @@
+/* GrapheneAgg class: aggregating formatter for get_range
+ */
+
+#ifndef GR_AGG_H
+#define GR_AGG_H
+
+#include <string>
+#include <vector>
+
+#include "gr_db.h"
+#include "data.h"
+
+/***********************************************************/
+// Enum for the aggregation mode. AGG_INTERP is not an aggregation
+// but resampling on a regular grid (see GrapheneDB::get_range_grid),
+// it is set in the same way.
+enum AggMode { AGG_NONE, AGG_MIN, AGG_MAX, AGG_MEAN,
+               AGG_FIRST, AGG_LAST, AGG_COUNT, AGG_MINMAX, AGG_INTERP };
+
+// Convert string into AggMode.
+AggMode graphene_agg_parse(const std::string & s);
+
+// Convert AggMode to string.
+std::string graphene_agg_name(const AggMode agg);
+
+/***********************************************************/
+// Aggregated data for a set of points: number of points,
+// min and max values (packed, database data type), sum and
+// number of non-NaN values for each column. NaN values are
+// skipped. For TEXT data only number of points is calculated.
+//
+// Data can be packed into a string (used for rollup records):
+// number of points (uint64), min values, max values,
+// sums (double), numbers of non-NaN values (uint64).
+class GrapheneAggData {
+  DataType dtype;
+  size_t ds; // data size
+
+  // update column i
+  void upd(const size_t i, const char *pmin, const char *pmax,
+           const double s, const uint64_t n);
+
+  public:
+  uint64_t nrec;              // number of points
+  std::string vmin, vmax;     // packed min and max values
+  std::vector<double> sum;    // sums of non-NaN values
+  std::vector<uint64_t> nnum; // numbers of non-NaN values
+
+  GrapheneAggData(const DataType dtype_);
+
+  void clear();
+
+  // number of columns
+  size_t ncol() const { return sum.size(); }
+
+  // add a point (packed value)
+  void add(const GrapheneView & v);
+
+  // add packed data, only column col if col>=0
+  void add_packed(const GrapheneView & r, const int col = -1);
+
+  // pack data
+  std::string pack() const;
+
+  // mean values (packed DOUBLE)
+  std::string mean() const;
+
+  // min and max values for each column (packed)
+  std::string minmax() const;
+};
+
+/***********************************************************/
+// Aggregating formatter. It should get every point in the time
+// range (get_range with dt=0), split points into buckets of
+// length dt starting at t1 and send one aggregated point for each
+// non-empty bucket to another formatter. If dt=0 the whole range is
+// a single bucket starting at the first point.
+//
+// Modes:
+//  min, max, mean -- value for each column, timestamp of the bucket;
+//  minmax -- min and max values for each column, timestamp of the bucket;
+//  first, last -- first/last point of the bucket;
+//  count -- number of points in the bucket (UINT64 value),
+//           timestamp of the bucket.
+// Mean values are DOUBLE, min and max keep the database data type.
+// NaN values are skipped. TEXT data can be used only with
+// first, last and count modes.
+//
+// Instead of points, packed aggregated data (rollup records)
+// can be added with proc_rollup() in all modes except first and last.
+//
+// If col>=0 only this column is aggregated.
+// flush() should be called after the last point.
+class GrapheneAgg: public GrapheneFormatter {
+  GrapheneFormatter & out;
+  AggMode mode;
+  int col;
+  uint64_t u1, du;  // range start and bucket length (ms or ns)
+
+  // current bucket
+  bool have;
+  uint64_t ub;      // bucket start (ms or ns)
+  GrapheneTime tb, tfirst, tlast;
+  std::string vfirst, vlast; // packed values
+  GrapheneAggData data;
+  TimeType ttype;
+  DataType dtype;
+
+  // switch to the bucket containing timestamp k
+  void set_bucket(const GrapheneTime &k);
+
+  public:
+  GrapheneAgg(GrapheneFormatter & out_, const AggMode mode_, const int col_,
+              const GrapheneTime & t1, const GrapheneTime & dt,
+              const TimeType ttype_, const DataType dtype_);
+
+  // can rollup records be used in this mode?
+  bool use_rollup() const { return mode!=AGG_FIRST && mode!=AGG_LAST; }
+
+  // bucket length
+  GrapheneTime get_dt() const;
+
+  // start of the bucket containing timestamp k (k>=t1, dt>0)
+  GrapheneTime get_bucket(const GrapheneTime &k) const;
+
+  void proc_point(const GrapheneTime &k, const GrapheneView &v,
+     const TimeType ttype, const DataType dtype) override;
+
+  // add a rollup record with timestamp k
+  void proc_rollup(const GrapheneTime &k, const GrapheneView &r);
+
+  // send the last bucket
+  void flush();
+};
+
+#endif
@@ -0,0 +1,332 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#include "gr_block.h"
+#include "err/err.h"
+
+/***********************************************************/
+// varints and zigzag encoding
+
+static void
+put_varint(std::string & s, uint64_t x){
+  while (x >= 0x80) { s.push_back((char)(x | 0x80)); x >>= 7; }
+  s.push_back((char)x);
+}
+
+static uint64_t
+get_varint(const char *& p, const char *e){
+  uint64_t x = 0;
+  for (int sh = 0; sh < 64; sh += 7){
+    if (p >= e) break;
+    uint8_t b = *p++;
+    x |= (uint64_t)(b & 0x7F) << sh;
+    if (!(b & 0x80)) return x;
+  }
+  throw Err() << "Broken database: bad data block";
+}
+
+static uint64_t zz_enc(const int64_t x) { return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63); }
+static int64_t  zz_dec(const uint64_t x) { return (int64_t)(x >> 1) ^ -(int64_t)(x & 1); }
+
+/***********************************************************/
+// timestamps as integer numbers
+
+static uint64_t
+time_lin(const GrapheneTime & t, const TimeType ttype){
+  if (ttype==TIME_V1) return t.val();
+  return t.sec(ttype)*1000000000ull + t.nsec(ttype);
+}
+
+static GrapheneTime
+time_unlin(const uint64_t x, const TimeType ttype){
+  if (ttype==TIME_V1) return GrapheneTime(x);
+  return GrapheneTime::make(x/1000000000ull, x%1000000000ull, ttype);
+}
+
+/***********************************************************/
+// column values as integer numbers (low bytes, sign-extended for
+// signed types)
+
+static uint64_t
+col_get(const char *p, const size_t w, const DataType dtype){
+  switch (dtype){
+    case DATA_INT8:   return (int64_t)*(int8_t*)p;
+    case DATA_INT16:  return (int64_t)*(int16_t*)p;
+    case DATA_INT32:  return (int64_t)*(int32_t*)p;
+    default: break;
+  }
+  uint64_t x = 0;
+  memcpy(&x, p, w);
+  return x;
+}
+
+static void
+col_put(std::string & s, const uint64_t x, const size_t w){
+  s.append((const char *)&x, w);
+}
+
+/***********************************************************/
+size_t
+GrapheneBlock::find(const GrapheneTime & t0) const {
+  return std::lower_bound(t.begin(), t.end(), t0) - t.begin();
+}
+
+void
+GrapheneBlock::insert(const size_t i, const GrapheneTime & t0, const std::string & v0){
+  t.insert(t.begin()+i, t0);
+  v.insert(v.begin()+i, v0);
+}
+
+void
+GrapheneBlock::erase(const size_t i1, const size_t i2){
+  t.erase(t.begin()+i1, t.begin()+i2);
+  v.erase(v.begin()+i1, v.begin()+i2);
+}
+
+/***********************************************************/
+std::string
+GrapheneBlock::encode(size_t i1, size_t i2) const {
+  if (i2 > t.size()) i2 = t.size();
+  std::string ret;
+  if (i1 >= i2) return ret;
+  put_varint(ret, i2-i1);
+
+  size_t w = graphene_dtype_size(dtype);
+  uint64_t pt = time_lin(t[i1], ttype); // previous time
+  uint64_t pd = 0;                      // previous time difference
+  const std::string empty;
+
+  for (size_t i=i1; i<i2; i++){
+    const std::string & pv = i>i1? v[i-1] : empty; // previous value
+    bool nsize = (i==i1 || v[i].size() != pv.size());
+
+    // timestamp
+    if (i>i1){
+      uint64_t ct = time_lin(t[i], ttype);
+      uint64_t d = ct - pt;
+      put_varint(ret, (zz_enc((int64_t)(d - pd))<<1) | nsize);
+      pt = ct; pd = d;
+    }
+    if (nsize) put_varint(ret, v[i].size());
+
+    // value
+    if (dtype==DATA_TEXT) { ret += v[i]; continue; }
+    if (v[i].size() % w != 0)
+      throw Err() << "Broken database: wrong data length";
+
+    for (size_t j=0; j<v[i].size(); j+=w){
+      uint64_t x = col_get(v[i].data()+j, w, dtype);
+      uint64_t p = j+w <= pv.size()? col_get(pv.data()+j, w, dtype) : 0;
+
+      if (dtype==DATA_FLOAT || dtype==DATA_DOUBLE){
+        uint64_t d = x ^ p;
+        if (d==0) { ret.push_back(0); continue; }
+        int tz = 0;
+        while (((d >> 8*tz) & 0xFF) == 0) tz++;
+        int n = w - tz;
+        while (n>1 && ((d >> 8*(tz+n-1)) & 0xFF) == 0) n--;
+        ret.push_back((char)(tz*16 + n));
+        d >>= 8*tz;
+        ret.append((const char *)&d, n);
+      }
+      else {
+        put_varint(ret, zz_enc((int64_t)(x - p)));
+      }
+    }
+  }
+  return ret;
+}
+
+/***********************************************************/
+void
+GrapheneBlock::decode(const GrapheneTime & t0, const GrapheneView & data){
+  clear();
+  const char *p = data.data();
+  const char *e = p + data.size();
+  size_t n = get_varint(p, e);
+  if (n==0 || n > data.size())
+    throw Err() << "Broken database: bad data block";
+  t.reserve(n);
+  v.reserve(n);
+
+  size_t w = graphene_dtype_size(dtype);
+  uint64_t pt = time_lin(t0, ttype);
+  uint64_t pd = 0;
+  size_t size = 0;
+  const std::string empty;
+
+  for (size_t i=0; i<n; i++){
+    // timestamp
+    bool nsize = true;
+    if (i>0){
+      uint64_t c = get_varint(p, e);
+      nsize = c & 1;
+      pd += zz_dec(c>>1);
+      pt += pd;
+    }
+    t.push_back(time_unlin(pt, ttype));
+    if (nsize) size = get_varint(p, e);
+
+    // value
+    if (dtype==DATA_TEXT) {
+      if (size > (size_t)(e-p))
+        throw Err() << "Broken database: bad data block";
+      v.push_back(std::string(p, size));
+      p += size;
+      continue;
+    }
+    if (size % w != 0)
+      throw Err() << "Broken database: bad data block";
+
+    const std::string & pv = i>0? v[i-1] : empty;
+    std::string cv;
+    cv.reserve(size);
+    for (size_t j=0; j<size; j+=w){
+      uint64_t pr = j+w <= pv.size()? col_get(pv.data()+j, w, dtype) : 0;
+      if (dtype==DATA_FLOAT || dtype==DATA_DOUBLE){
+        if (p >= e) throw Err() << "Broken database: bad data block";
+        uint8_t h = *p++;
+        int tz = h>>4, nb = h&0xF;
+        if (tz+nb > (int)w || nb > e-p || (nb==0 && tz!=0))
+          throw Err() << "Broken database: bad data block";
+        uint64_t d = 0;
+        memcpy(&d, p, nb);
+        p += nb;
+        col_put(cv, pr ^ (d << 8*tz), w);
+      }
+      else {
+        col_put(cv, pr + zz_dec(get_varint(p, e)), w);
+      }
+    }
+    v.push_back(cv);
+  }
+  if (p != e)
+    throw Err() << "Broken database: bad data block";
+}
+
+/***********************************************************/
+// GrapheneRegular
+
+#define REGULAR_MAXN 4096
+
+void
+GrapheneRegular::set(const GrapheneTime & start, const GrapheneTime & period, const uint32_t n_){
+  if (n_ == 0) {n = 0; return;}
+  if (n_ > REGULAR_MAXN)
+    throw Err() << "chunk size should be 1.." << REGULAR_MAXN << ": " << n_;
+  if (period.zero())
+    throw Err() << "non-zero period expected";
+  t0 = time_lin(start, ttype);
+  dt = time_lin(period, ttype);
+  n = n_;
+}
+
+GrapheneTime
+GrapheneRegular::start() const { return time_unlin(t0, ttype); }
+
+GrapheneTime
+GrapheneRegular::period() const { return time_unlin(dt, ttype); }
+
+bool
+GrapheneRegular::in(const GrapheneTime & t) const {
+  return n && time_lin(t, ttype) >= t0;
+}
+
+GrapheneTime
+GrapheneRegular::chunk(const GrapheneTime & t) const {
+  uint64_t l = dt*n;
+  return time_unlin(t0 + (time_lin(t, ttype) - t0)/l*l, ttype);
+}
+
+std::string
+GrapheneRegular::pack() const {
+  if (!n) return std::string();
+  std::string ret;
+  ret.append((const char *)&t0, sizeof(t0));
+  ret.append((const char *)&dt, sizeof(dt));
+  ret.append((const char *)&n,  sizeof(n));
+  return ret;
+}
+
+void
+GrapheneRegular::unpack(const std::string & s){
+  n = 0;
+  if (s.size()==0) return;
+  if (s.size() != sizeof(t0) + sizeof(dt) + sizeof(n))
+    throw Err() << "Broken database: wrong regular mode parameters";
+  memcpy(&t0, s.data(), sizeof(t0));
+  memcpy(&dt, s.data() + sizeof(t0), sizeof(dt));
+  memcpy(&n,  s.data() + sizeof(t0) + sizeof(dt), sizeof(n));
+  if (dt==0 || n==0 || n > REGULAR_MAXN)
+    throw Err() << "Broken database: wrong regular mode parameters";
+}
+
+std::string
+GrapheneRegular::encode(const GrapheneTime & key, const GrapheneBlock & b) const {
+  uint64_t k = time_lin(key, ttype);
+  std::vector<int> slot(b.size(), -1); // slot number for each point or -1
+  size_t w = 0;
+  bool wset = false;
+  std::string bitmap((n+7)/8, '\0');
+  for (size_t i=0; i<b.size(); i++){
+    uint64_t o = time_lin(b.t[i], ttype) - k;
+    if (o % dt != 0 || o/dt >= n) continue;
+    if (!wset) {w = b.v[i].size(); wset = true;}
+    if (b.v[i].size() != w) continue;
+    slot[i] = o/dt;
+    bitmap[slot[i]/8] |= 1 << (slot[i]%8);
+  }
+
+  std::string ret;
+  put_varint(ret, w);
+  ret += bitmap;
+  for (size_t i=0; i<b.size(); i++)
+    if (slot[i]>=0) ret += b.v[i];
+  for (size_t i=0; i<b.size(); i++){
+    if (slot[i]>=0) continue;
+    put_varint(ret, time_lin(b.t[i], ttype) - k);
+    put_varint(ret, b.v[i].size());
+    ret += b.v[i];
+  }
+  return ret;
+}
+
+void
+GrapheneRegular::decode(const GrapheneTime & key, const GrapheneView & data,
+                        GrapheneBlock & b) const {
+  b.clear();
+  uint64_t k = time_lin(key, ttype);
+  const char *p = data.data();
+  const char *e = p + data.size();
+  size_t w = get_varint(p, e);
+  size_t nb = (n+7)/8;
+  if (nb > (size_t)(e-p))
+    throw Err() << "Broken database: bad data chunk";
+  const char *bm = p;
+  p += nb;
+
+  // slot values
+  for (size_t j=0; j<n; j++){
+    if (!(bm[j/8] & (1 << (j%8)))) continue;
+    if (w > (size_t)(e-p))
+      throw Err() << "Broken database: bad data chunk";
+    b.t.push_back(time_unlin(k + j*dt, ttype));
+    b.v.push_back(std::string(p, w));
+    p += w;
+  }
+
+  // extra points
+  while (p < e){
+    uint64_t o = get_varint(p, e);
+    size_t s = get_varint(p, e);
+    if (o >= dt*n || s > (size_t)(e-p))
+      throw Err() << "Broken database: bad data chunk";
+    GrapheneTime t = time_unlin(k + o, ttype);
+    b.insert(b.find(t), t, std::string(p, s));
+    p += s;
+  }
+  if (b.size()==0)
+    throw Err() << "Broken database: bad data chunk";
+}
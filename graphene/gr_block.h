@@ -0,0 +1,109 @@
+/* GrapheneBlock class: a block of points stored in a single database
+   record (database version 3)
+ */
+
+#ifndef GR_BLOCK_H
+#define GR_BLOCK_H
+
+#include <string>
+#include <vector>
+
+#include "data.h"
+
+/***********************************************************/
+// Points are kept in a record with the key equal to the first
+// timestamp. Record value:
+// - number of points (varint);
+// - for each point: timestamp, value size if it was changed,
+//   value.
+//
+// Timestamps are converted to nanoseconds (milliseconds for TIME_V1)
+// and stored as zigzag varints of delta-of-delta (the first timestamp
+// is not stored). The lowest bit of this number shows that the value
+// size differs from the previous one, in this case the size (varint)
+// follows.
+//
+// FLOAT/DOUBLE values: XOR with the previous value of the same column,
+// a header byte (number of trailing zero bytes * 16 + number of
+// meaningful bytes) and meaningful bytes. Integer values: zigzag
+// varint of the difference with the previous value of the same column.
+// TEXT values are stored without change.
+//
+class GrapheneBlock {
+  public:
+  TimeType ttype;
+  DataType dtype;
+  std::vector<GrapheneTime> t; // timestamps, increasing
+  std::vector<std::string>  v; // packed values
+
+  GrapheneBlock(const TimeType ttype_, const DataType dtype_):
+    ttype(ttype_), dtype(dtype_) {}
+
+  size_t size() const {return t.size();}
+  void clear() {t.clear(); v.clear();}
+
+  // Index of the first point with timestamp >= t0 (size() if there is no such point).
+  size_t find(const GrapheneTime & t0) const;
+
+  // Insert a point at position i.
+  void insert(const size_t i, const GrapheneTime & t0, const std::string & v0);
+
+  // Remove points i1..i2-1.
+  void erase(const size_t i1, const size_t i2);
+
+  // Encode points i1..i2-1 (all points by default).
+  std::string encode(size_t i1 = 0, size_t i2 = (size_t)-1) const;
+
+  // Decode a record with key t0.
+  void decode(const GrapheneTime & t0, const GrapheneView & data);
+};
+
+/***********************************************************/
+// Regular-interval mode: points with timestamps t0 + k*dt are
+// expected. Points with t >= t0 are kept in chunks of n slots, record
+// key is the time of the first slot. Points before t0 are stored in
+// separate records as usual.
+//
+// Chunk record:
+// - size of slot values w (varint);
+// - bitmap of used slots (n bits, rounded up to bytes);
+// - values of used slots, w bytes each;
+// - extra points (timestamps not on the grid or values of a different
+//   size): time offset from the record key (varint), value size
+//   (varint), value.
+// Timestamps are converted to nanoseconds (milliseconds for TIME_V1),
+// as in GrapheneBlock.
+//
+class GrapheneRegular {
+  public:
+  TimeType ttype;
+  uint64_t t0, dt; // start time and period, nanoseconds (ms for TIME_V1)
+  uint32_t n;      // number of slots in a chunk, 0 if the mode is off
+
+  GrapheneRegular(const TimeType ttype_ = TIME_V2):
+    ttype(ttype_), t0(0), dt(0), n(0) {}
+
+  // Set parameters, n=0 switches the mode off.
+  void set(const GrapheneTime & start, const GrapheneTime & period, const uint32_t n_);
+
+  GrapheneTime start() const;
+  GrapheneTime period() const;
+
+  // Is the time inside the regular part?
+  bool in(const GrapheneTime & t) const;
+
+  // Key of the chunk containing time t (t should be inside the regular part).
+  GrapheneTime chunk(const GrapheneTime & t) const;
+
+  // Pack/unpack parameters for keeping in the database (empty string if
+  // the mode is off).
+  std::string pack() const;
+  void unpack(const std::string & s);
+
+  // Encode points of a block (all of them should belong to the chunk
+  // with the key), decode a chunk record.
+  std::string encode(const GrapheneTime & key, const GrapheneBlock & b) const;
+  void decode(const GrapheneTime & key, const GrapheneView & data, GrapheneBlock & b) const;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+
+#include "err/err.h"
+#include "err/assert_err.h"
+
+#include "gr_block.h"
+
+/***************************************************************/
+// encode and decode a block, compare with the original
+void
+check(const GrapheneBlock & b){
+  GrapheneBlock b1(b.ttype, b.dtype);
+  b1.decode(b.t[0], b.encode());
+  assert_eq(b1.size(), b.size());
+  for (size_t i=0; i<b.size(); i++){
+    assert_eq(b1.t[i].val(), b.t[i].val());
+    assert_eq(b1.v[i], b.v[i]);
+  }
+}
+
+using namespace std;
+int main() {
+  try{
+
+/***************************************************************/
+
+    // regular timestamps, slowly changing double values
+    {
+      GrapheneBlock b(TIME_V2, DATA_DOUBLE);
+      for (int i=0; i<100; i++)
+        b.insert(b.size(), graphene_time_parse_t(to_string(1000+i) + ".1", TIME_V2),
+                           graphene_data_parse({to_string(1.5 + (i/10)*0.25)}, DATA_DOUBLE));
+      check(b);
+      // 1 byte for a timestamp and 1 byte for an unchanged value
+      assert_eq(b.encode().size() < 300, true);
+
+      // find, erase, encode a part of the block
+      assert_eq(b.find(graphene_time_parse_t("1000.1", TIME_V2)), 0);
+      assert_eq(b.find(graphene_time_parse_t("1000.2", TIME_V2)), 1);
+      assert_eq(b.find(graphene_time_parse_t("2000", TIME_V2)), 100);
+      b.erase(0, 50);
+      assert_eq(b.size(), 50);
+      check(b);
+      GrapheneBlock b1(TIME_V2, DATA_DOUBLE);
+      b1.decode(b.t[10], b.encode(10, 20));
+      assert_eq(b1.size(), 10);
+      assert_eq(b1.v[9], b.v[19]);
+    }
+
+    // random timestamps and values, different number of columns
+    for (int dt=DATA_INT8; dt<=DATA_DOUBLE; dt++){
+      GrapheneBlock b(TIME_V2, (DataType)dt);
+      uint64_t s = 1000;
+      for (int i=0; i<200; i++){
+        s += rand()%3;
+        auto t = GrapheneTime::make(s, rand()%1000000000, TIME_V2);
+        if (b.size() && t <= b.t.back()) continue;
+        vector<string> d;
+        for (int j = rand()%3; j>=0; j--)
+          d.push_back(to_string(rand()%100));
+        b.insert(b.size(), t, graphene_data_parse(d, (DataType)dt));
+      }
+      check(b);
+    }
+
+    // text
+    {
+      GrapheneBlock b(TIME_V2, DATA_TEXT);
+      b.insert(0, GrapheneTime::make(10, 0, TIME_V2), "abc");
+      b.insert(1, GrapheneTime::make(20, 5, TIME_V2), "");
+      b.insert(2, GrapheneTime::make(30, 0, TIME_V2), "de\nf");
+      check(b);
+    }
+
+    // TIME_V1
+    {
+      GrapheneBlock b(TIME_V1, DATA_FLOAT);
+      b.insert(0, GrapheneTime(1000), graphene_data_parse({"1.5", "2"}, DATA_FLOAT));
+      b.insert(1, GrapheneTime(3000), graphene_data_parse({"-1.5"}, DATA_FLOAT));
+      check(b);
+    }
+
+    // broken data
+    GrapheneBlock b(TIME_V2, DATA_DOUBLE);
+    assert_err(b.decode(GrapheneTime(), string("")), "Broken database: bad data block");
+    assert_err(b.decode(GrapheneTime(), string("\x01\x08\x81", 3)), "Broken database: bad data block");
+
+    // regular-interval chunks
+    {
+      GrapheneRegular r(TIME_V2);
+      r.set(GrapheneTime::make(1000,0,TIME_V2), GrapheneTime::make(10,0,TIME_V2), 16);
+      assert_eq(r.in(GrapheneTime::make(999,0,TIME_V2)), false);
+      assert_eq(r.in(GrapheneTime::make(1000,0,TIME_V2)), true);
+      assert_eq(r.chunk(GrapheneTime::make(1159,0,TIME_V2)).sec(TIME_V2), 1000);
+      assert_eq(r.chunk(GrapheneTime::make(1160,0,TIME_V2)).sec(TIME_V2), 1160);
+
+      GrapheneRegular r1(TIME_V2);
+      r1.unpack(r.pack());
+      assert_eq(r1.t0, r.t0);
+      assert_eq(r1.dt, r.dt);
+      assert_eq(r1.n, r.n);
+
+      // points on the grid with gaps, points between grid steps,
+      // a value of a different size
+      GrapheneTime k = r.chunk(GrapheneTime::make(1200,0,TIME_V2));
+      GrapheneBlock b(TIME_V2, DATA_DOUBLE);
+      for (int i=0; i<16; i++){
+        if (i%3==0) continue;
+        b.insert(b.size(), GrapheneTime::make(1160+10*i,0,TIME_V2),
+                           graphene_data_parse({to_string(i)}, DATA_DOUBLE));
+      }
+      b.insert(b.find(GrapheneTime::make(1175,1,TIME_V2)), GrapheneTime::make(1175,1,TIME_V2),
+               graphene_data_parse({"1", "2"}, DATA_DOUBLE));
+      b.v[5] = graphene_data_parse({"1", "2"}, DATA_DOUBLE);
+      string s = r.encode(k, b);
+      // value size, bitmap, 9 regular points; offset, size and value
+      // for 2 extra points
+      assert_eq(s.size(), 1 + 2 + 9*8 + (5+6) + 2*(1+16));
+      GrapheneBlock b1(TIME_V2, DATA_DOUBLE);
+      r.decode(k, s, b1);
+      assert_eq(b1.size(), b.size());
+      for (size_t i=0; i<b.size(); i++){
+        assert_eq(b1.t[i].val(), b.t[i].val());
+        assert_eq(b1.v[i], b.v[i]);
+      }
+      assert_err(r.decode(k, string("\x08\x01\x00", 3), b1), "Broken database: bad data chunk");
+      assert_err(r.set(GrapheneTime(), GrapheneTime(), 10), "non-zero period expected");
+    }
+
+  } catch (Err E){
+    std::cerr << E.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
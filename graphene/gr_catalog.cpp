@@ -0,0 +1,206 @@
+#include <string>
+#include <vector>
+#include <regex>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "gr_catalog.h"
+#include "err/err.h"
+
+/***********************************************************/
+// Get database name from a file name, return false if it is
+// not a database file.
+static bool
+db_name(const std::string & fname, std::string & name){
+  size_t p = fname.find(".db");
+  if (fname.size()<=3 || p != fname.size()-3) return false;
+  name = fname.substr(0,p);
+  return true;
+}
+
+/***********************************************************/
+GrapheneCatalog::GrapheneCatalog(const std::string & dbpath_):
+  dbpath(dbpath_), gen(0), init(false), ifd(-1) {}
+
+GrapheneCatalog::~GrapheneCatalog(){
+  if (ifd>=0) close(ifd);
+}
+
+/***********************************************************/
+void
+GrapheneCatalog::scan(){
+  DIR *dir = opendir(dbpath.c_str());
+  if (!dir) throw Err() << "can't open database directory: " << strerror(errno);
+
+  // keep information of existing databases
+  std::map<std::string, Entry> dbs1;
+  struct dirent *ent;
+  std::string name;
+  while ((ent = readdir (dir)) != NULL) {
+    if (!db_name(ent->d_name, name)) continue;
+    auto i = dbs.find(name);
+    dbs1[name] = i==dbs.end()? Entry(++gen) : i->second;
+  }
+  closedir(dir);
+  dbs.swap(dbs1);
+}
+
+void
+GrapheneCatalog::update(){
+
+  // first request: start watching the folder, then read it
+  if (!init){
+    ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd>=0 && inotify_add_watch(ifd, dbpath.c_str(),
+          IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+          IN_MODIFY | IN_CLOSE_WRITE | IN_ONLYDIR) < 0){
+      close(ifd);
+      ifd = -1;
+    }
+    scan();
+    init = true;
+    return;
+  }
+
+  // no inotify: read the folder, forget all information
+  if (ifd<0){
+    dbs.clear();
+    scan();
+    return;
+  }
+
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  bool rescan = false;
+  while (1){
+    ssize_t len = read(ifd, buf, sizeof(buf));
+    if (len <= 0) break;
+    for (char *p = buf; p < buf + len; ) {
+      auto e = (const struct inotify_event *) p;
+      p += sizeof(struct inotify_event) + e->len;
+
+      // events were lost
+      if (e->mask & IN_Q_OVERFLOW) { rescan = true; continue; }
+
+      // the folder is removed or unmounted: stop using inotify
+      if (e->mask & IN_IGNORED) {
+        close(ifd);
+        ifd = -1;
+        dbs.clear();
+        scan();
+        return;
+      }
+
+      std::string name;
+      if (e->len==0 || !db_name(e->name, name)) continue;
+
+      if (e->mask & (IN_CREATE | IN_MOVED_TO))
+        dbs[name] = Entry(++gen);
+      else if (e->mask & (IN_DELETE | IN_MOVED_FROM))
+        dbs.erase(name);
+      else if (e->mask & (IN_MODIFY | IN_CLOSE_WRITE)) {
+        auto i = dbs.find(name);
+        if (i!=dbs.end()) mod_entry(i->second);
+      }
+    }
+  }
+  if (rescan) {
+    dbs.clear();
+    scan();
+  }
+}
+
+void
+GrapheneCatalog::mod_entry(Entry & e){
+  if (e.state>1) e.state = 1;
+  e.gen = ++gen;
+}
+
+/***********************************************************/
+std::vector<std::string>
+GrapheneCatalog::list(const std::string & prefix){
+  std::lock_guard<std::mutex> lk(m);
+  update();
+  std::vector<std::string> ret;
+  for (auto i = dbs.lower_bound(prefix); i!=dbs.end(); i++){
+    if (i->first.compare(0, prefix.size(), prefix) != 0) break;
+    ret.push_back(i->first);
+  }
+  return ret;
+}
+
+std::vector<std::string>
+GrapheneCatalog::list_re(const std::string & re){
+  std::regex r;
+  try { r = std::regex(re); }
+  catch (std::regex_error & e) {
+    throw Err() << "bad regular expression: " << re;
+  }
+  std::lock_guard<std::mutex> lk(m);
+  update();
+  std::vector<std::string> ret;
+  for (auto const & i: dbs)
+    if (std::regex_search(i.first, r)) ret.push_back(i.first);
+  return ret;
+}
+
+/***********************************************************/
+bool
+GrapheneCatalog::get_info(const std::string & name, GrapheneDBInfo & info, const bool full,
+                          uint64_t & g){
+  std::lock_guard<std::mutex> lk(m);
+  update();
+  auto i = dbs.find(name);
+  g = i==dbs.end()? 0 : i->second.gen;
+  if (i==dbs.end() || i->second.state < (full? 2:1)) return false;
+  info = i->second.info;
+  return true;
+}
+
+void
+GrapheneCatalog::set_info(const std::string & name, const GrapheneDBInfo & info, const bool full,
+                          const uint64_t g){
+  std::lock_guard<std::mutex> lk(m);
+  // without inotify the information is not kept
+  if (ifd<0) return;
+  // modifications after get_info
+  update();
+  auto i = dbs.find(name);
+  if (i==dbs.end() || i->second.gen != g) return;
+  auto & e = i->second;
+  if (e.state > (full? 2:1)) return;
+  e.info = info;
+  e.state = full? 2:1;
+}
+
+void
+GrapheneCatalog::add(const std::string & name){
+  std::lock_guard<std::mutex> lk(m);
+  if (init) dbs[name] = Entry(++gen);
+}
+
+void
+GrapheneCatalog::modified(const std::string & name){
+  std::lock_guard<std::mutex> lk(m);
+  auto i = dbs.find(name);
+  if (i!=dbs.end()) mod_entry(i->second);
+}
+
+void
+GrapheneCatalog::remove(const std::string & name){
+  std::lock_guard<std::mutex> lk(m);
+  dbs.erase(name);
+}
+
+void
+GrapheneCatalog::rename(const std::string & name1, const std::string & name2){
+  std::lock_guard<std::mutex> lk(m);
+  auto i = dbs.find(name1);
+  if (i==dbs.end()) return;
+  auto & e = dbs[name2];
+  e = i->second;
+  e.gen = ++gen;
+  dbs.erase(name1);
+}
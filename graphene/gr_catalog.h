@@ -0,0 +1,108 @@
+/* GrapheneCatalog class: cached list of databases in the data folder
+ */
+
+#ifndef GR_CATALOG_H
+#define GR_CATALOG_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include "data.h"
+
+/***********************************************************/
+// Database information kept in the catalog
+struct GrapheneDBInfo {
+  DataType dtype;
+  TimeType ttype;
+  std::string descr;
+  std::vector<int> filters; // numbers of non-empty filters
+  GrapheneDBInfo(): dtype(DATA_DOUBLE), ttype(TIME_V2) {}
+};
+
+/***********************************************************/
+// List of databases in the data folder with cached database
+// information. The folder is read once, then the list is updated
+// using inotify events and by GrapheneEnv methods which create,
+// rename and remove databases.
+//
+// Data and time types can not be changed, they are kept while the
+// database file exists. Description and filters are kept until they
+// are changed by GrapheneEnv methods or the database file is modified
+// by another program.
+//
+// Each database has a generation number which is changed on every
+// modification. Information read from a database is saved only if
+// the generation did not change after get_info.
+//
+// If inotify can not be used the folder is read on every request and
+// database information is not cached.
+//
+// The object can be shared between threads.
+class GrapheneCatalog {
+
+  // a database: information and its state
+  struct Entry {
+    int state; // 0 - no information, 1 - types, 2 - all fields
+    uint64_t gen; // generation number
+    GrapheneDBInfo info;
+    Entry(const uint64_t gen_ = 0): state(0), gen(gen_) {}
+  };
+
+  std::string dbpath;
+  std::mutex m;
+  std::map<std::string, Entry> dbs;
+  uint64_t gen; // last used generation number
+  bool init; // the folder was read
+  int ifd;   // inotify descriptor, -1 if not used
+
+  // read the folder
+  void scan();
+
+  // process inotify events (or read the folder)
+  void update();
+
+  // a database was modified: forget description and filters,
+  // change the generation number
+  void mod_entry(Entry & e);
+
+  public:
+
+  // Nothing is done before the first request.
+  GrapheneCatalog(const std::string & dbpath_);
+  ~GrapheneCatalog();
+
+  // Names of databases starting with the prefix, sorted.
+  std::vector<std::string> list(const std::string & prefix = "");
+
+  // Names of databases matching the regular expression
+  // (ECMAScript syntax, match anywhere in the name), sorted.
+  std::vector<std::string> list_re(const std::string & re);
+
+  // Get database information, return false if it is not known. If full
+  // is false only data and time types are needed. Generation number of
+  // the database is returned in gen (also if the information is not known).
+  bool get_info(const std::string & name, GrapheneDBInfo & info, const bool full,
+                uint64_t & gen);
+
+  // Save database information (full: all fields or only types) read
+  // after get_info call which returned generation gen. Nothing is done
+  // if the database was modified after get_info.
+  void set_info(const std::string & name, const GrapheneDBInfo & info, const bool full,
+                const uint64_t gen);
+
+  // A database was created (information is unknown).
+  void add(const std::string & name);
+
+  // Database description or filters were changed.
+  void modified(const std::string & name);
+
+  // A database was removed.
+  void remove(const std::string & name);
+
+  // A database was renamed.
+  void rename(const std::string & name1, const std::string & name2);
+};
+
+#endif
@@ -2,13 +2,17 @@
 #include <string>
 #include <vector>
 #include <sstream>
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <cstring> /* memset */
+#include <ctime>
+#include <sys/stat.h>
 
 #include "data.h"
 #include "gr_db.h"
+#include "gr_agg.h"
 #include "err/err.h"
 
 using namespace std;
@@ -56,6 +60,25 @@ int cmpfunc(DB *dbp, const DBT *a, const DBT *b){
 }
 
 
+/***********************************************************/
+// GrapheneDBSharedMap class
+
+std::shared_ptr<GrapheneDBShared>
+GrapheneDBSharedMap::get(const std::string & name){
+  std::lock_guard<std::mutex> lk(m);
+  auto ret = dbs[name].lock();
+  if (!ret) {
+    ret.reset(new GrapheneDBShared);
+    dbs[name] = ret;
+  }
+  // forget unused databases
+  for (auto i = dbs.begin(); i!=dbs.end(); ){
+    if (i->second.expired()) i = dbs.erase(i);
+    else i++;
+  }
+  return ret;
+}
+
 /***********************************************************/
 // GrapheneDB class
 
@@ -65,9 +88,13 @@ int cmpfunc(DB *dbp, const DBT *a, const DBT *b){
 GrapheneDB::GrapheneDB(DB_ENV *env_,
      const string & path_,
      const string & name_,
-     const int flags):
-       env(env_), name(name_),
-       ttype(DEF_TIMETYPE), dtype(DEF_DATATYPE), version(DEF_DBVERSION) {
+     const int flags,
+     const uint32_t pagesize,
+     const std::shared_ptr<GrapheneDBShared> & shared_):
+       env(env_), path(path_), name(name_),
+       ttype(DEF_TIMETYPE), dtype(DEF_DATATYPE), version(DEF_DBVERSION),
+       bulk(0), shared(shared_? shared_ : std::make_shared<GrapheneDBShared>()),
+       f0sync(0) {
 
   check_name(name); // check the name
 
@@ -100,6 +127,13 @@ GrapheneDB::GrapheneDB(DB_ENV *env_,
   if (ret != 0)
     throw Err() << name << ".db: " << db_strerror(ret);
 
+  /* set page size for a new database */
+  if (pagesize && (flags & DB_CREATE)) {
+    ret = dbp->set_pagesize(dbp.get(), pagesize);
+    if (ret != 0)
+      throw Err() << name << ".db: can't set page size " << pagesize << ": " << db_strerror(ret);
+  }
+
   /* Open the database */
   ret = dbp->open(dbp.get(),     /* Pointer to the database */
                   NULL,          /* Txn pointer */
@@ -111,8 +145,22 @@ GrapheneDB::GrapheneDB(DB_ENV *env_,
   if (ret != 0){
     throw Err() << name << ".db: " << db_strerror(ret);
   }
-  if ((flags & DB_CREATE) == 0) read_info();
+  gen = shared->gen;
+  if ((flags & DB_CREATE) == 0) {
+    read_info();
+    open_rollup();
+  }
+}
 
+/************************************/
+void
+GrapheneDB::check_info(const bool force){
+  uint64_t g = shared->gen;
+  if (g == gen && !force) return;
+  auto t = tiers;
+  read_info();
+  if (t != tiers) open_rollup();
+  gen = g;
 }
 
 /************************************/
@@ -123,43 +171,237 @@ GrapheneDB::txn_begin(int flags){
   DB_TXN *txn = NULL;
   if (env && (env_flags & DB_INIT_TXN)) {
     int ret = env->txn_begin(env, NULL, &txn, flags);
-    if (ret != 0) Err() << "Can't create a transaction: " << name << ".db: " << db_strerror(ret);
+    if (ret != 0) throw Err() << "Can't create a transaction: " << name << ".db: " << db_strerror(ret);
   }
   return txn;
 }
 
 void
-GrapheneDB::txn_commit(DB_TXN *txn){
+GrapheneDB::txn_commit(DB_TXN *txn, int flags){
   if (!txn) return;
-  int ret = txn->commit(txn, 0);
-  if (ret != 0) Err() << "Can't commit a transaction: " << name << ".db: " << db_strerror(ret);
+  int ret = txn->commit(txn, flags);
+  if (ret != 0) throw Err() << "Can't commit a transaction: " << name << ".db: " << db_strerror(ret);
 }
 
 void
 GrapheneDB::txn_abort(DB_TXN *txn){
   if (!txn) return;
   int ret = txn->abort(txn);
-  if (ret != 0) Err() << "Can't abort a transaction: " << name << ".db: " << db_strerror(ret);
+  if (ret != 0) throw Err() << "Can't abort a transaction: " << name << ".db: " << db_strerror(ret);
 }
 
 /************************************/
-// Simple wrappers for cursor actions:
+// GrapheneCursor
+
+GrapheneCursor::GrapheneCursor(DB *dbp, DB_TXN *txn, const std::string & name_,
+     const size_t bulk_): curs(NULL), name(name_), bulk(bulk_), bptr(NULL){
+  memset(&k, 0, sizeof(DBT));
+  memset(&v, 0, sizeof(DBT));
+  k.data  = kbuf;
+  k.ulen  = sizeof(kbuf);
+  k.flags = DB_DBT_USERMEM;
+  if (bulk){
+    // bulk buffer size should be a multiple of 1024
+    bulk = (bulk+1023)/1024*1024;
+    v.data = malloc(bulk);
+    if (!v.data) throw Err() << name << ".db: can't allocate bulk buffer";
+    v.ulen  = bulk;
+    v.flags = DB_DBT_USERMEM;
+  }
+  else {
+    v.flags = DB_DBT_REALLOC;
+  }
+  dbp->cursor(dbp, txn, &curs, 0);
+  if (curs==NULL)
+    throw Err() << name << ".db: can't get a cursor";
+}
 
-/* Get a cursor */
 void
-GrapheneDB::get_cursor(DB *dbp, DB_TXN *txn, DBC **curs, int flags) {
-  *curs=NULL;
-  dbp->cursor(dbp, txn, curs, flags);
-  if (*curs==NULL)
-    throw Err() << name << ".db: can't get a cursor";
+GrapheneCursor::set_key(const GrapheneView & key){
+  if (key.size() > sizeof(kbuf))
+    throw Err() << name << ".db: too long key";
+  memcpy(kbuf, key.data(), key.size());
+  k.size = key.size();
+  ck = GrapheneView(kbuf, k.size);
+}
+
+void
+GrapheneCursor::set_key(const GrapheneTime & t, const TimeType ttype){
+  k.size = graphene_time_pack(t, ttype, kbuf);
+  ck = GrapheneView(kbuf, k.size);
 }
 
 bool
-GrapheneDB::c_get(DBC *curs, DBT *k, DBT *v, int flags) {
-  int res = curs->c_get(curs, k, v, flags);
-  if (res!=0 && res!=DB_NOTFOUND)
+GrapheneCursor::bulk_next(){
+  if (!bptr) return false;
+  void *kp, *vp;
+  u_int32_t ks, vs;
+  DB_MULTIPLE_KEY_NEXT(bptr, &v, kp, ks, vp, vs);
+  if (!bptr) return false;
+  ck = GrapheneView((char*)kp, ks);
+  cv = GrapheneView((char*)vp, vs);
+  return true;
+}
+
+bool
+GrapheneCursor::get(int flags) {
+  if (!bulk){
+    int res = curs->c_get(curs, &k, &v, flags);
+    if (res == DB_BUFFER_SMALL)
+      throw Err() << "Broken database: too long key";
+    if (res!=0 && res!=DB_NOTFOUND)
+      throw Err() << name << ".db: " << db_strerror(res);
+    ck = GrapheneView((char*)k.data, k.size);
+    cv = GrapheneView((char*)v.data, v.size);
+    return res==0;
+  }
+
+  // bulk mode
+  if (flags!=DB_SET_RANGE && flags!=DB_NEXT)
+    throw Err() << name << ".db: unsupported cursor operation in bulk mode";
+
+  // next record from the buffer
+  if (flags==DB_NEXT && bulk_next()) return true;
+
+  // Read new portion of data. After this the cursor points
+  // to the last record in the buffer.
+  while (1){
+    int res = curs->c_get(curs, &k, &v, flags | DB_MULTIPLE_KEY);
+    if (res == DB_BUFFER_SMALL){
+      // a single record does not fit into the buffer: extend it
+      size_t s = (v.size+1023)/1024*1024;
+      void *p = realloc(v.data, s);
+      if (!p) throw Err() << name << ".db: can't allocate bulk buffer";
+      v.data = p;
+      v.ulen = s;
+      continue;
+    }
+    if (res == DB_NOTFOUND) {bptr = NULL; return false;}
+    if (res != 0)
+      throw Err() << name << ".db: " << db_strerror(res);
+    break;
+  }
+  DB_MULTIPLE_INIT(bptr, &v);
+  return bulk_next();
+}
+
+void
+GrapheneCursor::del() {
+  if (bulk) throw Err() << name << ".db: can't delete records in bulk mode";
+  int res = curs->del(curs, 0);
+  if (res!=0)
     throw Err() << name << ".db: " << db_strerror(res);
-  return res==0;
+}
+
+/************************************/
+// GrapheneDataCursor
+
+GrapheneDataCursor::GrapheneDataCursor(GrapheneDB & db, DB_TXN *txn, const size_t bulk):
+     name(db.name), curs(db.dbp.get(), txn, name, (db.blocks() || db.reg.n)? 0:bulk),
+     ttype(db.ttype), blocks(db.blocks() || db.reg.n), reg(db.reg),
+     blk(db.ttype, db.dtype), i(0), pos(0) {}
+
+void
+GrapheneDataCursor::set_key(const GrapheneTime & t, const TimeType ttype_){
+  if (!blocks) return curs.set_key(t, ttype_);
+  st = t;
+  pos = 0;
+}
+
+bool
+GrapheneDataCursor::load(const size_t n){
+  GrapheneTime k = curs.time(ttype);
+  if (!reg.n) blk.decode(k, curs.val());
+  else if (reg.in(k)) reg.decode(k, curs.val(), blk);
+  else { blk.clear(); blk.insert(0, k, curs.val().str()); }
+  i = n < blk.size()? n : blk.size()-1;
+  pos = 1;
+  return true;
+}
+
+bool
+GrapheneDataCursor::get(int flags){
+  if (!blocks) return curs.get(flags);
+  bool f;
+  switch (flags){
+
+    case DB_SET_RANGE:
+      // regular-interval mode: the chunk is found directly
+      if (reg.in(st)){
+        GrapheneTime c = reg.chunk(st);
+        curs.set_key(c, ttype);
+        if (!curs.get(DB_SET_RANGE)) { pos = 0; return false; }
+        load(0);
+        if (curs.time(ttype) != c) return true; // next chunk
+        i = blk.find(st);
+        if (i < blk.size()) return true;
+        if (!curs.get(DB_NEXT)) { pos = 0; return false; }
+        return load(0);
+      }
+
+      // record with key st
+      curs.set_key(st, ttype);
+      f = curs.get(DB_SET_RANGE);
+      if (f && curs.time(ttype) == st) return load(0);
+
+      // points >= st in the previous record
+      if (curs.get(f? DB_PREV : DB_LAST) && curs.is_tstamp()){
+        load(0);
+        i = blk.find(st);
+        if (i < blk.size()) return true;
+      }
+      pos = 0;
+      if (!f) return false;
+
+      // first point of the next record
+      curs.set_key(st, ttype);
+      curs.get(DB_SET_RANGE);
+      return load(0);
+
+    case DB_NEXT:
+      if (pos==1 && i+1 < blk.size()) { i++; return true; }
+      if (!curs.get(pos==0? DB_FIRST : DB_NEXT)) return false;
+      if (!curs.is_tstamp()) { pos = 2; return true; }
+      return load(0);
+
+    case DB_PREV:
+      if (pos==1 && i > 0) { i--; return true; }
+      if (pos==0) return get(DB_LAST);
+      if (!curs.get(DB_PREV)) return false;
+      if (!curs.is_tstamp()) { pos = 2; return true; }
+      return load(-1);
+
+    case DB_LAST:
+      if (!curs.get(DB_LAST)) { pos = 0; return false; }
+      if (!curs.is_tstamp()) { pos = 2; return true; }
+      return load(-1);
+  }
+  throw Err() << "unsupported cursor operation for a data cursor";
+}
+
+GrapheneView
+GrapheneDataCursor::key() const {
+  if (!blocks || pos==2) return curs.key();
+  size_t n = graphene_time_pack(pos==1? blk.t[i] : st, ttype, kbuf);
+  return GrapheneView(kbuf, n);
+}
+
+GrapheneView
+GrapheneDataCursor::val() const {
+  if (!blocks || pos!=1) return curs.val();
+  return GrapheneView(blk.v[i]);
+}
+
+GrapheneTime
+GrapheneDataCursor::time(const TimeType ttype_) const {
+  if (!blocks || pos==2) return curs.time(ttype_);
+  return pos==1? blk.t[i] : st;
+}
+
+bool
+GrapheneDataCursor::is_tstamp() const {
+  if (!blocks) return curs.is_tstamp();
+  return pos!=2;
 }
 
 /************************************/
@@ -190,6 +432,40 @@ GrapheneDB::get_key(DB_TXN *txn, uint8_t key, const std::string & def){
   throw Err() << name << ".db: " << db_strerror(ret);
 }
 
+GrapheneTime
+GrapheneDB::get_tkey(DB_TXN *txn, uint8_t key, const GrapheneTime & def){
+  DBT k = mk_dbt(&key);
+  DBT v = mk_dbt();
+  int ret = dbp->get(dbp.get(), txn, &k, &v, 0);
+  if (ret == 0) return graphene_time_unpack(GrapheneView((char*)v.data, v.size), ttype);
+  if (ret == DB_NOTFOUND) return def;
+  throw Err() << name << ".db: " << db_strerror(ret);
+}
+
+void
+GrapheneDB::set_tkey(DB_TXN *txn, uint8_t key, const GrapheneTime & t){
+  char buf[sizeof(uint64_t)];
+  DBT v = mk_dbt();
+  v.data = buf;
+  v.size = graphene_time_pack(t, ttype, buf);
+  set_key(txn, key, v);
+}
+
+uint64_t
+GrapheneDB::get_changes(DB_TXN *txn){
+  uint64_t c = 0;
+  auto str = get_key(txn, KEY_CHANGES);
+  if (str.size() == sizeof(c)) memcpy(&c, str.data(), sizeof(c));
+  return c;
+}
+
+uint64_t
+GrapheneDB::inc_changes(DB_TXN *txn){
+  uint64_t c = get_changes(txn) + 1;
+  set_key(txn, KEY_CHANGES, mk_dbt(&c));
+  return c;
+}
+
 
 /************************************/
 // Write database information.
@@ -214,8 +490,9 @@ GrapheneDB::write_info(){
     txn_abort(txn);
     throw e;
   }
-  sync();
   txn_commit(txn);
+  sync();
+  info_changed();
 }
 
 /************************************/
@@ -245,17 +522,142 @@ GrapheneDB::read_info(){
     switch (version){
       case 1: ttype=TIME_V1; break;
       case 2: ttype=TIME_V2; break;
+      case 3: ttype=TIME_V2; break; // blocks of points
       default: throw Err() << "unsupported database version: " << (int)version;
     }
 
+    // Read regular-interval mode parameters
+    reg = GrapheneRegular(ttype);
+    reg.unpack(get_key(txn, KEY_REGULAR));
+
+    // Read rollup tiers
+    tiers = GrapheneRollup::unpack_tiers(get_key(txn, KEY_ROLLUP));
+
+  }
+  catch (Err e){
+    txn_abort(txn);
+    throw e;
+  }
+  txn_commit(txn);
+}
+
+
+/************************************/
+void
+GrapheneDB::set_version(const int v){
+  if (v!=2 && v!=3)
+    throw Err() << "unsupported database version: " << v;
+  version = v;
+  ttype = TIME_V2;
+  write_info();
+}
+
+/************************************/
+void
+GrapheneDB::set_regular(const std::string & start, const std::string & period,
+                        const uint32_t n){
+  if (blocks())
+    throw Err() << name << ".db: regular-interval mode is not supported in version " << (int)version;
+  GrapheneRegular r(ttype);
+  if (n) r.set(graphene_time_parse_t(start, ttype),
+               graphene_time_parse_t(period, ttype), n);
+
+  DB_TXN *txn = txn_begin();
+  try {
+    // records are arranged differently, the database should be empty
+    {
+      GrapheneCursor curs(dbp.get(), txn, name);
+      curs.set_key(GrapheneTime(), ttype);
+      if (curs.get(DB_SET_RANGE) && curs.is_tstamp())
+        throw Err() << name << ".db: can't change regular-interval mode of a database with data";
+    }
+    if (n) set_key(txn, KEY_REGULAR, mk_dbt(r.pack()));
+    else del_key(txn, KEY_REGULAR);
   }
   catch (Err e){
     txn_abort(txn);
     throw e;
   }
   txn_commit(txn);
+  reg = r;
+  sync();
+  info_changed();
 }
 
+/************************************/
+void
+GrapheneDB::open_rollup(){
+  rollup.reset();
+  if (tiers.size()==0) return;
+
+  // The companion database can be missing (e.g. only *.db files were
+  // copied). In readonly mode raw points are used, otherwise it is
+  // created and rebuilt.
+  struct stat buf;
+  bool missing = stat((path + "/" + name + ".rollup").c_str(), &buf)!=0;
+  if (missing && (open_flags & DB_RDONLY)) return;
+
+  std::shared_ptr<GrapheneRollup> r(new GrapheneRollup(
+    env, path, name, open_flags, ttype, dtype, tiers));
+  r->set_bulk(bulk);
+  if (missing){
+    DB_TXN *txn = txn_begin();
+    try { r->rebuild(txn, *this, GrapheneTime(), GrapheneTime::max(ttype)); }
+    catch (Err e){
+      txn_abort(txn);
+      throw e;
+    }
+    txn_commit(txn);
+  }
+  rollup = r;
+}
+
+/************************************/
+void
+GrapheneDB::set_rollup(const std::vector<uint32_t> & t){
+  GrapheneRollup::check_tiers(t);
+  if (t.size()==0 && !rollup) {
+    // nothing to clear
+    DB_TXN *txn = txn_begin();
+    try { del_key(txn, KEY_ROLLUP); }
+    catch (Err e){
+      txn_abort(txn);
+      throw e;
+    }
+    txn_commit(txn);
+    tiers = t;
+    info_changed();
+    return;
+  }
+
+  // open the rollup database with new tiers
+  rollup.reset();
+  std::shared_ptr<GrapheneRollup> r(new GrapheneRollup(
+    env, path, name, open_flags, ttype, dtype, t));
+  r->set_bulk(bulk);
+
+  // do everything in a single transaction
+  DB_TXN *txn = txn_begin();
+  try {
+    r->clear(txn);
+    if (t.size()) {
+      set_key(txn, KEY_ROLLUP, mk_dbt(GrapheneRollup::pack_tiers(t)));
+      r->rebuild(txn, *this, GrapheneTime(), GrapheneTime::max(ttype));
+    }
+    else
+      del_key(txn, KEY_ROLLUP);
+  }
+  catch (Err e){
+    txn_abort(txn);
+    open_rollup(); // old tiers
+    throw e;
+  }
+  txn_commit(txn);
+  tiers = t;
+  if (tiers.size()) rollup = r;
+  sync();
+  info_changed();
+}
 
 /************************************/
 void
@@ -263,15 +665,19 @@ GrapheneDB::clear_filter(const int n){
   if (n<0 || n>MAX_FILTERS)
     throw Err() << "filter number out of range: " << n;
 
-  int ret;
+  uint64_t c;
   DB_TXN *txn = txn_begin(DB_TXN_SNAPSHOT);
-  try { del_key(txn, KEY_FLT+n); }
+  try {
+    del_key(txn, KEY_FLT+n);
+    c = inc_changes(txn);
+  }
   catch (Err e){
     txn_abort(txn);
     throw e;
   }
-  sync();
   txn_commit(txn);
+  sync();
+  cache_filter(c, n, "");
 }
 
 /************************************/
@@ -279,15 +685,41 @@ std::string
 GrapheneDB::get_filter(const int n){
   if (n<0 || n>MAX_FILTERS) return "";
 
+  // The change counter and the code are read in one transaction.
+  // If the counter is older than the cached one (a concurrent
+  // change), the code is not cached.
+  std::lock_guard<std::mutex> lk(shared->m);
   DB_TXN *txn = txn_begin(DB_TXN_SNAPSHOT);
-  std::string storage;
-  try { storage = get_key(txn, KEY_FLT+n); }
+  std::string code;
+  try {
+    uint64_t c = get_changes(txn);
+    if (c > shared->changes) {
+      shared->filters.clear();
+      shared->changes = c;
+    }
+    auto i = shared->filters.find(n);
+    if (c == shared->changes && i!=shared->filters.end())
+      code = i->second;
+    else {
+      code = get_key(txn, KEY_FLT+n);
+      if (c == shared->changes) shared->filters[n] = code;
+    }
+  }
   catch (Err e){
     txn_abort(txn);
     throw e;
   }
   txn_commit(txn);
-  return storage;
+  return code;
+}
+
+void
+GrapheneDB::cache_filter(const uint64_t c, const int n, const std::string & code){
+  std::lock_guard<std::mutex> lk(shared->m);
+  if (c < shared->changes) return;
+  if (c != shared->changes+1) shared->filters.clear();
+  shared->changes = c;
+  shared->filters[n] = code;
 }
 
 /************************************/
@@ -296,16 +728,26 @@ GrapheneDB::write_filter(const int n, const std::string & code){
   if (n<0 || n>MAX_FILTERS)
     throw Err() << "filter number out of range: " << n;
 
+  uint64_t c;
   DB_TXN *txn = txn_begin(DB_TXN_SNAPSHOT);
   try {
     if (n==0) del_key(txn, KEY_FLT0DATA);
-    set_key(txn, KEY_FLT+n, mk_dbt(code)); }
+    set_key(txn, KEY_FLT+n, mk_dbt(code));
+    c = inc_changes(txn);
+  }
   catch (Err e){
     txn_abort(txn);
     throw e;
   }
-  sync(); // a very slow operation
   txn_commit(txn);
+  sync(); // a very slow operation
+  cache_filter(c, n, code);
+  if (n==0) {
+    std::lock_guard<std::mutex> lk(shared->m);
+    shared->f0data = "";
+    shared->f0data_rd = true;
+    shared->f0data_mod = false;
+  }
 }
 
 
@@ -319,13 +761,19 @@ GrapheneDB::clear_f0data(){
     txn_abort(txn);
     throw e;
   }
-  sync();
   txn_commit(txn);
+  sync();
+  std::lock_guard<std::mutex> lk(shared->m);
+  shared->f0data = "";
+  shared->f0data_rd = true;
+  shared->f0data_mod = false;
 }
 
 /************************************/
 std::string
 GrapheneDB::get_f0data(){
+  std::lock_guard<std::mutex> lk(shared->m);
+  if (shared->f0data_rd) return shared->f0data;
 
   DB_TXN *txn = txn_begin(DB_TXN_SNAPSHOT);
   std::string storage;
@@ -335,19 +783,40 @@ GrapheneDB::get_f0data(){
     throw e;
   }
   txn_commit(txn);
+  shared->f0data = storage;
+  shared->f0data_rd = true;
   return storage;
 }
 
 /************************************/
 void
 GrapheneDB::write_f0data(const std::string & storage){
+  std::lock_guard<std::mutex> lk(shared->m);
+  shared->f0data = storage;
+  shared->f0data_rd = true;
+  shared->f0data_mod = true;
+  if (f0sync<=0 || time(NULL) - shared->f0data_t >= f0sync) write_f0data_db();
+}
+
+/************************************/
+void
+GrapheneDB::flush_f0data(){
+  std::lock_guard<std::mutex> lk(shared->m);
+  write_f0data_db();
+}
+
+void
+GrapheneDB::write_f0data_db(){
+  if (!shared->f0data_mod) return;
   DB_TXN *txn = txn_begin(DB_TXN_SNAPSHOT);
-  try { set_key(txn, KEY_FLT0DATA, mk_dbt(storage)); }
+  try { set_key(txn, KEY_FLT0DATA, mk_dbt(shared->f0data)); }
   catch (Err e){
     txn_abort(txn);
     throw e;
   }
   txn_commit(txn);
+  shared->f0data_mod = false;
+  shared->f0data_t = time(NULL);
 }
 
 
@@ -360,12 +829,9 @@ GrapheneDB::backup_start(){
   DB_TXN *txn = txn_begin();
   try {
     // reset temporary timer to inf
-    auto t = graphene_time_parse("inf", ttype);
-    set_key(txn, KEY_BACKUP_TMP, mk_dbt(t));
-    // return main backup timer value:
-    t = graphene_time_parse("0",ttype); // default
-    t = get_key(txn, KEY_BACKUP_MAIN, t);
-    ret = graphene_time_print(t, ttype);
+    set_tkey(txn, KEY_BACKUP_TMP, GrapheneTime::max(ttype));
+    // return main backup timer value (default 0):
+    ret = graphene_time_print(get_tkey(txn, KEY_BACKUP_MAIN), ttype);
   }
   catch (Err e){
     txn_abort(txn);
@@ -381,15 +847,14 @@ GrapheneDB::backup_end(const std::string & t2){
   DB_TXN *txn = txn_begin();
   try {
     // read temporary timer
-    auto timer = graphene_time_parse("0",ttype); // default
-    timer = get_key(txn, KEY_BACKUP_TMP, timer);
+    GrapheneTime timer = get_tkey(txn, KEY_BACKUP_TMP);
 
     // If t2 is smaller then timer, use t2 instead
-    std::string t2s = graphene_time_parse(t2, ttype);
-    if (graphene_time_cmp(timer,t2s, ttype)>0) timer = t2s;
+    GrapheneTime t2t = graphene_time_parse_t(t2, ttype);
+    if (timer > t2t) timer = t2t;
 
     // Commit the temporary timer to the main one
-    set_key(txn, KEY_BACKUP_MAIN, mk_dbt(timer));
+    set_tkey(txn, KEY_BACKUP_MAIN, timer);
   }
   catch (Err e){
     txn_abort(txn);
@@ -403,9 +868,8 @@ void
 GrapheneDB::backup_reset(){
   DB_TXN *txn = txn_begin();
   try {
-    auto t = graphene_time_parse("0", ttype);
-    set_key(txn, KEY_BACKUP_TMP,  mk_dbt(t));
-    set_key(txn, KEY_BACKUP_MAIN, mk_dbt(t));
+    set_tkey(txn, KEY_BACKUP_TMP,  GrapheneTime());
+    set_tkey(txn, KEY_BACKUP_MAIN, GrapheneTime());
   }
   catch (Err e){
     txn_abort(txn);
@@ -419,9 +883,7 @@ std::string
 GrapheneDB::backup_get(){
   DB_TXN *txn = txn_begin();
   try {
-    auto timer = graphene_time_parse("0",ttype); // default
-    timer = get_key(txn, KEY_BACKUP_MAIN, timer);
-    return graphene_time_print(timer, ttype);
+    return graphene_time_print(get_tkey(txn, KEY_BACKUP_MAIN), ttype);
   }
   catch (Err e){
     txn_abort(txn);
@@ -433,21 +895,223 @@ GrapheneDB::backup_get(){
 // return true if the main backup timer is finite
 bool
 GrapheneDB::backup_needed(){
-  auto t1 = graphene_time_parse(backup_get(), ttype);
-  auto t2 = graphene_time_parse("inf", ttype);
-  return graphene_time_cmp(t1,t2,ttype) < 0;
+  GrapheneTime t = graphene_time_parse_t(backup_get(), ttype);
+  return t < GrapheneTime::max(ttype);
 }
 
 // function to be called after each database modification
 void
-GrapheneDB::backup_upd(DB_TXN *txn, const std::string &t){
+GrapheneDB::backup_upd(DB_TXN *txn, const GrapheneTime &t){
   // Read and update both main and temporary timers
   for (int i = 0; i<2; i++) {
     uint8_t key = (i==0)? KEY_BACKUP_TMP : KEY_BACKUP_MAIN;
-    auto timer = graphene_time_parse("0",ttype); // default
-    timer = get_key(txn, key, timer);
-    if (graphene_time_cmp(timer,t, ttype)>0)
-      set_key(txn, key, mk_dbt(t));
+    if (get_tkey(txn, key) > t) set_tkey(txn, key, t);
+  }
+}
+
+/************************************/
+// Put one packed point, return its timestamp.
+// Should be called inside a transaction.
+//
+GrapheneTime
+GrapheneDB::put_point(DB_TXN *txn, const GrapheneTime &t0, const string &vs, const string &dpolicy){
+  if (blocks() || reg.in(t0)) return put_point_blk(txn, t0, vs, dpolicy);
+  GrapheneTime t(t0);
+  int flags = (dpolicy =="replace")? 0:DB_NOOVERWRITE;
+  int res = -1;
+  bool replaced = false; // existing point is replaced (for rollups)
+  char kbuf[sizeof(uint64_t)];
+  while (res!=0){
+    // shifted to the regular part
+    if (reg.in(t)) return put_point_blk(txn, t, vs, dpolicy);
+    DBT k = mk_dbt();
+    k.data = kbuf;
+    k.size = graphene_time_pack(t, ttype, kbuf);
+    DBT v = mk_dbt(vs);
+    if (rollup && flags==0)
+      replaced = dbp->exists(dbp.get(), txn, &k, 0) == 0;
+    res = dbp->put(dbp.get(), txn, &k, &v, flags);
+    if (res == DB_KEYEXIST){
+      if (dpolicy =="error") throw Err() << name << ".db: " << "Timestamp exists";
+      else if (dpolicy =="sshift")
+        t = graphene_time_add(t, GrapheneTime::make(1,0,ttype), ttype);
+      else if (dpolicy =="nsshift")
+        t = graphene_time_add(t, GrapheneTime::make(0,1,ttype), ttype);
+      else if (dpolicy =="skip") break;
+      else throw Err() << "Unknown dpolicy setting: " << dpolicy;
+    }
+    else if (res != 0)
+      throw Err() << name << ".db: " << db_strerror(res);
+  }
+
+  // update rollup records
+  if (rollup && res==0){
+    if (replaced) rollup->rebuild(txn, *this, t, t);
+    else rollup->add(txn, t, vs);
+  }
+  return t;
+}
+
+/************************************/
+// Blocks of points
+
+// Max size of a block record. Larger blocks are split into two
+// (records should fit into a database page together with some others).
+#define BLOCK_MAXSIZE 1000
+
+// Max number of blocks processed by del_range_blk with a single cursor.
+#define BLOCK_MAXDEL 256
+
+bool
+GrapheneDB::find_block(DB_TXN *txn, const GrapheneTime & t,
+                       GrapheneTime & key, GrapheneBlock & b){
+  GrapheneCursor curs(dbp.get(), txn, name);
+  if (reg.in(t)){
+    key = reg.chunk(t);
+    curs.set_key(key, ttype);
+    if (!curs.get(DB_SET_RANGE) || curs.time(ttype) != key) {b.clear(); return false;}
+    reg.decode(key, curs.val(), b);
+    return true;
+  }
+  curs.set_key(t, ttype);
+  bool f = curs.get(DB_SET_RANGE);
+  if (!f || curs.time(ttype) != t){
+    // previous record, or the next one if there is no previous record
+    bool fp = curs.get(f? DB_PREV : DB_LAST) && curs.is_tstamp();
+    if (!fp){
+      if (!f) {b.clear(); return false;}
+      curs.set_key(t, ttype);
+      curs.get(DB_SET_RANGE);
+    }
+  }
+  key = curs.time(ttype);
+  b.decode(key, curs.val());
+  return true;
+}
+
+void
+GrapheneDB::put_block(DB_TXN *txn, const GrapheneBlock & b,
+                      const size_t i1, const size_t i2){
+  std::string vs = b.encode(i1, i2);
+  if (vs.size() > BLOCK_MAXSIZE && i2-i1 > 1){
+    size_t m = (i1+i2)/2;
+    put_block(txn, b, i1, m);
+    put_block(txn, b, m, i2);
+    return;
+  }
+  char kbuf[sizeof(uint64_t)];
+  DBT k = mk_dbt();
+  k.data = kbuf;
+  k.size = graphene_time_pack(b.t[i1], ttype, kbuf);
+  DBT v = mk_dbt(vs);
+  int res = dbp->put(dbp.get(), txn, &k, &v, 0);
+  if (res != 0)
+    throw Err() << name << ".db: " << db_strerror(res);
+}
+
+void
+GrapheneDB::write_block(DB_TXN *txn, const bool have, const GrapheneTime & key,
+                        const GrapheneBlock & b){
+  // chunk with fixed key
+  if (reg.in(key) && b.size()){
+    char kbuf[sizeof(uint64_t)];
+    DBT k = mk_dbt();
+    k.data = kbuf;
+    k.size = graphene_time_pack(key, ttype, kbuf);
+    std::string vs = reg.encode(key, b);
+    DBT v = mk_dbt(vs);
+    int res = dbp->put(dbp.get(), txn, &k, &v, 0);
+    if (res != 0)
+      throw Err() << name << ".db: " << db_strerror(res);
+    return;
+  }
+
+  if (have && (b.size()==0 || b.t[0] != key)){
+    char kbuf[sizeof(uint64_t)];
+    DBT k = mk_dbt();
+    k.data = kbuf;
+    k.size = graphene_time_pack(key, ttype, kbuf);
+    int res = dbp->del(dbp.get(), txn, &k, 0);
+    if (res != 0)
+      throw Err() << name << ".db: " << db_strerror(res);
+  }
+  if (b.size()) put_block(txn, b, 0, b.size());
+}
+
+void
+GrapheneDB::decode_block(const GrapheneTime & key, const GrapheneView & v, GrapheneBlock & b){
+  if (reg.in(key)) reg.decode(key, v, b);
+  else b.decode(key, v);
+}
+
+GrapheneTime
+GrapheneDB::put_point_blk(DB_TXN *txn, const GrapheneTime &t0, const string &vs, const string &dpolicy){
+  GrapheneTime t(t0), key;
+  GrapheneBlock b(ttype, dtype);
+  bool replaced = false; // existing point is replaced (for rollups)
+  bool have;
+  size_t i;
+  while (1){
+    have = find_block(txn, t, key, b);
+    i = b.find(t);
+    if (i==b.size() || b.t[i] != t) break;
+    if (dpolicy =="replace") {replaced = true; break;}
+    if (dpolicy =="error") throw Err() << name << ".db: " << "Timestamp exists";
+    else if (dpolicy =="sshift")
+      t = graphene_time_add(t, GrapheneTime::make(1,0,ttype), ttype);
+    else if (dpolicy =="nsshift")
+      t = graphene_time_add(t, GrapheneTime::make(0,1,ttype), ttype);
+    else if (dpolicy =="skip") return t;
+    else throw Err() << "Unknown dpolicy setting: " << dpolicy;
+  }
+  if (replaced) b.v[i] = vs;
+  else b.insert(i, t, vs);
+  write_block(txn, have, key, b);
+
+  // update rollup records
+  if (rollup){
+    if (replaced) rollup->rebuild(txn, *this, t, t);
+    else rollup->add(txn, t, vs);
+  }
+  return t;
+}
+
+void
+GrapheneDB::del_range_blk(DB_TXN *txn, const GrapheneTime &t1, const GrapheneTime &t2,
+                          bool & deleted, GrapheneTime & first_del, GrapheneTime & last_del){
+  GrapheneTime pos = t1;
+  while (1){
+    // Collect blocks which can contain points in pos..t2, close the
+    // cursor before modifying the database.
+    GrapheneTime key;
+    GrapheneBlock b(ttype, dtype);
+    if (reg.in(pos)) key = reg.chunk(pos);
+    else if (!find_block(txn, pos, key, b)) return;
+    std::vector<std::pair<GrapheneTime, std::string> > recs;
+    {
+      GrapheneCursor curs(dbp.get(), txn, name);
+      curs.set_key(key, ttype);
+      int fl = DB_SET_RANGE;
+      while (recs.size() < BLOCK_MAXDEL && curs.get(fl)){
+        fl = DB_NEXT;
+        GrapheneTime tn = curs.time(ttype);
+        if (tn > t2) break;
+        recs.push_back(std::make_pair(tn, curs.val().str()));
+      }
+    }
+
+    for (auto const & r:recs){
+      decode_block(r.first, r.second, b);
+      size_t i1 = b.find(t1);
+      size_t i2 = std::upper_bound(b.t.begin(), b.t.end(), t2) - b.t.begin();
+      if (i1 >= i2) continue;
+      if (!deleted) {first_del = b.t[i1]; deleted = true;}
+      last_del = b.t[i2-1];
+      b.erase(i1, i2);
+      write_block(txn, true, r.first, b);
+    }
+    if (recs.size() < BLOCK_MAXDEL) return;
+    pos = recs.back().first;
   }
 }
 
@@ -459,39 +1123,78 @@ GrapheneDB::backup_upd(DB_TXN *txn, const std::string &t){
 //
 void
 GrapheneDB::put(const string &t, const vector<string> & dat, const string &dpolicy){
-  int ret;
-  string ks = graphene_time_parse(t, ttype);
+  GrapheneTime tt = graphene_time_parse_t(t, ttype);
   string vs = graphene_data_parse(dat, dtype);
 
   // do everything in a single transaction
   DB_TXN *txn = txn_begin();
   try {
+    tt = put_point(txn, tt, vs, dpolicy);
+    backup_upd(txn, tt);
+  }
+  catch (Err e){
+    txn_abort(txn);
+    throw e;
+  }
+  txn_commit(txn);
+}
 
-    int flags = (dpolicy =="replace")? 0:DB_NOOVERWRITE;
-    int res = -1;
-    while (res!=0){
-      DBT k = mk_dbt(ks);
-      DBT v = mk_dbt(vs);
-      res = dbp->put(dbp.get(), txn, &k, &v, flags);
-      if (res == DB_KEYEXIST){
-        if (dpolicy =="error") throw Err() << name << ".db: " << "Timestamp exists";
-        else if (dpolicy =="sshift")
-          ks = graphene_time_add(ks, graphene_time_parse("1", ttype), ttype);
-        else if (dpolicy =="nsshift")
-          ks = graphene_time_add(ks, graphene_time_parse("0.000000001", ttype), ttype);
-        else if (dpolicy =="skip") break;
-        else throw Err() << "Unknown dpolicy setting: " << dpolicy;
-      }
-      else if (res != 0)
-        throw Err() << name << ".db: " << db_strerror(res);
+/************************************/
+// Put many data points in a single transaction.
+// All input is parsed before the transaction starts: a
+// broken value does not leave a partially written batch.
+//
+void
+GrapheneDB::put_batch(const vector<string> &ts,
+                      const vector<vector<string> > & dats,
+                      const string &dpolicy){
+  if (ts.size() != dats.size())
+    throw Err() << "put_batch: different number of timestamps and values";
+  if (ts.size()==0) return;
+
+  vector<GrapheneTime> tts;
+  vector<string> vss;
+  tts.reserve(ts.size());
+  vss.reserve(ts.size());
+  for (size_t i=0; i<ts.size(); i++){
+    tts.push_back(graphene_time_parse_t(ts[i], ttype));
+    vss.push_back(graphene_data_parse(dats[i], dtype));
+  }
+  put_packed(tts, vss, dpolicy);
+}
+
+/************************************/
+// Put many packed data points in a single transaction.
+// Input is checked before the transaction starts.
+//
+void
+GrapheneDB::put_packed(const vector<GrapheneTime> &tts,
+                       const vector<string> & vss,
+                       const string &dpolicy, const int commit_flags){
+  if (tts.size() != vss.size())
+    throw Err() << "put_packed: different number of timestamps and values";
+  if (tts.size()==0) return;
+  for (size_t i=0; i<tts.size(); i++){
+    if (tts[i].nsec(ttype) >= 1000000000)
+      throw Err() << "Bad timestamp: nanoseconds out of range";
+    graphene_data_check(vss[i], dtype);
+  }
+
+  // do everything in a single transaction
+  DB_TXN *txn = txn_begin();
+  try {
+    GrapheneTime tmin = GrapheneTime::max(ttype); // smallest written timestamp
+    for (size_t i=0; i<tts.size(); i++){
+      GrapheneTime t = put_point(txn, tts[i], vss[i], dpolicy);
+      if (t < tmin) tmin = t;
     }
-    backup_upd(txn, ks);
+    backup_upd(txn, tmin);
   }
   catch (Err e){
     txn_abort(txn);
     throw e;
   }
-  txn_commit(txn);
+  txn_commit(txn, commit_flags);
 }
 
 /************************************/
@@ -499,30 +1202,21 @@ GrapheneDB::put(const string &t, const vector<string> & dat, const string &dpoli
 //
 void
 GrapheneDB::get_next(const string &t1, GrapheneFormatter & out){
-  string t1p = graphene_time_parse(t1, ttype);
-  DBT k = mk_dbt(t1p);
-  DBT v = mk_dbt();
+  GrapheneTime t1t = graphene_time_parse_t(t1, ttype);
 
   // do everything in a single transaction (with snapshot isolation)
   DB_TXN *txn = txn_begin(DB_TXN_SNAPSHOT);
-  DBC *curs = NULL;
   try {
-    /* Get a cursor */
-    get_cursor(dbp.get(), txn, &curs, 0);
-
-    if (c_get(curs, &k, &v, DB_SET_RANGE) && is_tstamp(&k))
-      out.proc_point(dbt2str(&k), dbt2str(&v), ttype, dtype);
-
-    curs->close(curs);
+    GrapheneDataCursor curs(*this, txn);
+    curs.set_key(t1t, ttype);
+    if (curs.get(DB_SET_RANGE) && curs.is_tstamp())
+      out.proc_point(curs.time(ttype), curs.val(), ttype, dtype);
   }
   catch (Err e){
-    if (curs) curs->close(curs);
     txn_abort(txn);
     throw e;
   }
   txn_commit(txn);
-
-
 }
 
 /************************************/
@@ -531,33 +1225,23 @@ GrapheneDB::get_next(const string &t1, GrapheneFormatter & out){
 void
 GrapheneDB::get_prev(const string &t2, GrapheneFormatter & out){
 
-  string t2p = graphene_time_parse(t2, ttype);
-  DBT k = mk_dbt(t2p);
-  DBT v = mk_dbt();
+  GrapheneTime t2t = graphene_time_parse_t(t2, ttype);
 
   // do everything in a single transaction (with snapshot isolation)
   DB_TXN *txn = txn_begin(DB_TXN_SNAPSHOT);
-  DBC *curs = NULL;
   try {
-    /* Get a cursor */
-    get_cursor(dbp.get(), txn, &curs, 0);
-
-    bool found = c_get(curs, &k, &v, DB_SET_RANGE);
-
-    // unpack time
-    string tp = dbt2str(&k);
+    GrapheneDataCursor curs(*this, txn);
+    curs.set_key(t2t, ttype);
+    bool found = curs.get(DB_SET_RANGE);
 
     // if needed, get previous record:
-    if (graphene_time_cmp(tp,t2p, ttype)>0 || !found)
-      found=c_get(curs, &k, &v, DB_PREV);
-
-    if (found && is_tstamp(&k))
-      out.proc_point(dbt2str(&k), dbt2str(&v), ttype, dtype);
+    if (!found || curs.time(ttype) > t2t)
+      found=curs.get(DB_PREV);
 
-    curs->close(curs);
+    if (found && curs.is_tstamp())
+      out.proc_point(curs.time(ttype), curs.val(), ttype, dtype);
   }
   catch (Err e){
-    if (curs) curs->close(curs);
     txn_abort(txn);
     throw e;
   }
@@ -574,59 +1258,61 @@ GrapheneDB::get(const string &t, GrapheneFormatter & out){
   if (dtype!=DATA_FLOAT && dtype!=DATA_DOUBLE)
     return get_prev(t, out);
 
-  string tp = graphene_time_parse(t, ttype);
-  DBT k = mk_dbt(tp);
-  DBT v = mk_dbt();
-  string t1p, v1p, t2p, v2p, vp;
+  GrapheneTime tt = graphene_time_parse_t(t, ttype);
+  GrapheneTime t1t;
+  string v1p, vp;
 
   // do everything in a single transaction (with snapshot isolation)
   DB_TXN *txn = txn_begin(DB_TXN_SNAPSHOT);
-  DBC *curs = NULL;
   try {
-
-    /* Get a cursor */
-    get_cursor(dbp.get(), txn, &curs, 0);
+    GrapheneDataCursor curs(*this, txn);
 
     // find next value
-    bool found = c_get(curs, &k, &v, DB_SET_RANGE);
-    if (!is_tstamp(&k)) goto finish;
+    curs.set_key(tt, ttype);
+    bool found = curs.get(DB_SET_RANGE);
+    if (!curs.is_tstamp()) goto finish;
 
     // if there is no next value - give the last value if any
     if (!found) {
-      if (c_get(curs, &k, &v, DB_PREV) && is_tstamp(&k))
-        out.proc_point(dbt2str(&k), dbt2str(&v), ttype, dtype);
+      if (curs.get(DB_PREV) && curs.is_tstamp())
+        out.proc_point(curs.time(ttype), curs.val(), ttype, dtype);
       goto finish;
     }
 
     // if "next" record is exactly at t - return it
-    t1p = dbt2str(&k);
-    v1p = dbt2str(&v);
-    if (graphene_time_cmp(t1p,tp, ttype) == 0){
-      out.proc_point(t1p, v1p, ttype, dtype);
+    t1t = curs.time(ttype);
+    if (t1t == tt){
+      out.proc_point(t1t, curs.val(), ttype, dtype);
       goto finish;
     }
+    // keep the value, cursor buffers will be overwritten
+    v1p = curs.val().str();
 
     // get the previous value and do interpolation
     // find prev value
-    found = c_get(curs, &k, &v, DB_PREV);
-    if (!found || !is_tstamp(&k)) goto finish; // not found or not a timestamp
+    found = curs.get(DB_PREV);
+    if (!found || !curs.is_tstamp()) goto finish; // not found or not a timestamp
 
-    t2p = dbt2str(&k);
-    v2p = dbt2str(&v);
-    vp = graphene_interpolate(tp, t1p, t2p, v1p, v2p, ttype, dtype);
-    if (vp!="") out.proc_point(tp, vp, ttype, dtype);
+    vp = graphene_interpolate(tt, t1t, curs.time(ttype), v1p, curs.val(), ttype, dtype);
+    if (vp!="") out.proc_point(tt, vp, ttype, dtype);
 
-    finish:
-    curs->close(curs);
+    finish:;
   }
   catch (Err e){
-    if (curs) curs->close(curs);
     txn_abort(txn);
     throw e;
   }
   txn_commit(txn);
 }
 
+/************************************/
+// Smallest timestamp after t
+static GrapheneTime
+time_next(const GrapheneTime & t, const TimeType ttype){
+  if (ttype==TIME_V1) return GrapheneTime(t.val()+1);
+  return graphene_time_add(t, GrapheneTime::make(0,1,ttype), ttype);
+}
+
 /************************************/
 // get data from the database -- get_range
 //
@@ -638,79 +1324,203 @@ GrapheneDB::get(const string &t, GrapheneFormatter & out){
 // (order is not too important, but we prefer the 1nd case):
 // use DB_SET_RANGE with dt shift, if the point didn't
 // change - use DB_NEXT.
-void
+std::string
 GrapheneDB::get_range(const string &t1, const string &t2,
-                const string &dt, GrapheneFormatter & out){
-
-  string t1p = graphene_time_parse(t1, ttype);
-  string t2p = graphene_time_parse(t2, ttype);
-  string dtp = graphene_time_parse(dt, ttype);
-  DBT k = mk_dbt(t1p);
-  DBT v = mk_dbt();
-  string tlp; // last printed value
+                const string &dt, GrapheneFormatter & out,
+                const size_t maxn){
+
+  GrapheneTime t1t = graphene_time_parse_t(t1, ttype);
+  GrapheneTime t2t = graphene_time_parse_t(t2, ttype);
+  GrapheneTime dtt = graphene_time_parse_t(dt, ttype);
+  bool every = dtt.zero();
+  GrapheneTime pre = t1t; // previous key
+  GrapheneTime tl;        // last printed value
+  bool printed = false;
+  size_t n = 0;           // number of printed points
+  string next;            // time to continue reading
 
   // do everything in a single transaction (with snapshot isolation)
   DB_TXN *txn = txn_begin(DB_TXN_SNAPSHOT);
-  DBC *curs = NULL;
   try {
 
-    // Get a cursor
-    get_cursor(dbp.get(), txn, &curs, 0);
+    // bulk reads are useful only if we want every point
+    GrapheneDataCursor curs(*this, txn, every? bulk:0);
+    curs.set_key(t1t, ttype);
 
     int fl = DB_SET_RANGE; // first get t >= t1
     while (1){
 
-      string pre = dbt2str(&k);
-      if (!c_get(curs, &k, &v, fl)) break;
+      if (!curs.get(fl)) break;
 
-      if (!is_tstamp(&k)) {
+      if (!curs.is_tstamp()) {
         fl=DB_NEXT;
         continue;
       }
 
-      // unpack new time value and check the range
-      string tnp = dbt2str(&k);
-      if (graphene_time_cmp(tnp,t2p,ttype)>0) break;
+      // check the range
+      GrapheneTime tn = curs.time(ttype);
+      if (tn > t2t) break;
 
       // I have a broken database where DB_SET_RANGE/DB_NEXT can
       // get non-increasing values. Let's check this to prevent the
       // program from infinite loops..
-      if (graphene_time_cmp(tnp,pre,ttype)<0)
+      if (tn < pre)
         throw Err() << "Broken database (DB_SET_RANGE/DB_NEXT get smaller timestamp)";
 
       // if we want every point, switch to DB_NEXT and repeat
-      if (graphene_time_zero(dtp, ttype)){
-        out.proc_point(dbt2str(&k), dbt2str(&v), ttype, dtype);
+      if (every){
+        out.proc_point(tn, curs.val(), ttype, dtype);
+        pre = tn;
         fl=DB_NEXT;
+        if (maxn && ++n >= maxn) {
+          if (tn < t2t) next = graphene_time_print(time_next(tn, ttype), ttype);
+          break;
+        }
         continue;
       }
 
       // If dt >0 we continue using fl=DB_SET_RANGE.
       // If new value the same as old
-      if (tlp.size()>0 && graphene_time_cmp(tlp,tnp,ttype)==0){
+      if (printed && tl == tn){
         // get next value
-        if (!c_get(curs, &k, &v, DB_NEXT)) break;
-        // unpack new time value and check the range
-        tnp = dbt2str(&k);
-        if (graphene_time_cmp(tnp,t2p,ttype) > 0 ) break;
+        if (!curs.get(DB_NEXT)) break;
+        // check the range
+        tn = curs.time(ttype);
+        if (tn > t2t) break;
       }
-      out.proc_point(dbt2str(&k), dbt2str(&v), ttype, dtype);
-      tlp=tnp; // update last printed value
+      out.proc_point(tn, curs.val(), ttype, dtype);
+      tl = tn; // update last printed value
+      printed = true;
 
       // add dt to the key for the next loop:
-      string sp = graphene_time_add(tlp, dtp, ttype);
-      memcpy(k.data,sp.data(),k.size);
-      k = mk_dbt(sp);
+      pre = graphene_time_add(tl, dtt, ttype);
+      curs.set_key(pre, ttype);
+
+      // the loop can be continued from pre
+      if (maxn && ++n >= maxn) {
+        if (pre > tl && pre <= t2t) next = graphene_time_print(pre, ttype);
+        break;
+      }
     }
-    curs->close(curs);
   }
   catch (Err e){
-    if (curs) curs->close(curs);
     txn_abort(txn);
     throw e;
   }
   txn_commit(txn);
+  return next;
+}
 
+/************************************/
+// Read every point in the range t1..t2
+//
+void
+GrapheneDB::read_range(DB_TXN *txn, const GrapheneTime &t1, const GrapheneTime &t2,
+                       GrapheneFormatter & out){
+  GrapheneTime pre = t1; // previous key
+  GrapheneDataCursor curs(*this, txn, bulk);
+  curs.set_key(t1, ttype);
+  int fl = DB_SET_RANGE; // first get t >= t1
+  while (curs.get(fl)){
+    fl=DB_NEXT;
+    if (!curs.is_tstamp()) continue;
+    GrapheneTime tn = curs.time(ttype);
+    if (tn > t2) break;
+    if (tn < pre)
+      throw Err() << "Broken database (DB_SET_RANGE/DB_NEXT get smaller timestamp)";
+    out.proc_point(tn, curs.val(), ttype, dtype);
+    pre = tn;
+  }
+}
+
+/************************************/
+// get data from the database for the aggregating formatter
+//
+// For each aggregation interval [a,e] rollup records of tier L
+// are used for all tier intervals inside [a,e], points
+// in the head and in the tail of [a,e] are read from the database.
+std::string
+GrapheneDB::get_range_agg(const std::string &t1, const std::string &t2,
+                          GrapheneAgg & agg, const size_t maxn){
+
+  GrapheneTime t1t = graphene_time_parse_t(t1, ttype);
+  GrapheneTime t2t = graphene_time_parse_t(t2, ttype);
+  GrapheneTime dtt = agg.get_dt();
+  size_t n = 0; // number of processed intervals
+  string next;  // time to continue reading
+
+  uint32_t L = (rollup && agg.use_rollup())? rollup->find_tier(t1t, dtt) : 0;
+
+  // do everything in a single transaction (with snapshot isolation)
+  DB_TXN *txn = txn_begin(DB_TXN_SNAPSHOT);
+  try {
+    // no rollup and no limit: read all points
+    bool all = L==0 && maxn==0;
+    if (all) read_range(txn, t1t, t2t, agg);
+
+    // cursor for skipping intervals without data
+    GrapheneDataCursor curs(*this, txn);
+    GrapheneTime a = t1t;
+    while (!all && a <= t2t){
+      // skip intervals without data
+      curs.set_key(a, ttype);
+      if (!curs.get(DB_SET_RANGE) || !curs.is_tstamp()) break;
+      GrapheneTime tn = curs.time(ttype);
+      if (tn > t2t) break;
+      // (with dt=0 the interval starts at the first point)
+      a = dtt.zero()? tn : agg.get_bucket(tn);
+
+      // end of the interval
+      GrapheneTime e = t2t;
+      if (!dtt.zero()){
+        GrapheneTime an = graphene_time_add(a, dtt, ttype);
+        if (an > a && an <= t2t) e = GrapheneTime(an.val()-1);
+      }
+
+      if (L==0) {
+        read_range(txn, a, e, agg);
+      }
+      else {
+        // first tier interval starting inside [a,e]
+        GrapheneTime h = rollup->bucket(a, L);
+        if (h < a) {
+          h = rollup->bucket_last(h, L);
+          h = GrapheneTime(h.val()+1);
+        }
+
+        // last tier interval inside [a,e]
+        GrapheneTime z = rollup->bucket(e, L);
+        if (rollup->bucket_last(z, L) > e)
+          z = GrapheneTime::make(z.sec(ttype) >= L? z.sec(ttype)-L : 0, 0, ttype);
+
+        if (h < a || h > e || z < h || rollup->bucket_last(z, L) > e) {
+          read_range(txn, a, e, agg);
+        }
+        else {
+          if (h > a) read_range(txn, a, GrapheneTime(h.val()-1), agg);
+          rollup->get(txn, L, h, z, agg);
+          GrapheneTime zl = rollup->bucket_last(z, L);
+          if (zl < e) read_range(txn, GrapheneTime(zl.val()+1), e, agg);
+        }
+      }
+
+      if (e >= t2t) break;
+      a = GrapheneTime(e.val()+1);
+
+      // intervals are independent, reading can be continued from a
+      if (maxn && ++n >= maxn) {
+        next = graphene_time_print(a, ttype);
+        break;
+      }
+    }
+  }
+  catch (Err e){
+    txn_abort(txn);
+    throw e;
+  }
+  txn_commit(txn);
+  agg.flush();
+  return next;
 }
 
 /************************************/
@@ -720,47 +1530,41 @@ void
 GrapheneDB::get_count(const string &t1,
                 const string &count, GrapheneFormatter & out){
 
-  string t1p = graphene_time_parse(t1, ttype);
+  GrapheneTime t1t = graphene_time_parse_t(t1, ttype);
   istringstream s(count);
   uint64_t N = 0;
   s >> N;
   if (s.bad() || s.fail() || !s.eof())
     throw Err() << "Can't parse data count: " << count;
 
-  DBT k = mk_dbt(t1p);
-  DBT v = mk_dbt();
+  GrapheneTime pre = t1t; // previous key
 
   // do everything in a single transaction (with snapshot isolation)
   DB_TXN *txn = txn_begin(DB_TXN_SNAPSHOT);
-  DBC *curs = NULL;
   try {
 
-    // Get a cursor
-    get_cursor(dbp.get(), txn, &curs, 0);
+    GrapheneDataCursor curs(*this, txn, bulk);
+    curs.set_key(t1t, ttype);
 
     int fl = DB_SET_RANGE; // first get t >= t1
-    for (int i=0; i<N; ++i) {
-      string pre = dbt2str(&k);
+    for (uint64_t i=0; i<N; ++i) {
 
-      if (!c_get(curs, &k, &v, fl)) break;
-
-      // unpack new time value
-      string tnp = dbt2str(&k);
+      if (!curs.get(fl)) break;
 
       // I have a broken database where DB_SET_RANGE/DB_NEXT can
       // get non-increasing values. Let's check this to prevent the
       // program from infinite loops..
-      if (graphene_time_cmp(tnp,pre,ttype)<0)
+      GrapheneTime tn = curs.time(ttype);
+      if (tn < pre)
         throw Err() << "Broken database (DB_SET_RANGE/DB_NEXT get smaller timestamp)";
 
       // we want every point, switch to DB_NEXT and repeat
-      out.proc_point(dbt2str(&k), dbt2str(&v), ttype, dtype);
+      out.proc_point(tn, curs.val(), ttype, dtype);
+      pre = tn;
       fl=DB_NEXT;
     }
-    curs->close(curs);
   }
   catch (Err e){
-    if (curs) curs->close(curs);
     txn_abort(txn);
     throw e;
   }
@@ -775,17 +1579,33 @@ GrapheneDB::get_count(const string &t1,
 void
 GrapheneDB::del(const string &t1){
   int ret;
-  string t1p = graphene_time_parse(t1, ttype);
-  DBT k = mk_dbt(t1p);
+  GrapheneTime t1t = graphene_time_parse_t(t1, ttype);
+  char kbuf[sizeof(uint64_t)];
+  DBT k = mk_dbt();
+  k.data = kbuf;
+  k.size = graphene_time_pack(t1t, ttype, kbuf);
 
   DB_TXN *txn = txn_begin();
   try{
-    ret = dbp->del(dbp.get(), txn, &k, 0);
+    if (blocks() || reg.in(t1t)){
+      GrapheneTime key;
+      GrapheneBlock b(ttype, dtype);
+      bool have = find_block(txn, t1t, key, b);
+      size_t i = b.find(t1t);
+      ret = (i<b.size() && b.t[i]==t1t)? 0 : DB_NOTFOUND;
+      if (ret == 0){
+        b.erase(i, i+1);
+        write_block(txn, have, key, b);
+      }
+    }
+    else
+      ret = dbp->del(dbp.get(), txn, &k, 0);
     if (ret == DB_NOTFOUND)
       throw Err() << name << ".db: No such record: " << t1;
     if (ret != 0)
       throw Err() << name << ".db: " << db_strerror(ret);
-    backup_upd(txn, t1p);
+    if (rollup) rollup->rebuild(txn, *this, t1t, t1t);
+    backup_upd(txn, t1t);
   }
   catch (Err e){
     txn_abort(txn);
@@ -795,56 +1615,131 @@ GrapheneDB::del(const string &t1){
 }
 
 /************************************/
-// delete data data from the database -- del_range
+// delete separate records of points in the range t1..t2
 void
-GrapheneDB::del_range(const string &t1, const string &t2){
-  int ret;
-  std::string first_del; // for lastmod timestamp
-
-  string t1p = graphene_time_parse(t1, ttype);
-  string t2p = graphene_time_parse(t2, ttype);
-  DBT k = mk_dbt(t1p);
-  DBT v = mk_dbt();
+GrapheneDB::del_range_raw(DB_TXN *txn, const GrapheneTime &t1, const GrapheneTime &t2,
+                          bool & deleted, GrapheneTime & first_del, GrapheneTime & last_del){
+  GrapheneTime pre = t1; // previous key
+  bool del = false;      // something is deleted here
+
+  // Bulk mode: collect keys using a bulk cursor, close it and delete
+  // all collected keys with a single DB->del(DB_MULTIPLE) call
+  // (deleting with a separate call while the cursor is opened
+  // deadlocks in the "lock" environment). Repeat until nothing is found.
+  if (bulk) {
+    std::vector<char> keys_buf(bulk);
+    while (1) {
+      DBT keys = mk_dbt();
+      keys.data  = keys_buf.data();
+      keys.ulen  = keys_buf.size();
+      keys.flags = DB_DBT_USERMEM;
+      void *p;
+      DB_MULTIPLE_WRITE_INIT(p, &keys);
+
+      bool full = false;
+      size_t n = 0;
+      {
+        GrapheneCursor curs(dbp.get(), txn, name, bulk);
+        curs.set_key(pre, ttype);
+        int fl = DB_SET_RANGE; // first get t >= pre
+        while (curs.get(fl)){
+          fl=DB_NEXT;
+
+          // check the range
+          GrapheneTime tn = curs.time(ttype);
+          if (tn > t2) break;
+
+          // check for broken databases, same as below
+          if (tn < pre)
+            throw Err() << "Broken database (DB_SET_RANGE/DB_NEXT get smaller timestamp)";
+
+          DB_MULTIPLE_WRITE_NEXT(p, &keys, curs.key().data(), curs.key().size());
+          if (p==NULL) {full = true; break;}
+
+          pre = tn;
+          if (!deleted) {first_del = tn; deleted = true;}
+          del = true;
+          n++;
+        }
+      }
+      if (n==0) break;
 
-  DB_TXN *txn = txn_begin();
-  DBC *curs = NULL;
-  try {
+      int res = dbp->del(dbp.get(), txn, &keys, DB_MULTIPLE);
+      if (res!=0)
+        throw Err() << name << ".db: " << db_strerror(res);
+      if (!full) break;
+    }
+  }
 
-    /* Get a cursor */
-    get_cursor(dbp.get(), txn, &curs, 0);
+  else {
+    GrapheneCursor curs(dbp.get(), txn, name);
+    curs.set_key(t1, ttype);
 
     int fl = DB_SET_RANGE; // first get t >= t1
     while (1){
 
-      string pre = dbt2str(&k);
-
-      if (!c_get(curs, &k, &v, fl)) break;
+      if (!curs.get(fl)) break;
 
-      // get packed time value and check the range
-      string tp = dbt2str(&k);
-      if (graphene_time_cmp(tp,t2p,ttype)>0) break;
+      // check the range
+      GrapheneTime tn = curs.time(ttype);
+      if (tn > t2) break;
 
       // I have a broken database where DB_SET_RANGE/DB_NEXT can
       // get non-increasing values. Let's check this to prevent the
       // program from infinite loops..
-      if (graphene_time_cmp(tp,pre,ttype)<0)
+      if (tn < pre)
         throw Err() << "Broken database (DB_SET_RANGE/DB_NEXT get smaller timestamp)";
 
       // delete the point
-      int res = curs->del(curs, 0);
-      if (res!=0)
-        throw Err() << name << ".db: " << db_strerror(res);
-      if (first_del=="") first_del = tp;
+      curs.del();
+      pre = tn;
+      if (!deleted) {first_del = tn; deleted = true;}
+      del = true;
 
       // we want to delete every point, so switch to DB_NEXT and repeat
       fl=DB_NEXT;
     }
+  }
 
-    curs->close(curs);
-    if (first_del!="") backup_upd(txn, first_del);
+  if (del) last_del = pre;
+}
+
+/************************************/
+// delete data data from the database -- del_range
+void
+GrapheneDB::del_range(const string &t1, const string &t2){
+  bool deleted = false;
+  GrapheneTime first_del; // for lastmod timestamp
+
+  GrapheneTime t1t = graphene_time_parse_t(t1, ttype);
+  GrapheneTime t2t = graphene_time_parse_t(t2, ttype);
+  GrapheneTime pre = t1t; // last deleted point
+
+  DB_TXN *txn = txn_begin();
+  try {
+
+    if (blocks())
+      del_range_blk(txn, t1t, t2t, deleted, first_del, pre);
+
+    // regular-interval mode: separate records before the start
+    // time, chunks after it
+    else if (reg.n) {
+      GrapheneTime s = reg.start();
+      if (t1t < s)
+        del_range_raw(txn, t1t, t2t < s? t2t : GrapheneTime(s.val()-1), deleted, first_del, pre);
+      if (t2t >= s)
+        del_range_blk(txn, t1t < s? s : t1t, t2t, deleted, first_del, pre);
+    }
+
+    else
+      del_range_raw(txn, t1t, t2t, deleted, first_del, pre);
+
+    if (deleted) {
+      if (rollup) rollup->rebuild(txn, *this, first_del, pre);
+      backup_upd(txn, first_del);
+    }
   }
   catch (Err e){
-    if (curs) curs->close(curs);
     txn_abort(txn);
     throw e;
   }
@@ -914,6 +1809,14 @@ GrapheneDB::load(const std::string &file){
     if (ret != 0)
       throw Err() << name << ".db: " << db_strerror(ret);
   }
+
+  // rollup records are not dumped, rebuild them
+  read_info();
+  open_rollup();
+  if (rollup){
+    rollup->clear(NULL);
+    rollup->rebuild(NULL, *this, GrapheneTime(), GrapheneTime::max(ttype));
+  }
 }
 
 /************************************/
@@ -934,39 +1837,180 @@ GrapheneDB::dump(const std::string &file){
      << "HEADER=END\n";
 
   // write data
-  DBT k = mk_dbt("\0"); // start from 1-byte 0
-  DBT v = mk_dbt();
-  DBC *curs = NULL;
-  try {
+  GrapheneCursor curs(dbp.get(), NULL, name, bulk);
+  curs.set_key(string()); // start from the smallest key
+
+  int fl = DB_SET_RANGE;
+  while (1){
+    if (!curs.get(fl)) break;
+    fl=DB_NEXT;
+
+    ff << ' ';
+    // print key and value as hex code
+    for (size_t i = 0; i < curs.key().size(); ++i)
+      ff << std::hex << std::setfill('0') << std::setw(2)
+         << (int)((uint8_t*)curs.key().data())[i];
+    ff << "\n";
+
+    ff << ' ';
+    for (size_t i = 0; i < curs.val().size(); ++i)
+      ff << std::hex << std::setfill('0') << std::setw(2)
+         << (int)((uint8_t*)curs.val().data())[i];
+    ff << "\n";
+  }
+  ff << "DATA=END\n";
+}
 
-    // Get a cursor
-    get_cursor(dbp.get(), NULL, &curs, 0);
+/***********************************************************/
+// GrapheneJoin class
 
-    int fl = DB_SET_RANGE;
-    while (1){
-      if (!c_get(curs, &k, &v, fl)) break;
-      fl=DB_NEXT;
+// Max number of cursor steps for a single request.
+// If the next timestamp is further, it is searched from the beginning.
+#define JOIN_MAXSTEP 16
 
-      ff << ' ';
-      // print key and value as hex code
-      for (string::size_type i = 0; i < k.size; ++i)
-        ff << std::hex << std::setfill('0') << std::setw(2)
-           << (int)((uint8_t*)k.data)[i];
-      ff << "\n";
-
-      ff << ' ';
-      for (string::size_type i = 0; i < v.size; ++i)
-        ff << std::hex << std::setfill('0') << std::setw(2)
-           << (int)((uint8_t*)v.data)[i];
-      ff << "\n";
-    }
-    curs->close(curs);
-    ff << "DATA=END\n";
-  }
+GrapheneJoin::GrapheneJoin(GrapheneDB & db):
+    dbp(db.dbp), name(db.name), ttype(db.ttype), dtype(db.dtype),
+    init(false), hp(false), hn(false) {
+  txn = db.txn_begin(DB_TXN_SNAPSHOT);
+  try { curs.reset(new GrapheneDataCursor(db, txn)); }
   catch (Err e){
-    if (curs) curs->close(curs);
+    if (txn) txn->abort(txn);
     throw e;
   }
 }
 
+GrapheneJoin::~GrapheneJoin(){
+  curs.reset(); // close the cursor before the transaction
+  if (txn) txn->commit(txn, 0);
+}
+
+void
+GrapheneJoin::seek(const GrapheneTime & t){
+  curs->set_key(t, ttype);
+  hn = curs->get(DB_SET_RANGE) && curs->is_tstamp();
+  if (hn) { tn = curs->time(ttype); vn = curs->val().str(); }
+
+  // previous record (the last one if nothing is found)
+  hp = curs->get(hn? DB_PREV : DB_LAST) && curs->is_tstamp();
+  if (hp) { tp = curs->time(ttype); vp = curs->val().str(); }
+
+  // move the cursor back to the next record
+  if (hn) curs->get(DB_NEXT);
+  init = true;
+}
+
+void
+GrapheneJoin::move(const GrapheneTime & t){
+  if (!init || t < t0) seek(t);
+  else {
+    int n = 0;
+    while (hn && tn < t){
+      if (++n > JOIN_MAXSTEP) { seek(t); break; }
+      hp = true; tp = tn; vp.swap(vn);
+      hn = curs->get(DB_NEXT) && curs->is_tstamp();
+      if (hn) { tn = curs->time(ttype); vn = curs->val().str(); }
+    }
+  }
+  t0 = t;
+}
+
+void
+GrapheneJoin::get(const GrapheneTime & t, GrapheneFormatter & out){
+
+  // update records around t
+  move(t);
+
+  // exact match
+  if (hn && tn == t) {
+    out.proc_point(tn, vn, ttype, dtype);
+    return;
+  }
+
+  // for non-float databases or if there is no next value
+  // give the previous value
+  if ((dtype!=DATA_FLOAT && dtype!=DATA_DOUBLE) || !hn){
+    if (hp) out.proc_point(tp, vp, ttype, dtype);
+    return;
+  }
 
+  // interpolation
+  if (!hp) return;
+  std::string v = graphene_interpolate(t, tn, tp, vn, vp, ttype, dtype);
+  if (v!="") out.proc_point(t, v, ttype, dtype);
+}
+
+void
+GrapheneJoin::get_prev(const GrapheneTime & t, GrapheneFormatter & out){
+  move(t);
+  if (hn && tn == t) out.proc_point(tn, vn, ttype, dtype);
+  else if (hp) out.proc_point(tp, vp, ttype, dtype);
+}
+
+void
+GrapheneJoin::get_at(const GrapheneTime & t, GrapheneFormatter & out){
+  move(t);
+  if (!hn) return;
+  if (tn == t) {
+    out.proc_point(t, vn, ttype, dtype);
+    return;
+  }
+  if (!hp) return;
+  if (dtype!=DATA_FLOAT && dtype!=DATA_DOUBLE) {
+    out.proc_point(t, vp, ttype, dtype);
+    return;
+  }
+  std::string v = graphene_interpolate(t, tn, tp, vn, vp, ttype, dtype);
+  if (v!="") out.proc_point(t, v, ttype, dtype);
+}
+
+/************************************/
+// get data from the database -- get_many, get_prev_many
+//
+void
+GrapheneDB::get_many(const vector<string> &ts, GrapheneFormatter & out){
+  GrapheneJoin j(*this);
+  for (auto const & t: ts)
+    j.get(graphene_time_parse_t(t, ttype), out);
+}
+
+void
+GrapheneDB::get_prev_many(const vector<string> &ts, GrapheneFormatter & out){
+  GrapheneJoin j(*this);
+  for (auto const & t: ts)
+    j.get_prev(graphene_time_parse_t(t, ttype), out);
+}
+
+/************************************/
+// get data from the database -- get_range_grid
+//
+string
+GrapheneDB::get_range_grid(const string &t1, const string &t2,
+                           const string &dt, GrapheneFormatter & out,
+                           const size_t maxn){
+
+  // grid in ms or ns
+  uint64_t u  = graphene_time_to_units(graphene_time_parse_t(t1, ttype), ttype);
+  uint64_t u2 = graphene_time_to_units(graphene_time_parse_t(t2, ttype), ttype);
+  uint64_t du = graphene_time_to_units(graphene_time_parse_t(dt, ttype), ttype);
+  if (du==0) throw Err() << "Non-zero time step is needed for interpolation";
+
+  size_t n = 0; // number of processed grid points
+  GrapheneJoin j(*this);
+  while (u <= u2){
+    j.get_at(graphene_time_from_units(u, ttype), out);
+
+    // stop after the last record
+    GrapheneTime tn;
+    if (!j.next_time(tn)) break;
+
+    // before the first record go to the first grid point after it
+    uint64_t un = graphene_time_to_units(tn, ttype);
+    uint64_t step = (!j.has_prev() && un > u)? (un-u + du-1)/du*du : du;
+    if (u2 - u < step) break;
+    u += step;
+
+    if (maxn && ++n >= maxn)
+      return graphene_time_print(graphene_time_from_units(u, ttype), ttype);
+  }
+  return string();
+}
@@ -10,12 +10,16 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <atomic>
 #include <sstream>
 #include <cstring> /* memset */
 #include <db.h>
 
 #include "err/err.h"
 #include "data.h"
+#include "gr_rollup.h"
+#include "gr_block.h"
 
 #include <iomanip>
 
@@ -24,11 +28,15 @@
 //  https://web.stanford.edu/class/cs276a/projects/docs/berkeleydb/reftoc.html
 
 #define GRAPHENE_LOGSIZE 1<<20
+#define GRAPHENE_MAX_BULK (1<<30) // max buffer size for bulk reads
 
 #define KEY_DESCR   0
 #define KEY_VERSION 1
 #define KEY_BACKUP_MAIN  0x10
 #define KEY_BACKUP_TMP   0x11
+#define KEY_ROLLUP       0x12
+#define KEY_REGULAR      0x13
+#define KEY_CHANGES      0x14 // counter of filter changes
 
 // Filters occupy MAX_FILTERS keys starting
 // from KEY_FLT. Filter 0 data uses KEY_FLT0DATA key
@@ -43,15 +51,158 @@
 // Base formatter class for GrapheneDB. All get_* methods call
 // GrapheneFormatter::proc_point on each record (without any
 // filtering or column selection).
+// Value is a view of packed data, valid only during the call.
 class GrapheneFormatter {
   public:
-  virtual void proc_point(const std::string &k, const std::string &v,
+  virtual void proc_point(const GrapheneTime &k, const GrapheneView &v,
      const TimeType ttype, const DataType dtype) = 0;
 };
 
+/***********************************************************/
+// Database cursor with its own key/value buffers.
+// Key is read into a small fixed buffer (DB_DBT_USERMEM),
+// value into a buffer reused between calls and extended by
+// the library when needed (DB_DBT_REALLOC). No memory is
+// allocated for each record. Views returned by key() and val()
+// are valid until the next get() call.
+//
+// If bulk>0, records are read in bulk mode (DB_MULTIPLE_KEY):
+// many key/value pairs are fetched into a buffer of this size
+// by a single library call. Only DB_SET_RANGE and DB_NEXT
+// operations are supported in this mode, del() is not supported.
+class GrapheneCursor {
+  DBC *curs;
+  const std::string & name; // database name for error messages
+  char kbuf[16];
+  DBT k, v;
+  size_t bulk;    // bulk buffer size, 0 if bulk mode is off
+  void *bptr;     // position in the bulk buffer
+  GrapheneView ck, cv; // current key and value
+
+  // read next record from the bulk buffer
+  bool bulk_next();
+
+  public:
+  GrapheneCursor(DB *dbp, DB_TXN *txn, const std::string & name_,
+                 const size_t bulk_ = 0);
+  GrapheneCursor(const GrapheneCursor &) = delete;
+  GrapheneCursor & operator=(const GrapheneCursor &) = delete;
+  ~GrapheneCursor() { close(); free(v.data); }
+
+  // close the cursor (it is also done in the destructor)
+  void close() { if (curs) curs->close(curs); curs=NULL; }
+
+  // set key for DB_SET_RANGE operation
+  void set_key(const GrapheneView & key);
+  void set_key(const GrapheneTime & t, const TimeType ttype);
+
+  // read a record, return false if it is not found
+  bool get(int flags);
+
+  // delete current record
+  void del();
+
+  GrapheneView key() const { return ck; }
+  GrapheneView val() const { return cv; }
+
+  // unpacked key
+  GrapheneTime time(const TimeType ttype) const {
+    return graphene_time_unpack(ck, ttype); }
+
+  // check if the key is a valid timestamp (not a 1- or 2-byte special keys)
+  bool is_tstamp() const { return ck.size()==sizeof(uint64_t) || ck.size()==sizeof(uint32_t); }
+};
+
+class GrapheneDB;
+
+/***********************************************************/
+// Cursor for data points. Same interface as GrapheneCursor (only
+// timestamp keys, DB_SET_RANGE, DB_NEXT, DB_PREV and DB_LAST
+// operations, no del()). For databases with blocks of points
+// (version 3) or chunks (regular-interval mode) records are decoded
+// and points are returned one by one, bulk mode is not used.
+// Otherwise GrapheneCursor is used directly.
+// The cursor does not refer to the GrapheneDB object after creation.
+class GrapheneDataCursor {
+  std::string name;
+  GrapheneCursor curs;
+  TimeType ttype;
+  bool blocks;       // records contain many points
+  GrapheneRegular reg; // regular-interval mode parameters
+  GrapheneBlock blk; // current block
+  size_t i;          // current point in the block
+  int pos;           // 0: not positioned, 1: at a point, 2: at a non-data record
+  GrapheneTime st;   // key for DB_SET_RANGE
+  mutable char kbuf[sizeof(uint64_t)];
+
+  // read the current record, set position to point n (or to the last point)
+  bool load(const size_t n);
+
+  public:
+  GrapheneDataCursor(GrapheneDB & db, DB_TXN *txn, const size_t bulk = 0);
+
+  // set key for DB_SET_RANGE operation
+  void set_key(const GrapheneTime & t, const TimeType ttype_);
+
+  // read a point, return false if it is not found
+  bool get(int flags);
+
+  GrapheneView key() const;
+  GrapheneView val() const;
+
+  // unpacked key
+  GrapheneTime time(const TimeType ttype_) const;
+
+  // check if the key is a valid timestamp
+  bool is_tstamp() const;
+};
+
+class GrapheneAgg;
+class GrapheneJoin;
+
+/***********************************************************/
+// Information shared by all GrapheneDB objects of one database
+// in a process (e.g. by worker threads of the socket mode):
+// - Counter of database information changes. Each object keeps
+//   its own copy of the information and re-reads it if the
+//   counter is modified (see GrapheneDB::check_info).
+// - Filter code cache. The cache is valid while the change counter
+//   stored in the database (KEY_CHANGES) is not modified, this allows
+//   to see changes made by other processes.
+// - Storage of the input filter.
+struct GrapheneDBShared {
+  std::atomic<uint64_t> gen; // counter of information changes
+  std::mutex m;     // lock for filters and input filter storage
+  uint64_t changes; // value of the change counter for the cache
+  std::map<int, std::string> filters; // filter code cache
+
+  // input filter storage (see GrapheneDB::get_f0data/write_f0data)
+  std::mutex flt0;    // lock for running the input filter
+  std::string f0data;
+  bool   f0data_rd;   // storage has been read from the database
+  bool   f0data_mod;  // storage is modified and not written yet
+  time_t f0data_t;    // time of the last write
+
+  GrapheneDBShared(): gen(0), changes(0),
+    f0data_rd(false), f0data_mod(false), f0data_t(0) {}
+};
+
+// Shared information of all databases. One object is used by
+// a GrapheneEnv and its child objects (in other threads).
+// Information is kept while some GrapheneDB object uses it.
+class GrapheneDBSharedMap {
+  std::mutex m;
+  std::map<std::string, std::weak_ptr<GrapheneDBShared> > dbs;
+  public:
+  std::shared_ptr<GrapheneDBShared> get(const std::string & name);
+};
+
 /***********************************************************/
 /* class for wrapping BerkleyDB */
 class GrapheneDB{
+  friend class GrapheneJoin;
+  friend class GrapheneDataCursor;
+
   /************************************/
   // Create DBT objects of various kinds.
   //
@@ -76,21 +227,27 @@ class GrapheneDB{
   static std::string dbt2str(DBT *k) {
     return std::string((char *)k->data, (char *)k->data+k->size);}
 
-  // check if database key is a valid timestamp (not a 1- or 2-byte special keys)
-  static bool is_tstamp(DBT *k) { return k->size==sizeof(uint64_t) || k->size==sizeof(uint32_t); }
-
   /************************************/
   /* data */
     std::shared_ptr<DB> dbp;
     DB_ENV * env;
+    std::string path;    // database folder
     std::string name;    // database name
     uint32_t open_flags; // database open flags
     uint32_t env_flags;  // environment flags
 
+    size_t bulk;       // buffer size for bulk reads (0 - no bulk reads)
+
     uint8_t  version;  // database version
     DataType dtype;    // data type
     TimeType ttype;    // timestamp type
     std::string descr; // database description
+    std::vector<uint32_t> tiers; // rollup tiers (seconds)
+    std::shared_ptr<GrapheneRollup> rollup; // NULL if no rollup tiers
+    GrapheneRegular reg; // regular-interval mode
+    std::shared_ptr<GrapheneDBShared> shared; // information shared with other objects
+    uint64_t gen;      // value of shared->gen when the information was read
+    int    f0sync;     // interval for writing input filter storage, seconds
 
   // database deleter
   struct D {
@@ -100,20 +257,34 @@ class GrapheneDB{
   /****************************/
   // Simple transaction wrappers:
     DB_TXN *txn_begin(int flags=0);
-    void txn_commit(DB_TXN *txn);
+    void txn_commit(DB_TXN *txn, int flags=0);
     void txn_abort(DB_TXN *txn);
 
-  /****************************/
-  // Simple wrappers for cursor operations:
-    void get_cursor(DB *dbp, DB_TXN *txn, DBC **curs, int flags);
-    bool c_get(DBC *curs, DBT *k, DBT *v, int flags);
-
   /****************************/
   // Simple del/put/set operations for database information
     void del_key(DB_TXN *txn, uint8_t key);
     void set_key(DB_TXN *txn, uint8_t key, DBT v);
     std::string get_key(DB_TXN *txn, uint8_t key,
                         const std::string & def = std::string());
+    // same for timestamps
+    GrapheneTime get_tkey(DB_TXN *txn, uint8_t key,
+                        const GrapheneTime & def = GrapheneTime());
+    void set_tkey(DB_TXN *txn, uint8_t key, const GrapheneTime & t);
+
+  // Read the change counter; increment it and return the new value.
+    uint64_t get_changes(DB_TXN *txn);
+    uint64_t inc_changes(DB_TXN *txn);
+
+  // Put filter code into the shared cache after changing it
+  // (c is the new value of the change counter).
+    void cache_filter(const uint64_t c, const int n, const std::string & code);
+
+  // Notify other objects that database information was changed
+  // (call after committing the change).
+    void info_changed() { shared->gen++; }
+
+  // Write storage of the input filter (shared->m should be locked).
+    void write_f0data_db();
 
   /****************************/
   // Read/Write database information.
@@ -122,16 +293,62 @@ class GrapheneDB{
     void write_info();
     void read_info();
 
+  // Open the rollup database if rollup tiers are set.
+    void open_rollup();
+
+  // Blocks of points (database version 3), see gr_block.h
+    bool blocks() const { return version>=3; }
+
+  // Find the block for time t: the last one with key <= t or the first
+  // one, in regular-interval mode the chunk for t. Return false if there
+  // is no such block.
+    bool find_block(DB_TXN *txn, const GrapheneTime & t,
+                    GrapheneTime & key, GrapheneBlock & b);
+
+  // Write a modified block which was read from record with key
+  // (have=false for a new block). The old record is deleted if the first
+  // point has changed, large blocks are split.
+    void write_block(DB_TXN *txn, const bool have, const GrapheneTime & key,
+                     const GrapheneBlock & b);
+    void put_block(DB_TXN *txn, const GrapheneBlock & b, const size_t i1, const size_t i2);
+
+  // decode a block or a chunk
+    void decode_block(const GrapheneTime & key, const GrapheneView & v, GrapheneBlock & b);
+
+  // put_point/del_range for blocks of points
+    GrapheneTime put_point_blk(DB_TXN *txn, const GrapheneTime &t,
+                               const std::string &vs, const std::string &dpolicy);
+    void del_range_blk(DB_TXN *txn, const GrapheneTime &t1, const GrapheneTime &t2,
+                       bool & deleted, GrapheneTime & first_del, GrapheneTime & last_del);
+
+  // del_range for separate records of points
+    void del_range_raw(DB_TXN *txn, const GrapheneTime &t1, const GrapheneTime &t2,
+                       bool & deleted, GrapheneTime & first_del, GrapheneTime & last_del);
+
+  // Read every point in the time range t1..t2 (inside a transaction).
+    void read_range(DB_TXN *txn, const GrapheneTime &t1, const GrapheneTime &t2,
+                    GrapheneFormatter & out);
+
   public:
 
   /************************************/
   // Constructor -- open a database
   // Path is a path to the database foolder.
   // Name is a database name, it can not contain some symbols (.|+ \n\t)
+  // Page size is used only for creating a new database (0 - libdb default).
+  // Shared information is used by all objects of the same database
+  // (by default the object has its own one).
   GrapheneDB(DB_ENV *env,
        const std::string & path_,
        const std::string & name_,
-       const int flags);
+       const int flags,
+       const uint32_t pagesize = 0,
+       const std::shared_ptr<GrapheneDBShared> & shared_ =
+         std::shared_ptr<GrapheneDBShared>());
+
+  // Re-read database information if it was changed by another
+  // object with the same shared information (or always if force is set).
+  void check_info(const bool force = false);
 
   // change database description
   void set_descr(const std::string & d){ descr = d; write_info(); }
@@ -139,6 +356,10 @@ class GrapheneDB{
   // Set data type. Do it only after creating a new database.
   void set_dtype(const DataType & t){ dtype = t; write_info(); }
 
+  // Set database version (2 or 3, see DEF_DBVERSION).
+  // Do it only after creating a new database.
+  void set_version(const int v);
+
   // get database description
   std::string get_descr() const { return descr; }
 
@@ -148,6 +369,20 @@ class GrapheneDB{
   // get timestamp type
   TimeType get_ttype() const { return ttype; }
 
+  // Set buffer size for bulk reads, 0 to switch them off.
+  // Bulk reads are used in get_range (with dt=0), get_count,
+  // del_range and dump.
+  // Buffer size is rounded up to a multiple of 1024, it should
+  // not exceed GRAPHENE_MAX_BULK (checked in GrapheneEnv::set_bulk).
+  void set_bulk(const size_t b) {
+    bulk = (b+1023)/1024*1024;
+    if (rollup) rollup->set_bulk(bulk);
+  }
+
+  // Set interval for writing input filter storage to the database,
+  // seconds (0 - write after each modification).
+  void set_f0sync(const int s) { f0sync = s; }
+
   // is the database opened readonly?
   bool is_readonly() const {return open_flags & DB_RDONLY;}
 
@@ -155,21 +390,50 @@ class GrapheneDB{
   void clear_filter(const int N);
 
   // read a filter from database
+  // Filter code is cached in the shared information,
+  // the cache is checked against the change counter.
   std::string get_filter(const int N);
 
   // write filter N. For input filter (N=0) storage is cleared
   void write_filter(const int N, const std::string & code);
 
 
+  // Set rollup tiers (lengths in seconds, each one a multiple of the
+  // previous one), rebuild all rollup records. Empty list switches
+  // rollups off.
+  void set_rollup(const std::vector<uint32_t> & t);
+
+  // get rollup tiers
+  std::vector<uint32_t> get_rollup() const { return tiers; }
+
+  // Set regular-interval mode: start time, period, number of points
+  // in a chunk (n=0 switches the mode off). Only for databases without
+  // data points, not for version 3.
+  void set_regular(const std::string & start, const std::string & period,
+                   const uint32_t n);
+
+  // get regular-interval mode parameters
+  GrapheneRegular get_regular() const { return reg; }
+
   // clear storage of the input filter
   void clear_f0data();
 
-  // read storage of the input filter from database
+  // Lock for running the input filter (get_f0data, filter,
+  // write_f0data) by many objects of the same database.
+  std::mutex & f0data_lock() { return shared->flt0; }
+
+  // Read storage of the input filter. It is kept in memory
+  // (in the shared information) after the first read.
   std::string get_f0data();
 
-  // write storage of the input filter to database
+  // Modify storage of the input filter. It is written to the
+  // database if f0sync seconds passed since the previous write,
+  // and in flush_f0data().
   void write_f0data(const std::string & storage);
 
+  // write modified storage of the input filter to the database
+  void flush_f0data();
+
   /****************************/
   // Backup system:
 
@@ -195,7 +459,14 @@ class GrapheneDB{
 
   // Internal function, should be called after each
   // database modification.
-  void backup_upd(DB_TXN *txn, const std::string &t);
+  void backup_upd(DB_TXN *txn, const GrapheneTime &t);
+
+  /****************************/
+  // Internal function: put one point (packed value) using dpolicy,
+  // return timestamp of the written point
+  // (it can be shifted by sshift/nsshift policies).
+  GrapheneTime put_point(DB_TXN *txn, const GrapheneTime &t,
+                        const std::string &vs, const std::string &dpolicy);
 
   /****************************/
   // Put data to the database
@@ -207,6 +478,23 @@ class GrapheneDB{
   void put(const std::string &t, const std::vector<std::string> & dat,
            const std::string &dpolicy);
 
+  // Put many data points in a single transaction.
+  // ts and dats should have same size. dpolicy is applied to
+  // each point, backup timers are updated once with the
+  // smallest timestamp of the batch.
+  void put_batch(const std::vector<std::string> &ts,
+                 const std::vector<std::vector<std::string> > & dats,
+                 const std::string &dpolicy);
+
+  // Same, but timestamps and values are already packed
+  // (GrapheneTime::val() and graphene_data_parse formats),
+  // used by the binary protocol and GrapheneQueue.
+  // commit_flags are used for committing the transaction
+  // (DB_TXN_NOSYNC, DB_TXN_WRITE_NOSYNC).
+  void put_packed(const std::vector<GrapheneTime> &ts,
+                  const std::vector<std::string> & vss,
+                  const std::string &dpolicy, const int commit_flags = 0);
+
   // All get* functions get some data from the database
   // and call cb for each key-value pair
 
@@ -219,9 +507,39 @@ class GrapheneDB{
   // get data from the database -- get
   void get(const std::string &t, GrapheneFormatter & out);
 
+  // Get data from the database for many timestamps -- get_many,
+  // get_prev_many. Same as get/get_prev for each timestamp. Sorted
+  // timestamps are found in a single pass with one cursor (see
+  // GrapheneJoin).
+  void get_many(const std::vector<std::string> &ts, GrapheneFormatter & out);
+  void get_prev_many(const std::vector<std::string> &ts, GrapheneFormatter & out);
+
   // get data from the database -- get_range
-  void get_range(const std::string &t1, const std::string &t2,
-                 const std::string &dt, GrapheneFormatter & out);
+  // If maxn>0 reading stops after maxn points. Then time to continue
+  // reading (to be used as t1 in the next call) is returned.
+  // Empty string is returned if the range is finished.
+  std::string get_range(const std::string &t1, const std::string &t2,
+                 const std::string &dt, GrapheneFormatter & out,
+                 const size_t maxn = 0);
+
+  // Get data from the database on a regular grid t1 + k*dt (used
+  // for get_range in the interp mode, dt>0). Values are interpolated for FLOAT and DOUBLE
+  // databases, previous values are used for other types (see
+  // GrapheneJoin::get_at). Grid points before the first and after the
+  // last record are skipped. The range is read in a single pass.
+  // If maxn>0 reading stops after maxn grid points and time to continue
+  // reading is returned (empty string if the range is finished).
+  std::string get_range_grid(const std::string &t1, const std::string &t2,
+                 const std::string &dt, GrapheneFormatter & out,
+                 const size_t maxn = 0);
+
+  // Get data from the database for the aggregating formatter
+  // (same as get_range with dt=0 and agg.flush()). Rollup records
+  // are used for time intervals fully covered by them.
+  // If maxn>0 reading stops after maxn aggregation intervals,
+  // return value is same as in get_range.
+  std::string get_range_agg(const std::string &t1, const std::string &t2,
+                     GrapheneAgg & agg, const size_t maxn = 0);
 
   // get data from the database -- get_count
   void get_count(const std::string &t1,
@@ -233,8 +551,12 @@ class GrapheneDB{
   // delete data data from the database -- del_range
   void del_range(const std::string &t1, const std::string &t2);
 
-  // sync the database
-  void sync() {dbp->sync(dbp.get(), 0);}
+  // Sync the database. Storage of the input filter is not written
+  // here (sync can be called inside a transaction), use flush_f0data().
+  void sync() {
+    dbp->sync(dbp.get(), 0);
+    if (rollup) rollup->sync();
+  }
 
   // load file in a db_dump format
   // (we can not use db_load because of user-defined comparison function)
@@ -246,4 +568,57 @@ class GrapheneDB{
 
 };
 
+/***********************************************************/
+// Sequential get requests (same as GrapheneDB::get) for
+// non-decreasing timestamps, used for joining databases.
+// A single transaction and cursor are used for all requests,
+// the cursor is moved forward instead of searching each
+// timestamp from the beginning.
+class GrapheneJoin {
+  std::shared_ptr<DB> dbp; // keep the database open
+  std::string name;
+  TimeType ttype;
+  DataType dtype;
+  DB_TXN *txn;
+  std::unique_ptr<GrapheneDataCursor> curs;
+
+  // Records around the last requested time t0: the last
+  // record before t0 (p) and the first record at or after t0 (n).
+  // The cursor points to n.
+  bool init, hp, hn;
+  GrapheneTime t0, tp, tn;
+  std::string vp, vn;
+
+  // find records for time t from the beginning
+  void seek(const GrapheneTime & t);
+
+  // update records for time t (move forward or seek)
+  void move(const GrapheneTime & t);
+
+  public:
+  GrapheneJoin(GrapheneDB & db);
+  ~GrapheneJoin();
+
+  // Get previous or interpolated point for time t (in the
+  // database time format).
+  void get(const GrapheneTime & t, GrapheneFormatter & out);
+
+  // Get previous point for time t (at or before t).
+  void get_prev(const GrapheneTime & t, GrapheneFormatter & out);
+
+  // Get a point with timestamp t: exact or interpolated value for
+  // FLOAT and DOUBLE databases, previous value for other types.
+  // Nothing is sent if t is before the first or after the last record.
+  void get_at(const GrapheneTime & t, GrapheneFormatter & out);
+
+  // Is there a record before the last requested time?
+  bool has_prev() const {return hp;}
+
+  // Time of the first record at or after the last requested time,
+  // return false if there is no such record.
+  bool next_time(GrapheneTime & t) const {if (hn) t = tn; return hn;}
+
+  TimeType get_ttype() const {return ttype;}
+};
+
 #endif
@@ -3,10 +3,10 @@
 #include <vector>
 #include <map>
 #include <sstream>
+#include <iostream>
 #include <algorithm>
 #include <cstring> /* memset */
 #include <db.h>
-#include <dirent.h>
 #include <errno.h>
 #include <sys/stat.h>
 
@@ -17,7 +17,7 @@
 
 GrapheneEnvFormatter::GrapheneEnvFormatter(GrapheneTCL & tcl_,
           const std::string & ext_name, GrapheneEnv & env_):
-          col(-1), flt_num(-1), timefmt(TFMT_DEF), list(false),
+          col(-1), flt_num(-1), timefmt(TFMT_DEF), list(false), batch(false),
           fmt_cb(NULL), fmt_cb_data(NULL), tcl(tcl_), env(env_) {
 
   // split secondary database names using '+' delimiter
@@ -30,7 +30,8 @@ GrapheneEnvFormatter::GrapheneEnvFormatter(GrapheneTCL & tcl_,
   std::reverse(secondary.begin(), secondary.end());
 
   name = parse_ext_name(name, col, flt_num);
-  if (flt_num>0) filter = env.getdb(name, DB_RDONLY).get_filter(flt_num);
+  if (flt_num>0) filter = env.getdb(name, DB_RDONLY)->get_filter(flt_num);
+  batch = GrapheneTCL::is_batch(filter);
 }
 
 
@@ -69,21 +70,71 @@ GrapheneTCLGetN::run(const std::vector<std::string> & args) {
 }
 
 
+// number of points processed by a batch filter at once
+#define BATCH_SIZE 4096
+
 void
-GrapheneEnvFormatter::proc_point(const std::string &ks, const std::string &vs,
+GrapheneEnvFormatter::proc_point(const GrapheneTime &ks, const GrapheneView &vs,
     const TimeType ttype, const DataType dtype) {
 
-  auto t = graphene_time_print(ks, ttype, timefmt, time0);
   auto d = graphene_data_print(vs, (filter == "" ? col:-1), dtype); // use all columns for filters
 
+  // batch filter: collect points, timestamps in default format
+  if (batch){
+    btimes.push_back(graphene_time_print(ks, ttype));
+    bdata.push_back(d);
+    bttype = ttype;
+    bdtype = dtype;
+    if (btimes.size() >= BATCH_SIZE) flush();
+    return;
+  }
+
+  auto t = graphene_time_print(ks, ttype, timefmt, time0);
+
   // run filters
   std::string storage; // output filters do not use storage, but we need to provide the variable
   if (!tcl.run(filter, t,d,storage)) return;
 
+  out_point(ks, t, d, ttype, dtype);
+}
+
+void
+GrapheneEnvFormatter::flush() {
+  if (btimes.size()==0) return;
+  tcl.run_batch(filter, btimes, bdata);
+
+  // filtered timestamps are used for secondary databases and output
+  for (size_t i=0; i<btimes.size(); i++){
+    auto ks = graphene_time_parse_t(btimes[i], bttype);
+    auto t = timefmt==TFMT_DEF? btimes[i] :
+               graphene_time_print(ks, bttype, timefmt, time0);
+    out_point(ks, t, bdata[i], bttype, bdtype);
+  }
+  btimes.clear();
+  bdata.clear();
+}
+
+void
+GrapheneEnvFormatter::out_point(const GrapheneTime &ks, const std::string &t,
+    std::vector<std::string> &d, const TimeType ttype, const DataType dtype) {
+
   // add data from secondary databases
-  for (const auto & s:secondary){
-    auto t = graphene_time_print(ks, ttype, TFMT_DEF, "");
-    env.get(s, t, TFMT_DEF, out_cb_addval, &d);
+  if (sec_join.size() != secondary.size()){
+    sec_fmt.clear();
+    sec_join.clear();
+    for (const auto & s:secondary){
+      std::shared_ptr<GrapheneEnvFormatter> f(new GrapheneEnvFormatter(tcl, s, env));
+      f->fmt_cb = out_cb_addval;
+      sec_join.emplace_back(new GrapheneJoin(*env.getdb(f->name, DB_RDONLY)));
+      sec_fmt.push_back(f);
+    }
+  }
+  for (size_t i=0; i<secondary.size(); i++){
+    auto tt = sec_join[i]->get_ttype();
+    sec_fmt[i]->fmt_cb_data = &d;
+    sec_join[i]->get(tt==ttype? ks :
+      graphene_time_parse_t(graphene_time_print(ks, ttype, TFMT_DEF, ""), tt), *sec_fmt[i]);
+    sec_fmt[i]->flush(); // batch filter of the secondary database
   }
 
   // in list mode keep only first line
@@ -105,8 +156,12 @@ GrapheneEnvFormatter::proc_point(const std::string &ks, const std::string &vs,
 
 // Constructor: open DB environment
 GrapheneEnv::GrapheneEnv(const std::string & dbpath_, const bool readonly_,
-                         const std::string & env_type_, const std::string & tcl_libdir):
-    dbpath(dbpath_), env_type(env_type_), readonly(readonly_), tcl(tcl_libdir),
+                         const std::string & env_type_, const std::string & tcl_libdir,
+                         const bool thread, const GrapheneEnvCfg & cfg):
+    dbpath(dbpath_), env_type(env_type_), pool_size(DEF_POOL_SIZE),
+    st_hits(0), st_opens(0), st_evicts(0), readonly(readonly_), bulk(0), f0sync(0),
+    page_size(cfg.page_size), caller(0), catalog(new GrapheneCatalog(dbpath_)),
+    dbshared(new GrapheneDBSharedMap), tcl(tcl_libdir),
     tcl_get_cmd(*this), tcl_getp_cmd(*this), tcl_getn_cmd(*this) {
 
   // add commands to TCL interpeter
@@ -136,12 +191,26 @@ GrapheneEnv::GrapheneEnv(const std::string & dbpath_, const bool readonly_,
   if (res != 0) throw Err() << "Error setting lock detect: " << db_strerror(res);
 
   // configure number of locks
-//  res = env->set_lk_max_locks(env.get(), 1000);
-//  if (res != 0) throw Err() << "Error setting lk_max_locks: " << db_strerror(res);
-//  res = env->set_lk_max_lockers(env.get(), 1000);
-//  if (res != 0) throw Err() << "Error setting lk_max_lockers: " << db_strerror(res);
-//  res = env->set_lk_max_objects(env.get(), 1000);
-//  if (res != 0) throw Err() << "Error setting lk_max_objects: " << db_strerror(res);
+  if (cfg.lk_max) {
+    res = env->set_lk_max_locks(env.get(), cfg.lk_max);
+    if (res != 0) throw Err() << "Error setting lk_max_locks: " << db_strerror(res);
+    res = env->set_lk_max_lockers(env.get(), cfg.lk_max);
+    if (res != 0) throw Err() << "Error setting lk_max_lockers: " << db_strerror(res);
+    res = env->set_lk_max_objects(env.get(), cfg.lk_max);
+    if (res != 0) throw Err() << "Error setting lk_max_objects: " << db_strerror(res);
+  }
+
+  // cache size (single cache region)
+  if (cfg.cache_size) {
+    res = env->set_cachesize(env.get(), cfg.cache_size >> 30, cfg.cache_size & ((1<<30)-1), 1);
+    if (res != 0) throw Err() << "Error setting cache size: " << db_strerror(res);
+  }
+
+  // max size of a file mapped into memory
+  if (cfg.mmap_size) {
+    res = env->set_mp_mmapsize(env.get(), cfg.mmap_size);
+    if (res != 0) throw Err() << "Error setting mmap size: " << db_strerror(res);
+  }
 
   int flags;
   if (env_type == "txn")
@@ -161,6 +230,9 @@ GrapheneEnv::GrapheneEnv(const std::string & dbpath_, const bool readonly_,
 
   else throw Err() << "unknown env_type";
 
+  // environment handle is shared between threads
+  if (thread) flags |= DB_THREAD;
+
   // open environment
   res = env->open(env.get(), dbpath.c_str(), flags, 0644);
   if (res != 0)
@@ -169,59 +241,143 @@ GrapheneEnv::GrapheneEnv(const std::string & dbpath_, const bool readonly_,
 
 }
 
+// Constructor: use DB environment of another GrapheneEnv object
+GrapheneEnv::GrapheneEnv(const GrapheneEnv & parent, const std::string & tcl_libdir):
+    dbpath(parent.dbpath), env_type(parent.env_type), pool_size(parent.pool_size),
+    st_hits(0), st_opens(0), st_evicts(0), env(parent.env),
+    readonly(parent.readonly), bulk(parent.bulk), f0sync(parent.f0sync),
+    page_size(parent.page_size), queue(parent.queue), caller(0), catalog(parent.catalog),
+    dbshared(parent.dbshared), tcl(tcl_libdir),
+    tcl_get_cmd(*this), tcl_getp_cmd(*this), tcl_getn_cmd(*this) {
+
+  tcl.add_cmd("graphene_get", &tcl_get_cmd);
+  tcl.add_cmd("graphene_get_prev", &tcl_getp_cmd);
+  tcl.add_cmd("graphene_get_next", &tcl_getn_cmd);
+}
+
 // Destructor: close the DB environment
 GrapheneEnv::~GrapheneEnv(){
-  close();
+  try { close(); }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    pool.clear();
+    pool_idx.clear();
+  }
 }
 
 
-// find database in the pool. Open/Reopen if needed
-GrapheneDB &
+// find database in the pool. Open if needed
+std::shared_ptr<GrapheneDB>
 GrapheneEnv::getdb(const std::string & name, const int fl){
 
   if (readonly && !(fl & DB_RDONLY)) throw Err() << "can't write to database in readonly mode";
-  std::map<std::string, GrapheneDB>::iterator i = pool.find(name);
 
-  // if database was opened with wrong flags close it
-  if (!(fl & DB_RDONLY) && i!=pool.end() && i->second.is_readonly()){
-    pool.erase(i); i=pool.end();
+  // move the database to the beginning of the list
+  auto i = pool_idx.find(name);
+  if (i != pool_idx.end()){
+    // pooled database exists, do not reuse it for creating a new one
+    if (fl & DB_EXCL) throw Err() << name << ".db: File exists";
+    st_hits++;
+    pool.splice(pool.begin(), pool, i->second);
+    pool.front().second->check_info();
+    return pool.front().second;
+  }
+
+  // Open the database. In a writable environment it is always opened
+  // for writing to avoid reopening.
+  std::shared_ptr<GrapheneDB> db(new GrapheneDB(env.get(), dbpath, name,
+     readonly? fl|DB_RDONLY : fl & ~DB_RDONLY, page_size, dbshared->get(name)));
+  db->set_bulk(bulk);
+  db->set_f0sync(f0sync);
+  st_opens++;
+  pool.emplace_front(name, db);
+  pool_idx[name] = pool.begin();
+
+  // Close least recently used databases. Skip databases which are
+  // used outside the pool (by callers of getdb in the current
+  // call stack), they are closed later.
+  if (pool_size==0) return db;
+  auto j = pool.end();
+  while (pool_idx.size() > pool_size && j != pool.begin()){
+    --j;
+    if (j->second.use_count() > 1) continue;
+    try { j->second->flush_f0data(); }
+    catch (Err & e) { std::cerr << "Error: " << e.str() << "\n"; }
+    pool_idx.erase(j->first);
+    j = pool.erase(j);
+    st_evicts++;
   }
+  return db;
+}
+
+void
+GrapheneEnv::set_pool_size(const size_t n){
+  pool_size = n;
+}
 
-  // if database is not opened, open it
-  if (i == pool.end())
-    i = pool.insert(std::pair<std::string, GrapheneDB>(name, GrapheneDB(env.get(), dbpath, name, fl))).first;
+void
+GrapheneEnv::pool_stat(std::ostream & out){
+  out << "max number of opened databases: " << pool_size << "\n"
+      << "opened databases: " << pool.size() << "\n"
+      << "databases found in the pool: " << st_hits << "\n"
+      << "databases opened: " << st_opens << "\n"
+      << "databases closed to free the pool: " << st_evicts << "\n";
+}
 
-  return i->second;
+void
+GrapheneEnv::set_bulk(const size_t b){
+  if (b!=0 && (b<1024 || b>GRAPHENE_MAX_BULK))
+    throw Err() << "bulk buffer size should be 0 or 1024.." << GRAPHENE_MAX_BULK << ": " << b;
+  bulk = b;
+  for (auto & i:pool) i.second->set_bulk(bulk);
+}
+
+void
+GrapheneEnv::set_f0sync(const int s){
+  f0sync = s;
+  for (auto & i:pool) i.second->set_f0sync(f0sync);
 }
 
 /****************/
 
-// make database list
+// find databases by prefix or regular expression
 std::vector<std::string>
-GrapheneEnv::dblist(){
-  std::vector<std::string> ret;
-  DIR *dir = opendir(dbpath.c_str());
-  if (!dir) throw Err() << "can't open database directory: " << strerror(errno);
-  struct dirent *ent;
-  std::vector<std::string> names;
-  while ((ent = readdir (dir)) != NULL) {
-    std::string name(ent->d_name);
-    size_t p = name.find(".db");
-    if (name.size()>3 && p == name.size()-3)
-      ret.push_back(name.substr(0,p));
-  }
-  closedir(dir);
-  std::sort(ret.begin(), ret.end());
-  return ret;
+GrapheneEnv::dbsearch(const std::string & pattern){
+  auto n = pattern.size();
+  if (n>1 && pattern[0]=='/' && pattern[n-1]=='/')
+    return dblist_re(pattern.substr(1,n-2));
+  return dblist(pattern);
+}
+
+// get database information
+GrapheneDBInfo
+GrapheneEnv::dbinfo(const std::string & name, const bool full){
+  GrapheneDBInfo info;
+  uint64_t gen;
+  if (catalog->get_info(name, info, full, gen)) return info;
+  // information of a pooled database can be changed by another program
+  auto db = getdb(name, DB_RDONLY);
+  db->check_info(true);
+  info.dtype = db->get_dtype();
+  info.ttype = db->get_ttype();
+  if (full){
+    info.descr = db->get_descr();
+    for (int n=0; n<MAX_FILTERS; n++)
+      if (db->get_filter(n)!="") info.filters.push_back(n);
+  }
+  catalog->set_info(name, info, full, gen);
+  return info;
 }
 
 // create new database
 void
 GrapheneEnv::dbcreate(const std::string & name, const std::string & descr,
-                    const DataType dtype){
-  GrapheneDB & db = getdb(name, DB_CREATE | DB_EXCL);
-  db.set_dtype(dtype);
-  db.set_descr(descr);
+                    const DataType dtype, const int version){
+  auto db = getdb(name, DB_CREATE | DB_EXCL);
+  db->set_version(version);
+  db->set_dtype(dtype);
+  db->set_descr(descr);
+  catalog->add(name);
 }
 
 
@@ -239,6 +395,19 @@ GrapheneEnv::dbremove(const std::string & name){
     int res = remove((dbpath + "/" + name + ".db").c_str());
     if (res) throw Err() << name <<  ".db: " << strerror(errno);
   }
+  catalog->remove(name);
+
+  // remove rollup database if it exists
+  struct stat buf;
+  if (stat((dbpath + "/" + name + ".rollup").c_str(), &buf)!=0) return;
+  if (env) {
+    int res = env->dbremove(env.get(), NULL, (name + ".rollup").c_str(), NULL, 0);
+    if (res!=0) throw Err() << name <<  ".rollup: " << db_strerror(res);
+  }
+  else {
+    int res = remove((dbpath + "/" + name + ".rollup").c_str());
+    if (res) throw Err() << name <<  ".rollup: " << strerror(errno);
+  }
 }
 
 // rename database file
@@ -269,29 +438,67 @@ GrapheneEnv::dbrename(const std::string & name1, const std::string & name2){
     if (res) throw Err() << "renaming " << name1 <<  ".db -> "
                          << name2 << ".db: " << strerror(errno);
   }
+  catalog->rename(name1, name2);
+
+  // rename rollup database if it exists
+  path1 = name1 + ".rollup";
+  path2 = name2 + ".rollup";
+  fpath1 = dbpath + "/" + path1;
+  fpath2 = dbpath + "/" + path2;
+  if (stat(fpath1.c_str(), &buf)!=0) return;
+  if (env) {
+    res = env->dbrename(env.get(), NULL, path1.c_str(), NULL, path2.c_str(), 0);
+    if (res!=0) throw Err() << "renaming " << name1 <<  ".rollup -> "
+                            << name2 << ".rollup: " << db_strerror(res);
+  }
+  else {
+    res = rename(fpath1.c_str(), fpath2.c_str());
+    if (res) throw Err() << "renaming " << name1 <<  ".rollup -> "
+                         << name2 << ".rollup: " << strerror(errno);
+  }
 }
 
 // close one database, close all databases
 void
 GrapheneEnv::close(const std::string & name){
-  auto i = pool.find(name);
-  if (i!=pool.end()) pool.erase(i);
+  if (queue) queue->close(name);
+  auto i = pool_idx.find(name);
+  if (i==pool_idx.end()) return;
+  auto db = i->second->second;
+  pool.erase(i->second);
+  pool_idx.erase(i);
+  db->flush_f0data();
 }
 
 void
-GrapheneEnv::close(){ pool.clear(); }
+GrapheneEnv::close(){
+  // close all databases even if some storage can not be written
+  std::string err;
+  for (auto & db:pool){
+    try { db.second->flush_f0data(); }
+    catch (Err & e) { if (err=="") err = e.str(); }
+  }
+  pool.clear();
+  pool_idx.clear();
+  if (err!="") throw Err() << err;
+}
 
 
 // sync one database, sync all databases
 void
 GrapheneEnv::sync(const std::string & name){
-  auto i = pool.find(name);
-  if (i!=pool.end()) i->second.sync();
+  auto i = pool_idx.find(name);
+  if (i==pool_idx.end()) return;
+  i->second->second->flush_f0data();
+  i->second->second->sync();
 }
 
 void
 GrapheneEnv::sync(){
-  for (auto &db:pool) db.second.sync();
+  for (auto &db:pool) {
+    db.second->flush_f0data();
+    db.second->sync();
+  }
 }
 
 void
@@ -328,39 +535,89 @@ GrapheneEnv::list_logs(){
   }
 }
 
+// print a ratio with 4 digits after the decimal point
+static std::string
+ratio(const double r){
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.4f", r);
+  return buf;
+}
+
 void
-GrapheneEnv::lock_stat(bool reset){
+GrapheneEnv::lock_stat(std::ostream & out, bool reset){
   int ret;
   DB_LOCK_STAT *st;
   if (!env) throw Err() << "Command can not be run without DB environment";
   if ((ret = env->lock_stat(env.get(), &st, reset? DB_STAT_CLEAR:0)) != 0)
     throw Err() << db_strerror(ret);
 
-  https://web.stanford.edu/class/cs276a/projects/docs/berkeleydb/api_c/lock_stat.html
-  printf("last allocated locker ID: %d\n\n", st->st_id);
-  printf("current maximum unused locker ID: %d\n", st->st_cur_maxid);
-  printf("number of lock modes: %d\n", st->st_nmodes);
-  printf("maximum number of locks possible: %d\n", st->st_maxlocks);
-  printf("maximum number of lockers possible: %d\n", st->st_maxlockers);
-  printf("maximum number of lock objects possible: %d\n", st->st_maxobjects);
-  printf("number of current locks: %d\n", st->st_nlocks);
-  printf("maximum number of locks at any one time: %d\n", st->st_maxnlocks);
-  printf("number of current lockers: %d\n", st->st_nlockers);
-  printf("maximum number of lockers at any one time: %d\n", st->st_maxnlockers);
-  printf("number of current lock objects: %d\n", st->st_nobjects);
-  printf("maximum number of lock objects at any one time: %d\n", st->st_maxnobjects);
-  printf("total number of locks requested: %ld\n", st->st_nrequests);
-  printf("total number of locks released: %ld\n", st->st_nreleases);
-  //printf("total number of lock requests failing because DB_LOCK_NOWAIT was set: %d\n", st->st_nnowaits);
-  //printf("total number of locks not immediately available due to conflicts: %d\n", st->st_nconflicts);
-  printf("number of deadlocks: %ld\n", st->st_ndeadlocks);
-  printf("timeout value: %d\n", st->st_locktimeout);
-  printf("number of locks that have timed out: %ld\n", st->st_nlocktimeouts);
-  printf("transaction timeout value: %d\n", st->st_txntimeout);
-  printf("number of transactions that have timed out: %ld\n", st->st_ntxntimeouts);
-  printf("size of the lock region: %ld\n", st->st_regsize);
-  printf("number of times that a thread of control was forced to wait before obtaining the region lock: %ld\n", st->st_region_wait);
-  printf("number of times that a thread of control was able to obtain the region lock without waiting: %ld\n", st->st_region_nowait);
+  // https://web.stanford.edu/class/cs276a/projects/docs/berkeleydb/api_c/lock_stat.html
+  out << "last allocated locker ID: " << st->st_id << "\n\n";
+  out << "current maximum unused locker ID: " << st->st_cur_maxid << "\n";
+  out << "number of lock modes: " << st->st_nmodes << "\n";
+  out << "maximum number of locks possible: " << st->st_maxlocks << "\n";
+  out << "maximum number of lockers possible: " << st->st_maxlockers << "\n";
+  out << "maximum number of lock objects possible: " << st->st_maxobjects << "\n";
+  out << "number of current locks: " << st->st_nlocks << "\n";
+  out << "maximum number of locks at any one time: " << st->st_maxnlocks << "\n";
+  out << "number of current lockers: " << st->st_nlockers << "\n";
+  out << "maximum number of lockers at any one time: " << st->st_maxnlockers << "\n";
+  out << "number of current lock objects: " << st->st_nobjects << "\n";
+  out << "maximum number of lock objects at any one time: " << st->st_maxnobjects << "\n";
+  out << "total number of locks requested: " << st->st_nrequests << "\n";
+  out << "total number of locks released: " << st->st_nreleases << "\n";
+  //out << "total number of lock requests failing because DB_LOCK_NOWAIT was set: " << st->st_nnowaits << "\n";
+  //out << "total number of locks not immediately available due to conflicts: " << st->st_nconflicts << "\n";
+  out << "number of deadlocks: " << st->st_ndeadlocks << "\n";
+  out << "timeout value: " << st->st_locktimeout << "\n";
+  out << "number of locks that have timed out: " << st->st_nlocktimeouts << "\n";
+  out << "transaction timeout value: " << st->st_txntimeout << "\n";
+  out << "number of transactions that have timed out: " << st->st_ntxntimeouts << "\n";
+  out << "size of the lock region: " << st->st_regsize << "\n";
+  out << "number of times that a thread of control was forced to wait before obtaining the region lock: " << st->st_region_wait << "\n";
+  out << "number of times that a thread of control was able to obtain the region lock without waiting: " << st->st_region_nowait << "\n";
+  free(st);
+}
+
+void
+GrapheneEnv::mpool_stat(std::ostream & out, bool reset){
+  int ret;
+  DB_MPOOL_STAT *st;
+  DB_MPOOL_FSTAT **fst;
+  if (!env) throw Err() << "Command can not be run without DB environment";
+  if ((ret = env->memp_stat(env.get(), &st, &fst, reset? DB_STAT_CLEAR:0)) != 0)
+    throw Err() << db_strerror(ret);
+
+  uint64_t n = st->st_cache_hit + st->st_cache_miss;
+  out << "cache size: " << (uint64_t)st->st_gbytes*(1<<30) + st->st_bytes << "\n";
+  out << "number of caches: " << st->st_ncache << "\n";
+  out << "maximum file size for mmap: " << (uint64_t)st->st_mmapsize << "\n";
+  out << "pages in the cache: " << st->st_pages << "\n";
+  out << "clean pages: " << st->st_page_clean << "\n";
+  out << "dirty pages: " << st->st_page_dirty << "\n";
+  out << "requested pages found in the cache: " << st->st_cache_hit << "\n";
+  out << "requested pages not found in the cache: " << st->st_cache_miss << "\n";
+  out << "cache hit ratio: " << ratio(n? (double)st->st_cache_hit/n : 0.0) << "\n";
+  out << "pages created in the cache: " << st->st_page_create << "\n";
+  out << "pages read into the cache: " << st->st_page_in << "\n";
+  out << "pages written from the cache: " << st->st_page_out << "\n";
+  out << "clean pages forced from the cache: " << st->st_ro_evict << "\n";
+  out << "dirty pages forced from the cache: " << st->st_rw_evict << "\n";
+  out << "size of the cache region: " << (uint64_t)st->st_regsize << "\n";
+
+  // database files
+  for (DB_MPOOL_FSTAT **f = fst; f && *f; f++){
+    n = (*f)->st_cache_hit + (*f)->st_cache_miss;
+    out << "\n" << (*f)->file_name << "\n";
+    out << "  page size: " << (*f)->st_pagesize << "\n";
+    out << "  requested pages found in the cache: " << (*f)->st_cache_hit << "\n";
+    out << "  requested pages not found in the cache: " << (*f)->st_cache_miss << "\n";
+    out << "  cache hit ratio: " << ratio(n? (double)(*f)->st_cache_hit/n : 0.0) << "\n";
+    out << "  pages read into the cache: " << (*f)->st_page_in << "\n";
+    out << "  pages written from the cache: " << (*f)->st_page_out << "\n";
+  }
+  free(st);
+  free(fst);
 }
 
 /****************/
@@ -368,24 +625,73 @@ GrapheneEnv::lock_stat(bool reset){
 void
 GrapheneEnv::put(const std::string & name, const std::string & t,
          const std::vector<std::string> & dat, const std::string &dpolicy){
-  auto & db = getdb(name);
-  db.put(t, dat, dpolicy);
+  if (queue) return put_batch(name, {t}, {dat}, dpolicy);
+  auto db = getdb(name);
+  db->put(t, dat, dpolicy);
+}
+
+void
+GrapheneEnv::put_batch(const std::string & name, const std::vector<std::string> & ts,
+         const std::vector<std::vector<std::string> > & dats, const std::string &dpolicy){
+  auto db = getdb(name);
+  if (!queue) return db->put_batch(ts, dats, dpolicy);
+
+  // parse points before sending them to the queue
+  if (ts.size() != dats.size())
+    throw Err() << "put_batch: different number of timestamps and values";
+  std::vector<GrapheneTime> tts;
+  std::vector<std::string> vss;
+  for (size_t i=0; i<ts.size(); i++){
+    tts.push_back(graphene_time_parse_t(ts[i], db->get_ttype()));
+    vss.push_back(graphene_data_parse(dats[i], db->get_dtype()));
+  }
+  put_packed(name, tts, vss, dpolicy);
+}
+
+void
+GrapheneEnv::put_packed(const std::string & name, const std::vector<GrapheneTime> & ts,
+         const std::vector<std::string> & vss, const std::string &dpolicy){
+  auto db = getdb(name);
+  if (!queue) return db->put_packed(ts, vss, dpolicy);
+  if (ts.size() != vss.size())
+    throw Err() << "put_packed: different number of timestamps and values";
+  if (ts.size()==0) return;
+  for (auto const & v: vss) graphene_data_check(v, db->get_dtype());
+  auto n = queue->push(name, ts, vss, dpolicy, caller);
+  if (queue->ack()) queue->wait(n, caller);
+}
+
+void
+GrapheneEnv::set_queue(const GrapheneQueueCfg & cfg){
+  if (cfg.window == 0) {queue.reset(); return;}
+  if (readonly) throw Err() << "can't use put queue in readonly mode";
+  GrapheneQueueCfg c(cfg);
+  c.max_dbs = pool_size;
+  queue.reset(new GrapheneQueue(env, dbpath, page_size, dbshared, c));
+}
+
+void
+GrapheneEnv::queue_stat(std::ostream & out){
+  if (!queue) throw Err() << "put queue is not used";
+  queue->stat(out);
 }
 
 void
 GrapheneEnv::put_flt(const std::string & name, const std::string &t,
              const std::vector<std::string> & dat, const std::string &dpolicy){
-  auto & db = getdb(name);
+  auto db = getdb(name);
 
-  auto ttype = db.get_ttype();
-  std::string storage = db.get_f0data();
+  // input filter of one database is run by one thread at a time
+  std::lock_guard<std::mutex> lk(db->f0data_lock());
+  auto ttype = db->get_ttype();
+  std::string storage = db->get_f0data();
   // run input filter
   auto t1 = graphene_time_print(graphene_time_parse(t, ttype),ttype);
   auto d1(dat);
-  if (tcl.run(db.get_filter(0), t1, d1, storage)) db.put(t1,d1,dpolicy);
+  if (tcl.run(db->get_filter(0), t1, d1, storage)) put(name, t1, d1, dpolicy);
 
   // write storage
-  db.write_f0data(storage);
+  db->write_f0data(storage);
 }
 
 /****************/
@@ -395,12 +701,13 @@ void
 GrapheneEnv::get_next(const std::string & ext_name, const std::string & t,
               const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data) {
   GrapheneEnvFormatter dbo(tcl, ext_name, *this);
-  auto & db = getdb(dbo.name, DB_RDONLY);
+  auto db = getdb(dbo.name, DB_RDONLY);
   dbo.timefmt = timefmt;
   dbo.time0   = t;
   dbo.fmt_cb  = fmt_cb;
   dbo.fmt_cb_data  = fmt_cb_data;
-  db.get_next(t, dbo);
+  db->get_next(t, dbo);
+  dbo.flush();
 }
 
 // get previous point before t
@@ -408,12 +715,13 @@ void
 GrapheneEnv::get_prev(const std::string & ext_name, const std::string & t,
               const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data) {
   GrapheneEnvFormatter dbo(tcl, ext_name, *this);
-  auto & db = getdb(dbo.name, DB_RDONLY);
+  auto db = getdb(dbo.name, DB_RDONLY);
   dbo.timefmt = timefmt;
   dbo.time0   = t;
   dbo.fmt_cb  = fmt_cb;
   dbo.fmt_cb_data  = fmt_cb_data;
-  db.get_prev(t, dbo);
+  db->get_prev(t, dbo);
+  dbo.flush();
 }
 
 // get previous or interpolated point
@@ -421,27 +729,85 @@ void
 GrapheneEnv::get(const std::string & ext_name, const std::string & t,
          const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data) {
   GrapheneEnvFormatter dbo(tcl, ext_name, *this);
-  auto & db = getdb(dbo.name, DB_RDONLY);
+  auto db = getdb(dbo.name, DB_RDONLY);
   dbo.timefmt = timefmt;
   dbo.time0   = t;
   dbo.fmt_cb  = fmt_cb;
   dbo.fmt_cb_data  = fmt_cb_data;
-  db.get(t, dbo);
+  db->get(t, dbo);
+  dbo.flush();
 }
 
-// get data range
+// get previous or interpolated points for many timestamps
+void
+GrapheneEnv::get_many(const std::string & ext_name, const std::vector<std::string> & ts,
+         const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data) {
+  GrapheneEnvFormatter dbo(tcl, ext_name, *this);
+  auto db = getdb(dbo.name, DB_RDONLY);
+  dbo.timefmt = timefmt;
+  dbo.fmt_cb  = fmt_cb;
+  dbo.fmt_cb_data  = fmt_cb_data;
+  GrapheneJoin j(*db);
+  for (auto const & t: ts){
+    dbo.time0 = t;
+    j.get(graphene_time_parse_t(t, j.get_ttype()), dbo);
+    dbo.flush();
+  }
+}
+
+// get previous points for many timestamps
 void
+GrapheneEnv::get_prev_many(const std::string & ext_name, const std::vector<std::string> & ts,
+         const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data) {
+  GrapheneEnvFormatter dbo(tcl, ext_name, *this);
+  auto db = getdb(dbo.name, DB_RDONLY);
+  dbo.timefmt = timefmt;
+  dbo.fmt_cb  = fmt_cb;
+  dbo.fmt_cb_data  = fmt_cb_data;
+  GrapheneJoin j(*db);
+  for (auto const & t: ts){
+    dbo.time0 = t;
+    j.get_prev(graphene_time_parse_t(t, j.get_ttype()), dbo);
+    dbo.flush();
+  }
+}
+
+// get data range
+std::string
 GrapheneEnv::get_range(const std::string & ext_name, const std::string & t1,
                const std::string & t2, const std::string & dt,
-               const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data) {
+               const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data,
+               const AggMode agg, const size_t maxn, const std::string & time0) {
   GrapheneEnvFormatter dbo(tcl, ext_name, *this);
-  auto & db = getdb(dbo.name, DB_RDONLY);
+  auto db = getdb(dbo.name, DB_RDONLY);
   dbo.list = true;
   dbo.timefmt = timefmt;
-  dbo.time0   = t1;
+  dbo.time0   = time0==""? t1 : time0;
   dbo.fmt_cb  = fmt_cb;
   dbo.fmt_cb_data  = fmt_cb_data;
-  db.get_range(t1,t2,dt, dbo);
+  if (agg == AGG_NONE){
+    auto ret = db->get_range(t1,t2,dt, dbo, maxn);
+    dbo.flush();
+    return ret;
+  }
+
+  // Resampling on the regular grid
+  if (agg == AGG_INTERP){
+    auto ret = db->get_range_grid(t1,t2,dt, dbo, maxn);
+    dbo.flush();
+    return ret;
+  }
+
+  // Aggregation: read every point, aggregate the selected column
+  // (or all columns if a filter is used).
+  auto ttype = db->get_ttype();
+  GrapheneAgg dba(dbo, agg, dbo.filter==""? dbo.col:-1,
+                  graphene_time_parse_t(t1, ttype),
+                  graphene_time_parse_t(dt, ttype), ttype, db->get_dtype());
+  if (dbo.col>=0) dbo.col = (agg==AGG_MINMAX)? -1:0;
+  auto ret = db->get_range_agg(t1,t2, dba, maxn);
+  dbo.flush();
+  return ret;
 }
 
 // get wide range
@@ -450,15 +816,16 @@ GrapheneEnv::get_wrange(const std::string & ext_name, const std::string & t1,
                const std::string & t2, const std::string & dt,
                const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data) {
   GrapheneEnvFormatter dbo(tcl, ext_name, *this);
-  auto & db = getdb(dbo.name, DB_RDONLY);
+  auto db = getdb(dbo.name, DB_RDONLY);
   dbo.list = true;
   dbo.timefmt = timefmt;
   dbo.time0   = t1;
   dbo.fmt_cb  = fmt_cb;
   dbo.fmt_cb_data  = fmt_cb_data;
-  db.get_prev(t1, dbo);
-  db.get_range(t1,t2,dt, dbo);
-  db.get_next(t2, dbo);
+  db->get_prev(t1, dbo);
+  db->get_range(t1,t2,dt, dbo);
+  db->get_next(t2, dbo);
+  dbo.flush();
 }
 
 // get limited number of points starting at t
@@ -467,13 +834,14 @@ GrapheneEnv::get_count(const std::string & ext_name,
                const std::string & t, const std::string & cnt,
                const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data) {
   GrapheneEnvFormatter dbo(tcl, ext_name, *this);
-  auto & db = getdb(dbo.name, DB_RDONLY);
+  auto db = getdb(dbo.name, DB_RDONLY);
   dbo.list = true;
   dbo.timefmt = timefmt;
   dbo.time0   = t;
   dbo.fmt_cb  = fmt_cb;
   dbo.fmt_cb_data  = fmt_cb_data;
-  db.get_count(t,cnt, dbo);
+  db->get_count(t,cnt, dbo);
+  dbo.flush();
 }
 
 
@@ -7,11 +7,17 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <list>
+#include <unordered_map>
+#include <memory>
 #include <sstream>
 #include <cstring> /* memset */
 #include <db.h>
 #include "gr_db.h"
+#include "gr_agg.h"
 #include "gr_tcl.h"
+#include "gr_queue.h"
+#include "gr_catalog.h"
 
 #include "data.h"
 
@@ -63,12 +69,24 @@ class GrapheneEnvFormatter: public GrapheneFormatter {
   bool list;
 
   std::string filter;
+  bool batch; // batch filter, see GrapheneTCL::run_batch
+
+  // block of points for the batch filter
+  std::vector<std::string> btimes;
+  std::vector<std::vector<std::string> > bdata;
+  TimeType bttype;
+  DataType bdtype;
 
   GrapheneFmtCB fmt_cb;
   void * fmt_cb_data;
 
   std::vector<std::string> secondary;
 
+  // formatters and readers for secondary databases
+  // (created on the first point)
+  std::vector<std::shared_ptr<GrapheneEnvFormatter> > sec_fmt;
+  std::vector<std::shared_ptr<GrapheneJoin> > sec_join;
+
   GrapheneTCL & tcl; // tcl interpreter
   GrapheneEnv & env;
 
@@ -85,20 +103,61 @@ class GrapheneEnvFormatter: public GrapheneFormatter {
   // This method is called from GrapheneGB::get_* for each data point
   // It gets unpacked values from the database, do formatting,
   // column selection and filtering and call print_point method.
-  void proc_point(const std::string &k, const std::string &v,
+  void proc_point(const GrapheneTime &k, const GrapheneView &v,
      const TimeType ttype, const DataType dtype) override;
+
+  // Process the remaining block of points (for batch filters).
+  // Should be called after each GrapheneGB::get_* call.
+  void flush();
+
+  private:
+  // Add data from secondary databases and call fmt_cb.
+  void out_point(const GrapheneTime &k, const std::string &t,
+     std::vector<std::string> &d, const TimeType ttype, const DataType dtype);
 };
 
 
+/***********************************************************/
+// Berkeley DB tuning parameters, 0 to use library defaults.
+// Environment parameters are applied only when the environment is
+// created (a DB_CONFIG file in the database directory overrides them),
+// page size is used for new databases.
+struct GrapheneEnvCfg {
+  size_t   cache_size; // cache size, bytes
+  size_t   mmap_size;  // max size of a read-only file mapped into memory, bytes
+  uint32_t lk_max;     // max number of locks, lockers and lock objects
+  uint32_t page_size;  // page size for new databases, bytes (512..65536, power of 2)
+  GrapheneEnvCfg(): cache_size(0), mmap_size(0), lk_max(0), page_size(0) {}
+};
+
+// default max number of opened databases in GrapheneEnv
+#define DEF_POOL_SIZE 256
+
 /***********************************************************/
 // Class for keeping a database environment and many opened
 // databases.
 class GrapheneEnv{
   std::string dbpath;
   std::string env_type;
-  std::map<std::string, GrapheneDB> pool;
+
+  // Pool of opened databases: a list in the order of use (most
+  // recently used first) and a hash index. If there are more than
+  // pool_size databases the least recently used ones are closed.
+  typedef std::list<std::pair<std::string, std::shared_ptr<GrapheneDB> > > pool_t;
+  pool_t pool;
+  std::unordered_map<std::string, pool_t::iterator> pool_idx;
+  size_t pool_size; // max number of opened databases (0 - no limit)
+  uint64_t st_hits, st_opens, st_evicts; // pool statistics
+
   std::shared_ptr<DB_ENV> env; // database environment
   bool readonly;
+  size_t bulk; // buffer size for bulk reads (0 - no bulk reads)
+  int f0sync;  // interval for writing input filter storage, seconds
+  uint32_t page_size; // page size for new databases (0 - default)
+  std::shared_ptr<GrapheneQueue> queue; // put queue (shared with child objects)
+  uint64_t caller; // caller id for the put queue
+  std::shared_ptr<GrapheneCatalog> catalog; // database list (shared with child objects)
+  std::shared_ptr<GrapheneDBSharedMap> dbshared; // database caches (shared with child objects)
 
   GrapheneTCL tcl;
   GrapheneTCLGet  tcl_get_cmd;
@@ -114,22 +173,80 @@ class GrapheneEnv{
 
   // Constructor: open DB environment
   // env_type: "none", "lock", "txn" (default)
+  // If thread is true the environment is opened with DB_THREAD flag
+  // and can be shared between threads (see the next constructor).
   GrapheneEnv(const std::string & dbpath_, const bool readonly,
-              const std::string & env_type, const std::string & tcl_libdir);
+              const std::string & env_type, const std::string & tcl_libdir,
+              const bool thread = false, const GrapheneEnvCfg & cfg = GrapheneEnvCfg());
+
+  // Constructor: use DB environment of another GrapheneEnv object
+  // in a different thread. Database pool and TCL interpreter are
+  // not shared, the object should be used only in one thread.
+  GrapheneEnv(const GrapheneEnv & parent, const std::string & tcl_libdir);
 
   ~GrapheneEnv();
 
-  // find database in the pool. Create/Open/Reopen if needed
-  GrapheneDB & getdb(const std::string & name, const int fl = 0);
+  // Find database in the pool. Open it if needed (for writing if the
+  // environment is not readonly, fl is used only for DB_CREATE and
+  // DB_EXCL flags then). Databases which are not used outside the pool
+  // can be closed by later getdb calls.
+  std::shared_ptr<GrapheneDB> getdb(const std::string & name, const int fl = 0);
+
+  // Set max number of opened databases (0 - no limit), default
+  // is DEF_POOL_SIZE.
+  void set_pool_size(const size_t n);
+
+  // print database pool statistics
+  void pool_stat(std::ostream & out);
+
+  // Set buffer size for bulk reads (0 - no bulk reads, or
+  // 1024..GRAPHENE_MAX_BULK), see GrapheneDB::set_bulk.
+  void set_bulk(const size_t b);
+
+  // Start the put queue (see GrapheneQueue), window=0 to stop it.
+  // Then put, put_batch and put_packed send points to the queue
+  // instead of writing them. The environment should be created
+  // with thread=true. If cfg.ack is set they wait until the points
+  // are written.
+  void set_queue(const GrapheneQueueCfg & cfg);
+
+  // Set caller id for the put queue (e.g. connection number in the
+  // socket mode), errors of queued points are reported to the caller.
+  void set_caller(const uint64_t c) { caller = c; }
+
+  // Wait until all points queued by the caller are written (nothing
+  // is done if the queue is not used).
+  void queue_flush() { if (queue) queue->flush(caller); }
+
+  // print queue statistics
+  void queue_stat(std::ostream & out);
+
+  // Set interval for writing input filter storage (0 - write
+  // after each put_flt), see GrapheneDB::set_f0sync.
+  void set_f0sync(const int s);
 
   /****************/
 
-  // return list of all databases
-  std::vector<std::string> dblist();
+  // return sorted list of databases with names starting with the prefix
+  // (all databases by default)
+  std::vector<std::string> dblist(const std::string & prefix = "") {
+    return catalog->list(prefix); }
+
+  // return sorted list of databases with names matching the regular expression
+  std::vector<std::string> dblist_re(const std::string & re) {
+    return catalog->list_re(re); }
+
+  // same as dblist_re if the pattern is written as /<re>/,
+  // same as dblist otherwise
+  std::vector<std::string> dbsearch(const std::string & pattern);
 
-  // create new database
+  // return database information (see GrapheneCatalog), if full is false
+  // only data and time types are filled
+  GrapheneDBInfo dbinfo(const std::string & name, const bool full = true);
+
+  // create new database (version 2 or 3, see GrapheneDB::set_version)
   void dbcreate(const std::string & name, const std::string & descr,
-              const DataType type);
+              const DataType type, const int version = DEF_DBVERSION);
 
   // remove database file
   void dbremove(const std::string & name);
@@ -138,10 +255,12 @@ class GrapheneEnv{
   void dbrename(const std::string & name1, const std::string & name2);
 
   // close one database, close all databases
+  // (input filter storage is written before closing)
   void close(const std::string & name);
   void close();
 
   // sync one database, sync all databases
+  // (storage of input filters is written)
   void sync(const std::string & name);
   void sync();
 
@@ -152,20 +271,24 @@ class GrapheneEnv{
   void list_logs();
 
   // print lock statistics
-  void lock_stat(bool reset);
+  void lock_stat(std::ostream & out, bool reset);
+
+  // print cache statistics (total and for each database file)
+  void mpool_stat(std::ostream & out, bool reset);
 
   /****************/
   void set_descr(const std::string & name, const std::string & descr) {
-     getdb(name).set_descr(descr); }
+     getdb(name)->set_descr(descr);
+     catalog->modified(name); }
 
   std::string get_descr(const std::string & name) {
-     return getdb(name, DB_RDONLY).get_descr(); }
+     return getdb(name, DB_RDONLY)->get_descr(); }
 
   DataType get_dtype(const std::string & name) {
-     return getdb(name, DB_RDONLY).get_dtype(); }
+     return dbinfo(name, false).dtype; }
 
   TimeType get_ttype(const std::string & name) {
-     return getdb(name, DB_RDONLY).get_ttype(); }
+     return dbinfo(name, false).ttype; }
 
   /****************/
 
@@ -173,30 +296,38 @@ class GrapheneEnv{
   // - reset temporary backup timer
   // - return value of the main backup timer
   std::string backup_start(const std::string & name) {
-    return getdb(name).backup_start(); }
+    return getdb(name)->backup_start(); }
 
   // backup end: notify that backup is successfully done
   // - commit temporary backup timer into main one
   void backup_end(const std::string & name, const std::string & t2 = "inf") {
-    getdb(name).backup_end(t2); }
+    getdb(name)->backup_end(t2); }
 
   // reset backup timer
   void backup_reset(const std::string & name) {
-     getdb(name).backup_reset(); }
+     getdb(name)->backup_reset(); }
 
   // get value of the backup timer
   std::string backup_get(const std::string & name) {
-     return getdb(name, DB_RDONLY).backup_get(); }
+     return getdb(name, DB_RDONLY)->backup_get(); }
 
   // is backup needed?
   bool backup_needed(const std::string & name) {
-     return getdb(name, DB_RDONLY).backup_needed(); }
+     return getdb(name, DB_RDONLY)->backup_needed(); }
 
   /****************/
 
   void put(const std::string & name, const std::string & t,
            const std::vector<std::string> & dat, const std::string &dpolicy);
 
+  // put many points in a single transaction
+  void put_batch(const std::string & name, const std::vector<std::string> & ts,
+           const std::vector<std::vector<std::string> > & dats, const std::string &dpolicy);
+
+  // put many packed points in a single transaction (binary protocol)
+  void put_packed(const std::string & name, const std::vector<GrapheneTime> & ts,
+           const std::vector<std::string> & vss, const std::string &dpolicy);
+
   void put_flt(const std::string & name, const std::string &t,
                const std::vector<std::string> & dat, const std::string &dpolicy);
 
@@ -214,10 +345,32 @@ class GrapheneEnv{
   void get(const std::string & ext_name, const std::string & t,
            const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data);
 
+  // get previous or interpolated points for many timestamps
+  // (same as get for each timestamp, sorted timestamps are
+  // found in a single pass)
+  void get_many(const std::string & ext_name, const std::vector<std::string> & ts,
+           const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data);
+
+  // get previous points for many timestamps (same as get_prev
+  // for each timestamp)
+  void get_prev_many(const std::string & ext_name, const std::vector<std::string> & ts,
+           const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data);
+
   // get data range
-  void get_range(const std::string & ext_name, const std::string & t1,
+  // If agg is not AGG_NONE, one aggregated point is returned for
+  // each dt interval (see GrapheneAgg). Rollup records are used
+  // if possible (see GrapheneDB::get_range_agg). With AGG_INTERP
+  // interpolated or previous values on the grid t1 + k*dt are
+  // returned (see GrapheneDB::get_range_grid).
+  // If maxn>0, range is read in parts: reading stops after maxn points
+  // (or aggregation intervals) and time to continue from is returned
+  // (empty string when the range is finished). time0 is zero time for
+  // relative time output (default: t1).
+  std::string get_range(const std::string & ext_name, const std::string & t1,
                  const std::string & t2, const std::string & dt,
-                 const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data);
+                 const TimeFMT timefmt, GrapheneFmtCB fmt_cb, void * fmt_cb_data,
+                 const AggMode agg = AGG_NONE, const size_t maxn = 0,
+                 const std::string & time0 = std::string());
 
   // get wide range (get_prev, get_range, get_next)
   void get_wrange(const std::string & ext_name, const std::string & t1,
@@ -233,35 +386,54 @@ class GrapheneEnv{
 
   // delete one data point
   void del(const std::string & name, const std::string & t1){
-    getdb(name).del(t1); }
+    getdb(name)->del(t1); }
 
   // delete all points in the data range
   void del_range(const std::string & name, const std::string & t1, const std::string & t2){
-    getdb(name).del_range(t1,t2); }
+    getdb(name)->del_range(t1,t2); }
 
   /****************/
 
   // create db and load file in db_dump format
   // (we can not use db_load because of user-defined comparison function)
   void load(const std::string & name, const std::string & fname){
-    getdb(name, DB_CREATE | DB_EXCL).load(fname); }
+    getdb(name, DB_CREATE | DB_EXCL)->load(fname);
+    catalog->add(name); }
 
   void dump(const std::string & name, const std::string & fname){
-    getdb(name, DB_RDONLY).dump(fname); }
+    getdb(name, DB_RDONLY)->dump(fname); }
+
+  /****************/
+
+  // set/get rollup tiers (see GrapheneDB::set_rollup)
+  void set_rollup(const std::string & name, const std::vector<uint32_t> & tiers){
+    getdb(name)->set_rollup(tiers);}
+
+  std::vector<uint32_t> get_rollup(const std::string & name){
+    return getdb(name, DB_RDONLY)->get_rollup();}
+
+  // set/get regular-interval mode (see GrapheneDB::set_regular)
+  void set_regular(const std::string & name, const std::string & start,
+                   const std::string & period, const uint32_t n){
+    getdb(name)->set_regular(start, period, n);}
+
+  GrapheneRegular get_regular(const std::string & name){
+    return getdb(name, DB_RDONLY)->get_regular();}
 
   /****************/
 
   void set_filter(const std::string & name, const int N, const std::string & code){
-    getdb(name).write_filter(N, code);}
+    getdb(name)->write_filter(N, code);
+    catalog->modified(name);}
 
   std::string get_filter(const std::string & name, const int N){
-    return getdb(name, DB_RDONLY).get_filter(N);}
+    return getdb(name, DB_RDONLY)->get_filter(N);}
 
   std::string get_f0data(const std::string & name){
-    return getdb(name, DB_RDONLY).get_f0data();}
+    return getdb(name, DB_RDONLY)->get_f0data();}
 
   void clear_f0data(const std::string & name){
-    getdb(name).clear_f0data();}
+    getdb(name)->clear_f0data();}
 
 };
 
@@ -0,0 +1,276 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <csignal>
+#include <pthread.h>
+
+#include "gr_queue.h"
+#include "gr_db.h"
+#include "err/err.h"
+
+/***********************************************************/
+GrapheneDurability
+graphene_durability_parse(const std::string & s){
+  if (strcasecmp(s.c_str(), "sync")==0)         return DUR_SYNC;
+  if (strcasecmp(s.c_str(), "write_nosync")==0) return DUR_WRITE_NOSYNC;
+  if (strcasecmp(s.c_str(), "nosync")==0)       return DUR_NOSYNC;
+  throw Err() << "Unknown durability level: " << s;
+}
+
+/***********************************************************/
+GrapheneQueue::GrapheneQueue(const std::shared_ptr<DB_ENV> & env_,
+       const std::string & dbpath_, const uint32_t page_size_,
+       const std::shared_ptr<GrapheneDBSharedMap> & dbshared_,
+       const GrapheneQueueCfg & cfg_):
+         env(env_), dbpath(dbpath_), page_size(page_size_), dbshared(dbshared_), cfg(cfg_),
+         npts(0), last(0), done(0), stop(false),
+         st_reqs(0), st_points(0), st_groups(0), st_failed(0) {
+
+  if (!env) throw Err() << "put queue can not be used without DB environment";
+  uint32_t fl = 0;
+  int ret = env->get_open_flags(env.get(), &fl);
+  if (ret != 0) throw Err() << "put queue: " << db_strerror(ret);
+  if (!(fl & DB_THREAD))
+    throw Err() << "put queue: environment should be opened with DB_THREAD flag";
+  txn = fl & DB_INIT_TXN;
+  if (cfg.maxn < 1) cfg.maxn = 1;
+
+  // signals should be processed by other threads
+  sigset_t sigs, oldsigs;
+  sigfillset(&sigs);
+  pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+  thr = std::thread(&GrapheneQueue::run, this);
+  pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+}
+
+GrapheneQueue::~GrapheneQueue(){
+  {
+    std::lock_guard<std::mutex> lk(m);
+    stop = true;
+  }
+  cv_in.notify_all();
+  thr.join();
+  if (errors.size())
+    std::cerr << "Error: " << errors.size()
+              << " queued put request(s) failed: " << st_error << "\n";
+}
+
+/***********************************************************/
+uint64_t
+GrapheneQueue::push(const std::string & name, const std::vector<GrapheneTime> & ts,
+                    const std::vector<std::string> & vs, const std::string & dpolicy,
+                    const uint64_t caller){
+  std::unique_lock<std::mutex> lk(m);
+
+  // do not collect too many points if the thread is busy
+  cv_done.wait(lk, [this]{return npts < 2*cfg.maxn;});
+
+  if (reqs.empty()) t_first = std::chrono::steady_clock::now();
+  reqs.push_back(Req());
+  Req & r = reqs.back();
+  r.num = ++last;
+  r.caller = caller;
+  r.name = name;
+  r.dpolicy = dpolicy;
+  r.ts = ts;
+  r.vs = vs;
+  npts += ts.size();
+  pending[caller] = last;
+  st_reqs++;
+  cv_in.notify_one();
+  return last;
+}
+
+void
+GrapheneQueue::report(const uint64_t num, const uint64_t caller){
+  size_t n = 0;
+  std::string msg;
+  for (auto e = errors.begin(); e!=errors.end() && e->first <= num; ){
+    if (e->second.first != caller) { e++; continue; }
+    if (n++ == 0) msg = e->second.second;
+    e = errors.erase(e);
+  }
+  if (n==0) return;
+  if (n==1) throw Err() << msg;
+  throw Err() << msg << " (and " << n-1 << " more failed put requests)";
+}
+
+void
+GrapheneQueue::wait(const uint64_t num, const uint64_t caller){
+  std::unique_lock<std::mutex> lk(m);
+  cv_done.wait(lk, [this,num]{return done >= num;});
+  report(num, caller);
+}
+
+void
+GrapheneQueue::flush(const uint64_t caller){
+  std::unique_lock<std::mutex> lk(m);
+  auto i = pending.find(caller);
+  if (i!=pending.end()){
+    uint64_t num = i->second;
+    cv_done.wait(lk, [this,num]{return done >= num;});
+  }
+  report(last, caller);
+}
+
+void
+GrapheneQueue::stat(std::ostream & out){
+  std::lock_guard<std::mutex> lk(m);
+  out << "time window, ms: " << cfg.window << "\n"
+      << "max number of points in a group: " << cfg.maxn << "\n"
+      << "durability: " << (cfg.durability==DUR_SYNC? "sync" :
+                            cfg.durability==DUR_WRITE_NOSYNC? "write_nosync" : "nosync") << "\n"
+      << "requests: " << st_reqs << "\n"
+      << "waiting requests: " << reqs.size() << "\n"
+      << "written points: " << st_points << "\n"
+      << "written groups: " << st_groups << "\n"
+      << "failed requests: " << st_failed << "\n";
+  if (st_error!="") out << "last error: " << st_error << "\n";
+}
+
+/***********************************************************/
+void
+GrapheneQueue::run(){
+  std::unique_lock<std::mutex> lk(m);
+  while (1){
+    cv_in.wait(lk, [this]{return stop || reqs.size();});
+    if (reqs.empty()) break;
+
+    // collect requests during the time window
+    cv_in.wait_until(lk, t_first + std::chrono::milliseconds(cfg.window),
+                     [this]{return stop || npts >= cfg.maxn;});
+    std::deque<Req> group;
+    group.swap(reqs);
+    npts = 0;
+    cv_done.notify_all();
+
+    lk.unlock();
+    write(group);
+    lk.lock();
+  }
+  lk.unlock();
+  std::lock_guard<std::mutex> plk(pm);
+  pool_idx.clear();
+  pool.clear();
+}
+
+void
+GrapheneQueue::close(const std::string & name){
+  // wait for waiting requests, errors are reported to their callers
+  {
+    std::unique_lock<std::mutex> lk(m);
+    uint64_t num = last;
+    cv_done.wait(lk, [this,num]{return done >= num;});
+  }
+  std::lock_guard<std::mutex> plk(pm);
+  auto i = pool_idx.find(name);
+  if (i==pool_idx.end()) return;
+  pool.erase(i->second);
+  pool_idx.erase(i);
+}
+
+/***********************************************************/
+GrapheneDB &
+GrapheneQueue::getdb(const std::string & name){
+  auto i = pool_idx.find(name);
+  if (i != pool_idx.end()){
+    pool.splice(pool.begin(), pool, i->second);
+    pool.front().second->check_info();
+    return *pool.front().second;
+  }
+
+  pool.emplace_front(name, std::make_shared<GrapheneDB>(
+    env.get(), dbpath, name, 0, page_size, dbshared->get(name)));
+  pool_idx[name] = pool.begin();
+
+  // close least recently used databases
+  while (cfg.max_dbs && pool.size() > cfg.max_dbs){
+    pool_idx.erase(pool.back().first);
+    pool.pop_back();
+  }
+  return *pool.front().second;
+}
+
+/***********************************************************/
+void
+GrapheneQueue::write(std::deque<Req> & group){
+
+  // split requests by database and duplicate policy, keeping the order
+  typedef std::pair<std::string, std::string> key_t;
+  std::vector<key_t> keys;
+  std::map<key_t, std::vector<Req*> > sets;
+  for (auto & r: group){
+    key_t k(r.name, r.dpolicy);
+    if (!sets.count(k)) keys.push_back(k);
+    sets[k].push_back(&r);
+  }
+
+  int flags = cfg.durability==DUR_NOSYNC? DB_TXN_NOSYNC :
+              cfg.durability==DUR_WRITE_NOSYNC? DB_TXN_WRITE_NOSYNC : 0;
+  std::map<uint64_t, std::pair<uint64_t, std::string> > errs;
+  uint64_t ngroups = 0, npoints = 0;
+
+  std::unique_lock<std::mutex> plk(pm);
+  for (auto const & k: keys){
+    auto & rs = sets[k];
+    try {
+      GrapheneDB & db = getdb(k.first);
+
+      // one transaction for all requests
+      if (txn && rs.size()>1){
+        std::vector<GrapheneTime> ts;
+        std::vector<std::string> vs;
+        for (auto r: rs){
+          ts.insert(ts.end(), r->ts.begin(), r->ts.end());
+          vs.insert(vs.end(), r->vs.begin(), r->vs.end());
+        }
+        try {
+          db.put_packed(ts, vs, k.second, flags);
+          ngroups++;
+          npoints += ts.size();
+          continue;
+        }
+        catch (Err & e) {}
+      }
+
+      // Write requests one by one: the transaction failed (find broken
+      // requests), or there are no transactions (do not write points of
+      // a failed request twice).
+      for (auto r: rs){
+        try {
+          db.put_packed(r->ts, r->vs, k.second, flags);
+          ngroups++;
+          npoints += r->ts.size();
+        }
+        catch (Err & e) { errs[r->num] = std::make_pair(r->caller, e.str()); }
+      }
+    }
+    catch (Err & e){
+      for (auto r: rs) errs[r->num] = std::make_pair(r->caller, e.str());
+    }
+  }
+
+  // without transactions sync databases
+  if (!txn && cfg.durability==DUR_SYNC)
+    for (auto const & k: keys)
+      try { getdb(k.first).sync(); } catch (Err & e) {}
+  plk.unlock();
+
+  std::lock_guard<std::mutex> lk(m);
+  for (auto const & e: errs){
+    errors[e.first] = e.second;
+    st_error = e.second.second;
+  }
+  // keep only recent errors if nobody waits for them
+  while (errors.size() > 1000) errors.erase(errors.begin());
+  st_failed += errs.size();
+  st_groups += ngroups;
+  st_points += npoints;
+  done = group.back().num;
+  for (auto i = pending.begin(); i!=pending.end(); ){
+    if (i->second <= done) i = pending.erase(i);
+    else i++;
+  }
+  cv_done.notify_all();
+}
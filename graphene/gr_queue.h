@@ -0,0 +1,153 @@
+/* GrapheneQueue class: asynchronous group commit of put requests
+ */
+
+#ifndef GR_QUEUE_H
+#define GR_QUEUE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+#include <db.h>
+
+#include "data.h"
+
+class GrapheneDB;
+class GrapheneDBSharedMap;
+
+/***********************************************************/
+// Durability of queue commits:
+// - sync: log is flushed on commit (databases are synced in
+//   environments without transactions);
+// - write_nosync: log is written but not flushed (DB_TXN_WRITE_NOSYNC),
+//   data is lost if the system crashes;
+// - nosync: log is not written on commit (DB_TXN_NOSYNC), data is lost
+//   if the process crashes.
+enum GrapheneDurability {DUR_SYNC, DUR_WRITE_NOSYNC, DUR_NOSYNC};
+
+// Convert string into GrapheneDurability (sync, write_nosync, nosync).
+GrapheneDurability graphene_durability_parse(const std::string & s);
+
+// Queue parameters
+struct GrapheneQueueCfg {
+  uint32_t window; // time window, ms (0 - no queue)
+  size_t   maxn;   // write points as soon as maxn of them are collected
+  GrapheneDurability durability;
+  size_t   max_dbs; // max number of databases kept open by the queue (0 - no limit)
+  bool     ack;     // put requests wait until their points are written
+  GrapheneQueueCfg(): window(0), maxn(10000), durability(DUR_SYNC), max_dbs(256), ack(false) {}
+};
+
+/***********************************************************/
+// Put requests from many callers (threads) are collected during the
+// time window (starting with the first request) or until maxn points
+// are collected. Then they are written by a separate thread, in a
+// single transaction for each database and duplicate policy. If the
+// transaction fails, requests are written one by one to find the
+// broken ones.
+//
+// Each request has a caller id (e.g. a connection number). Errors are
+// reported only to the caller of the failed request, by wait or flush.
+//
+// The environment should be opened with DB_THREAD flag. Databases are
+// opened by the queue thread and kept open between groups, if there are
+// more than max_dbs of them the least recently used ones are closed.
+class GrapheneQueue {
+
+  // a request: packed points for one database
+  struct Req {
+    uint64_t num;
+    uint64_t caller;
+    std::string name;
+    std::string dpolicy;
+    std::vector<GrapheneTime> ts;
+    std::vector<std::string> vs;
+  };
+
+  std::shared_ptr<DB_ENV> env;
+  std::string dbpath;
+  uint32_t page_size;
+  std::shared_ptr<GrapheneDBSharedMap> dbshared; // database information shared with other threads
+  GrapheneQueueCfg cfg;
+  bool txn; // transactions are used
+
+  std::mutex m;
+  std::condition_variable cv_in;   // new requests or stop
+  std::condition_variable cv_done; // requests are written
+  std::deque<Req> reqs;            // waiting requests
+  std::chrono::steady_clock::time_point t_first; // time of the first waiting request
+  size_t npts;    // number of waiting points
+  uint64_t last;  // number of the last request
+  uint64_t done;  // all requests up to this number are written
+  bool stop;
+  std::map<uint64_t, uint64_t> pending; // last waiting request of each caller
+  std::map<uint64_t, std::pair<uint64_t, std::string> > errors; // caller and error of failed requests
+
+  // statistics
+  uint64_t st_reqs, st_points, st_groups, st_failed;
+  std::string st_error;
+
+  std::thread thr;
+
+  // Databases opened by the queue thread: a list in the order of use
+  // (most recently used first) and a hash index, as in GrapheneEnv.
+  typedef std::list<std::pair<std::string, std::shared_ptr<GrapheneDB> > > pool_t;
+  std::mutex pm; // lock for the pool
+  pool_t pool;
+  std::unordered_map<std::string, pool_t::iterator> pool_idx;
+
+  // find database in the pool, open it if needed
+  GrapheneDB & getdb(const std::string & name);
+
+  // thread function
+  void run();
+
+  // write a group of requests
+  void write(std::deque<Req> & group);
+
+  // Throw errors of the caller's requests up to num (m should be locked).
+  void report(const uint64_t num, const uint64_t caller);
+
+  public:
+
+  GrapheneQueue(const std::shared_ptr<DB_ENV> & env_, const std::string & dbpath_,
+                const uint32_t page_size_,
+                const std::shared_ptr<GrapheneDBSharedMap> & dbshared_,
+                const GrapheneQueueCfg & cfg_);
+
+  // write all waiting requests and stop the thread
+  ~GrapheneQueue();
+
+  // Add a request, return its number.
+  uint64_t push(const std::string & name, const std::vector<GrapheneTime> & ts,
+                const std::vector<std::string> & vs, const std::string & dpolicy,
+                const uint64_t caller = 0);
+
+  // Wait until the request num and all previous ones are written.
+  // Throw an error if some of the caller's requests failed (each error
+  // is reported once).
+  void wait(const uint64_t num, const uint64_t caller = 0);
+
+  // Wait until all requests of the caller are written, report errors.
+  void flush(const uint64_t caller = 0);
+
+  // should put requests wait until points are written?
+  bool ack() const { return cfg.ack; }
+
+  // Write all waiting requests and close the database if it is
+  // opened by the queue (before removing or renaming it).
+  void close(const std::string & name);
+
+  // print statistics
+  void stat(std::ostream & out);
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+#include "gr_rollup.h"
+#include "gr_db.h"
+#include "gr_agg.h"
+#include "err/err.h"
+
+/***********************************************************/
+GrapheneRollup::GrapheneRollup(DB_ENV *env, const std::string & path,
+       const std::string & name_, const uint32_t flags,
+       const TimeType ttype_, const DataType dtype_,
+       const std::vector<uint32_t> & tiers_):
+         name(name_), ttype(ttype_), dtype(dtype_),
+         tiers(tiers_), bulk(0) {
+
+  check_tiers(tiers);
+
+  std::string fname = name + ".rollup";
+  if (!env) { fname = path + "/" + fname; }
+
+  DB *dbp1;
+  int ret = db_create(&dbp1, env, 0);
+  if (ret != 0)
+    throw Err() << name << ".rollup: " << db_strerror(ret);
+  dbp = std::shared_ptr<DB>(dbp1, GrapheneRollup::D());
+
+  // companion database is created when needed
+  uint32_t fl = flags & ~DB_EXCL;
+  if (!(fl & DB_RDONLY)) fl |= DB_CREATE;
+
+  // default key comparison (memcmp) is used
+  ret = dbp->open(dbp.get(), NULL, fname.c_str(), NULL,
+                  DB_BTREE, fl, 0644);
+  if (ret != 0)
+    throw Err() << name << ".rollup: " << db_strerror(ret);
+}
+
+/***********************************************************/
+void
+GrapheneRollup::check_tiers(const std::vector<uint32_t> & tiers){
+  for (size_t i=0; i<tiers.size(); i++){
+    if (tiers[i]==0)
+      throw Err() << "Rollup tier length should be positive";
+    if (i>0 && (tiers[i] <= tiers[i-1] || tiers[i]%tiers[i-1]!=0))
+      throw Err() << "Rollup tier length should be a multiple of the previous one: "
+                  << tiers[i-1] << " " << tiers[i];
+  }
+}
+
+std::string
+GrapheneRollup::pack_tiers(const std::vector<uint32_t> & tiers){
+  return std::string((char *)tiers.data(), tiers.size()*sizeof(uint32_t));
+}
+
+std::vector<uint32_t>
+GrapheneRollup::unpack_tiers(const std::string & s){
+  if (s.size() % sizeof(uint32_t) != 0)
+    throw Err() << "Broken database: wrong rollup tiers";
+  std::vector<uint32_t> ret(s.size()/sizeof(uint32_t));
+  memcpy(ret.data(), s.data(), s.size());
+  return ret;
+}
+
+/***********************************************************/
+std::string
+GrapheneRollup::mk_key(const uint32_t L, const GrapheneTime & t) const {
+  std::string k(sizeof(uint32_t) + sizeof(uint64_t), '\0');
+  for (int i=0; i<4; i++) k[i]   = (char)(L >> (8*(3-i)));
+  for (int i=0; i<8; i++) k[4+i] = (char)(t.val() >> (8*(7-i)));
+  return k;
+}
+
+void
+GrapheneRollup::parse_key(const GrapheneView & k, uint32_t & L, GrapheneTime & t) const {
+  if (k.size() != sizeof(uint32_t) + sizeof(uint64_t))
+    throw Err() << name << ".rollup: broken key";
+  const uint8_t *p = (const uint8_t *)k.data();
+  L = 0;
+  uint64_t v = 0;
+  for (int i=0; i<4; i++) L = (L<<8) + p[i];
+  for (int i=0; i<8; i++) v = (v<<8) + p[4+i];
+  t = GrapheneTime(v);
+}
+
+/***********************************************************/
+GrapheneTime
+GrapheneRollup::bucket(const GrapheneTime & t, const uint32_t L) const {
+  return GrapheneTime::make(t.sec(ttype)/L*L, 0, ttype);
+}
+
+GrapheneTime
+GrapheneRollup::bucket_last(const GrapheneTime & b, const uint32_t L) const {
+  uint64_t s = b.sec(ttype) + L;
+  GrapheneTime mx = GrapheneTime::max(ttype);
+  if (s > mx.sec(ttype)) return mx;
+  return GrapheneTime(GrapheneTime::make(s, 0, ttype).val() - 1);
+}
+
+uint32_t
+GrapheneRollup::find_tier(const GrapheneTime & t1, const GrapheneTime & dt) const {
+  uint32_t ret = 0;
+  for (auto L:tiers){
+    // single interval: edges are read only once
+    if (dt.zero()) {ret = L; continue;}
+
+    // intervals consist of whole tier records
+    if (t1.nsec(ttype)==0 && t1.sec(ttype)%L==0 &&
+        dt.nsec(ttype)==0 && dt.sec(ttype)%L==0) {ret = L; continue;}
+
+    // otherwise edges of each interval are read from the main database,
+    // tier records should be small enough
+    if (dt.sec(ttype) >= 4*(uint64_t)L) ret = L;
+  }
+  return ret;
+}
+
+/***********************************************************/
+void
+GrapheneRollup::put(DB_TXN *txn, const std::string & k, const std::string & v){
+  DBT kd, vd;
+  memset(&kd, 0, sizeof(DBT));
+  memset(&vd, 0, sizeof(DBT));
+  kd.data = (void *)k.data(); kd.size = k.size();
+  vd.data = (void *)v.data(); vd.size = v.size();
+  int ret = dbp->put(dbp.get(), txn, &kd, &vd, 0);
+  if (ret != 0)
+    throw Err() << name << ".rollup: " << db_strerror(ret);
+}
+
+void
+GrapheneRollup::del(DB_TXN *txn, const uint32_t L,
+                    const GrapheneTime & t1, const GrapheneTime & t2){
+  std::string k2 = mk_key(L, t2);
+  GrapheneCursor curs(dbp.get(), txn, name);
+  curs.set_key(mk_key(L, t1));
+  int fl = DB_SET_RANGE;
+  while (curs.get(fl)){
+    fl = DB_NEXT;
+    if (curs.key().str() > k2) break;
+    curs.del();
+  }
+}
+
+void
+GrapheneRollup::add(DB_TXN *txn, const GrapheneTime & t, const GrapheneView & v){
+  for (auto L:tiers){
+    std::string k = mk_key(L, bucket(t, L));
+    DBT kd, vd;
+    memset(&kd, 0, sizeof(DBT));
+    memset(&vd, 0, sizeof(DBT));
+    kd.data = (void *)k.data(); kd.size = k.size();
+    vd.flags = DB_DBT_MALLOC;
+
+    GrapheneAggData d(dtype);
+    int ret = dbp->get(dbp.get(), txn, &kd, &vd, 0);
+    if (ret == 0) {
+      std::string r((char *)vd.data, vd.size);
+      free(vd.data);
+      d.add_packed(r);
+    }
+    else if (ret != DB_NOTFOUND)
+      throw Err() << name << ".rollup: " << db_strerror(ret);
+
+    d.add(v);
+    put(txn, k, d.pack());
+  }
+}
+
+void
+GrapheneRollup::rebuild(DB_TXN *txn, GrapheneDB & dbm,
+                        const GrapheneTime & t1, const GrapheneTime & t2){
+  for (size_t j=0; j<tiers.size(); j++){
+    uint32_t L = tiers[j];
+    GrapheneTime b1 = bucket(t1, L);
+    GrapheneTime b2 = bucket(t2, L);
+    GrapheneTime e2 = bucket_last(b2, L);
+    del(txn, L, b1, b2);
+
+    // collect new records: the first tier is calculated from
+    // the main database, others from the previous tier
+    std::vector<std::pair<GrapheneTime, std::string> > recs;
+    GrapheneAggData d(dtype);
+    GrapheneTime cb; // current bucket
+    auto add = [&](const GrapheneTime & t, const GrapheneView & v){
+      GrapheneTime b = bucket(t, L);
+      if (d.nrec && b != cb){
+        recs.push_back(std::make_pair(cb, d.pack()));
+        d.clear();
+      }
+      cb = b;
+      if (j==0) d.add(v);
+      else d.add_packed(v);
+    };
+
+    if (j==0) {
+      GrapheneDataCursor curs(dbm, txn, bulk);
+      curs.set_key(b1, ttype);
+      int fl = DB_SET_RANGE;
+      while (curs.get(fl)){
+        fl = DB_NEXT;
+        if (!curs.is_tstamp()) continue;
+        GrapheneTime t = curs.time(ttype);
+        if (t > e2) break;
+        add(t, curs.val());
+      }
+    }
+    else {
+      GrapheneCursor curs(dbp.get(), txn, name, bulk);
+      std::string k2 = mk_key(tiers[j-1], e2);
+      curs.set_key(mk_key(tiers[j-1], b1));
+      int fl = DB_SET_RANGE;
+      while (curs.get(fl)){
+        fl = DB_NEXT;
+        if (curs.key().str() > k2) break;
+        uint32_t Lp;
+        GrapheneTime t;
+        parse_key(curs.key(), Lp, t);
+        add(t, curs.val());
+      }
+    }
+    if (d.nrec) recs.push_back(std::make_pair(cb, d.pack()));
+
+    for (auto const & r:recs) put(txn, mk_key(L, r.first), r.second);
+  }
+}
+
+void
+GrapheneRollup::clear(DB_TXN *txn){
+  u_int32_t n;
+  int ret = dbp->truncate(dbp.get(), txn, &n, 0);
+  if (ret != 0)
+    throw Err() << name << ".rollup: " << db_strerror(ret);
+}
+
+void
+GrapheneRollup::get(DB_TXN *txn, const uint32_t L, const GrapheneTime & t1,
+                    const GrapheneTime & t2, GrapheneAgg & out){
+  std::string k2 = mk_key(L, t2);
+  GrapheneCursor curs(dbp.get(), txn, name, bulk);
+  curs.set_key(mk_key(L, t1));
+  int fl = DB_SET_RANGE;
+  while (curs.get(fl)){
+    fl = DB_NEXT;
+    if (curs.key().str() > k2) break;
+    uint32_t l;
+    GrapheneTime t;
+    parse_key(curs.key(), l, t);
+    out.proc_rollup(t, curs.val());
+  }
+}
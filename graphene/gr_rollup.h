@@ -0,0 +1,104 @@
+/* GrapheneRollup class: rollup tiers, aggregated data for fixed
+   time intervals, stored in a companion database <name>.rollup
+ */
+
+#ifndef GR_ROLLUP_H
+#define GR_ROLLUP_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <db.h>
+
+#include "data.h"
+
+class GrapheneAgg;
+class GrapheneDB;
+
+/***********************************************************/
+// Each tier has a length L (integer number of seconds) and contains
+// one record for each interval [k*L, (k+1)*L) with some data. Records
+// are packed GrapheneAggData (number of points, min, max, sum and
+// number of non-NaN values for each column).
+//
+// Key of a record: tier length (4 bytes) + bucket start (8 bytes),
+// both big-endian, default key comparison is used.
+//
+// Tiers should be increasing, each one a multiple of the previous one:
+// the first tier is calculated from the main database, others from
+// the previous tier.
+class GrapheneRollup {
+  std::shared_ptr<DB> dbp;
+  std::string name; // database name
+  TimeType ttype;
+  DataType dtype;
+  std::vector<uint32_t> tiers; // tier lengths, seconds
+  size_t bulk;      // buffer size for bulk reads
+
+  // database deleter
+  struct D {
+    void operator()(DB* dbp) { dbp->close(dbp, 0); }
+  };
+
+  // make a record key
+  std::string mk_key(const uint32_t L, const GrapheneTime & t) const;
+
+  // parse a record key
+  void parse_key(const GrapheneView & k, uint32_t & L, GrapheneTime & t) const;
+
+  // write a record
+  void put(DB_TXN *txn, const std::string & k, const std::string & v);
+
+  // delete records of tier L with bucket start in t1..t2
+  void del(DB_TXN *txn, const uint32_t L,
+           const GrapheneTime & t1, const GrapheneTime & t2);
+
+  public:
+
+  // Open the companion database <name_>.rollup (created if needed).
+  // flags are open flags of the main database.
+  GrapheneRollup(DB_ENV *env, const std::string & path, const std::string & name_,
+                 const uint32_t flags, const TimeType ttype_, const DataType dtype_,
+                 const std::vector<uint32_t> & tiers_);
+
+  // Check tier lengths, throw an error if they are not valid.
+  static void check_tiers(const std::vector<uint32_t> & tiers);
+
+  // Pack/unpack tier lengths (for keeping them in the main database).
+  static std::string pack_tiers(const std::vector<uint32_t> & tiers);
+  static std::vector<uint32_t> unpack_tiers(const std::string & s);
+
+  const std::vector<uint32_t> & get_tiers() const { return tiers; }
+
+  void set_bulk(const size_t b) { bulk = b; }
+
+  // Start of the tier L bucket containing t.
+  GrapheneTime bucket(const GrapheneTime & t, const uint32_t L) const;
+
+  // Last timestamp of the tier L bucket starting at b.
+  GrapheneTime bucket_last(const GrapheneTime & b, const uint32_t L) const;
+
+  // Find the largest tier suitable for aggregation with intervals
+  // of length dt starting at t1 (dt=0 for a single interval),
+  // return 0 if there is no such tier.
+  uint32_t find_tier(const GrapheneTime & t1, const GrapheneTime & dt) const;
+
+  // A new point is added to the main database: update all tiers.
+  void add(DB_TXN *txn, const GrapheneTime & t, const GrapheneView & v);
+
+  // Points in the time range t1..t2 are modified or deleted: rebuild all
+  // tiers in this range using the main database.
+  void rebuild(DB_TXN *txn, GrapheneDB & dbm, const GrapheneTime & t1, const GrapheneTime & t2);
+
+  // Delete all records.
+  void clear(DB_TXN *txn);
+
+  // Send records of tier L with bucket start in t1..t2 to the aggregator.
+  void get(DB_TXN *txn, const uint32_t L, const GrapheneTime & t1,
+           const GrapheneTime & t2, GrapheneAgg & out);
+
+  // sync the database
+  void sync() {dbp->sync(dbp.get(), 0);}
+};
+
+#endif
@@ -62,6 +62,9 @@ GrapheneTCL::add_cmd(const char *name, GrapheneTCLProc * proc){
 void
 GrapheneTCL::restart(const std::string & tcl_libdir) {
 
+  // compiled scripts belong to the old interpreter
+  scripts.clear();
+
   // create TCL interpreter
   interp = std::shared_ptr<Tcl_Interp> (Tcl_CreateInterp(), Tcl_DeleteInterp);
   if (!interp) throw Err() << "filter: can't run TCL interpreter\n";
@@ -99,6 +102,24 @@ GrapheneTCL::restart(const std::string & tcl_libdir) {
 
 /***************************************************/
 
+// Compiled scripts are kept until the interpreter is restarted.
+// Number of different filters is small, but the cache is cleared
+// if it grows too large (e.g. if input filter is changed many times).
+#define MAX_SCRIPTS 256
+
+Tcl_Obj *
+GrapheneTCL::get_script(const std::string & code){
+  auto i = scripts.find(code);
+  if (i!=scripts.end()) return i->second.get();
+
+  if (scripts.size() >= MAX_SCRIPTS) scripts.clear();
+  Tcl_Obj *o = Tcl_NewStringObj(code.data(), code.size());
+  Tcl_IncrRefCount(o);
+  std::shared_ptr<Tcl_Obj> so(o, [](Tcl_Obj *o){ Tcl_DecrRefCount(o); });
+  scripts.emplace(code, so);
+  return o;
+}
+
 // Process and optionally modify input, return true if it
 // should be recorded.
 //
@@ -116,32 +137,33 @@ GrapheneTCL::run(const std::string & code, std::string & t, std::vector<std::str
   if (code=="") return true;
 
   // define global variable time
-  if (Tcl_SetVar(interp.get(), "time", t.c_str(), TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG) == NULL)
+  if (Tcl_SetVar2Ex(interp.get(), "time", NULL, Tcl_NewStringObj(t.data(), t.size()),
+                    TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG) == NULL)
     throw Err() << "filter: can't set time variable: " << tcl_error(interp.get());
 
-  // define global variable data
-  if (Tcl_SetVar(interp.get(), "data", "", TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG) == NULL)
+  // define global variable data (list of values)
+  std::vector<Tcl_Obj *> dl;
+  dl.reserve(d.size());
+  for (auto const & v:d) dl.push_back(Tcl_NewStringObj(v.data(), v.size()));
+  if (Tcl_SetVar2Ex(interp.get(), "data", NULL, Tcl_NewListObj(dl.size(), dl.data()),
+                    TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG) == NULL)
     throw Err() << "filter: can't set data variable: " << tcl_error(interp.get());
 
-  // append values to data list
-  for (auto const & v:d)
-    if (Tcl_SetVar(interp.get(), "data", v.c_str(),
-            TCL_GLOBAL_ONLY | TCL_APPEND_VALUE | TCL_LIST_ELEMENT | TCL_LEAVE_ERR_MSG) == NULL)
-      throw Err() << "filter: can't set data variable: " << tcl_error(interp.get());
-
   // define global variable storage
-  if (Tcl_SetVar(interp.get(), "storage", storage.c_str(), TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG) == NULL)
+  if (Tcl_SetVar2Ex(interp.get(), "storage", NULL, Tcl_NewStringObj(storage.data(), storage.size()),
+                    TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG) == NULL)
     throw Err() << "filter: can't set storage variable: " << tcl_error(interp.get());
 
-
-  // run TCL script
-  if (Tcl_Eval(interp.get(), code.c_str()) != TCL_OK)
+  // run TCL script (compiled on first use)
+  if (Tcl_EvalObjEx(interp.get(), get_script(code), 0) != TCL_OK)
     throw Err() << "filter: can't run TCL script: " << tcl_error(interp.get());
 
   // get timestamp back
-  auto tc = Tcl_GetVar(interp.get(), "time", TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG);
-  if (tc==NULL) throw Err() << "filter: can't get time value: " << tcl_error(interp.get());
-  t = tc;
+  auto to = Tcl_GetVar2Ex(interp.get(), "time", NULL, TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG);
+  if (to==NULL) throw Err() << "filter: can't get time value: " << tcl_error(interp.get());
+  int len;
+  const char* s = Tcl_GetStringFromObj(to, &len);
+  t.assign(s, len);
 
   // get data back
   Tcl_Obj* lst = Tcl_GetVar2Ex(interp.get(), "data", NULL, TCL_GLOBAL_ONLY);
@@ -152,24 +174,94 @@ GrapheneTCL::run(const std::string & code, std::string & t, std::vector<std::str
       throw Err() << "filter: broken data list: " << tcl_error(interp.get());
     d.clear();
     for (int i = 0; i < n; ++i,++elem){
-      int len;
       const char* s = Tcl_GetStringFromObj(*elem, &len);
       if (!s) throw Err() << "filter: can't get string value from storage: " << tcl_error(interp.get());
       d.push_back(std::string(s, s+len));
     }
   }
 
-
   // get storage back
-  auto storagec = Tcl_GetVar(interp.get(), "storage", TCL_GLOBAL_ONLY);
-  storage = storagec? storagec:"";
+  auto so = Tcl_GetVar2Ex(interp.get(), "storage", NULL, TCL_GLOBAL_ONLY);
+  if (so) {
+    s = Tcl_GetStringFromObj(so, &len);
+    storage.assign(s, len);
+  }
+  else storage = "";
 
   // Return value. If value can not be converted assume true
   int ret;
-  auto ret_str = Tcl_GetString(Tcl_GetObjResult(interp.get()));
-  if (!ret_str || Tcl_GetBoolean(interp.get(), ret_str, &ret) != TCL_OK)
+  if (Tcl_GetBooleanFromObj(NULL, Tcl_GetObjResult(interp.get()), &ret) != TCL_OK)
     ret = true;
 
   return ret;
 }
 
+/***************************************************/
+
+bool
+GrapheneTCL::is_batch(const std::string & code){
+  size_t n = code.find_first_not_of(" \t\n");
+  if (n==std::string::npos || code[n]!='#') return false;
+  n = code.find_first_not_of(" \t", n+1);
+  if (n==std::string::npos || code.compare(n, 5, "batch")!=0) return false;
+  return n+5==code.size() || strchr(" \t\n", code[n+5]);
+}
+
+// Process a block of points. Global variables:
+//  times -- list of timestamps
+//  data  -- list of data lists, one for each timestamp
+// Filter should modify both lists (with same length). Return
+// value is not used.
+void
+GrapheneTCL::run_batch(const std::string & code, std::vector<std::string> & t,
+                       std::vector<std::vector<std::string> > & d){
+  if (t.size()!=d.size())
+    throw Err() << "filter: different number of timestamps and data";
+
+  // define global variables times and data
+  std::vector<Tcl_Obj *> tl, dl, el;
+  tl.reserve(t.size());
+  dl.reserve(d.size());
+  for (size_t i=0; i<t.size(); i++){
+    tl.push_back(Tcl_NewStringObj(t[i].data(), t[i].size()));
+    el.clear();
+    for (auto const & v:d[i]) el.push_back(Tcl_NewStringObj(v.data(), v.size()));
+    dl.push_back(Tcl_NewListObj(el.size(), el.data()));
+  }
+  if (Tcl_SetVar2Ex(interp.get(), "times", NULL, Tcl_NewListObj(tl.size(), tl.data()),
+                    TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG) == NULL)
+    throw Err() << "filter: can't set times variable: " << tcl_error(interp.get());
+  if (Tcl_SetVar2Ex(interp.get(), "data", NULL, Tcl_NewListObj(dl.size(), dl.data()),
+                    TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG) == NULL)
+    throw Err() << "filter: can't set data variable: " << tcl_error(interp.get());
+
+  // run TCL script (compiled on first use)
+  if (Tcl_EvalObjEx(interp.get(), get_script(code), 0) != TCL_OK)
+    throw Err() << "filter: can't run TCL script: " << tcl_error(interp.get());
+
+  // get lists back
+  int nt, nd, n, len;
+  Tcl_Obj **te, **de, **e;
+  Tcl_Obj* to = Tcl_GetVar2Ex(interp.get(), "times", NULL, TCL_GLOBAL_ONLY);
+  Tcl_Obj* dto = Tcl_GetVar2Ex(interp.get(), "data", NULL, TCL_GLOBAL_ONLY);
+  if (!to || Tcl_ListObjGetElements(interp.get(), to, &nt, &te) != TCL_OK)
+    throw Err() << "filter: broken times list: " << tcl_error(interp.get());
+  if (!dto || Tcl_ListObjGetElements(interp.get(), dto, &nd, &de) != TCL_OK)
+    throw Err() << "filter: broken data list: " << tcl_error(interp.get());
+  if (nt!=nd)
+    throw Err() << "filter: different length of times and data lists: " << nt << " " << nd;
+
+  t.resize(nt);
+  d.resize(nt);
+  for (int i = 0; i < nt; ++i){
+    const char* s = Tcl_GetStringFromObj(te[i], &len);
+    t[i].assign(s, len);
+    if (Tcl_ListObjGetElements(interp.get(), de[i], &n, &e) != TCL_OK)
+      throw Err() << "filter: broken data list: " << tcl_error(interp.get());
+    d[i].resize(n);
+    for (int j = 0; j < n; ++j){
+      s = Tcl_GetStringFromObj(e[j], &len);
+      d[i][j].assign(s, len);
+    }
+  }
+}
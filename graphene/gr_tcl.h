@@ -7,6 +7,7 @@
 #include <sstream>
 #include <cmath>
 #include <memory>
+#include <map>
 
 #include "opt/opt.h"
 #include "err/err.h"
@@ -26,6 +27,14 @@ class GrapheneTCL {
 
   std::shared_ptr<Tcl_Interp> interp;
 
+  // Compiled scripts: code -> script object. Tcl keeps
+  // bytecode in the object, the code is compiled only once.
+  // (should be deleted before the interpreter)
+  std::map<std::string, std::shared_ptr<Tcl_Obj> > scripts;
+
+  // get script object for the code
+  Tcl_Obj * get_script(const std::string & code);
+
   public:
 
   // Restart the interpreter
@@ -41,6 +50,14 @@ class GrapheneTCL {
   bool run(const std::string & code, std::string & t,
            std::vector<std::string> & d, std::string & storage);
 
+  // Check if the code is a batch filter (first line is "#batch").
+  static bool is_batch(const std::string & code);
+
+  // Run a batch filter for a block of points. Timestamps and data
+  // lists are replaced by the filtered block.
+  void run_batch(const std::string & code, std::vector<std::string> & t,
+           std::vector<std::vector<std::string> > & d);
+
 };
 
 #endif
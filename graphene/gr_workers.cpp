@@ -0,0 +1,111 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <csignal>
+#include <pthread.h>
+
+#include "gr_workers.h"
+#include "err/err.h"
+
+/***********************************************************/
+GrapheneWorkers::GrapheneWorkers(const GrapheneEnv & parent,
+       const std::string & tcllib, const int nthreads): stop(false) {
+
+  if (nthreads<0) throw Err() << "non-negative number of threads expected";
+
+  // signals should be processed by other threads
+  sigset_t sigs, oldsigs;
+  sigfillset(&sigs);
+  pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+  for (int i=0; i<nthreads; i++)
+    thr.emplace_back(&GrapheneWorkers::run_thread, this, &parent, tcllib);
+  pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+}
+
+GrapheneWorkers::~GrapheneWorkers(){
+  {
+    std::lock_guard<std::mutex> lk(m);
+    stop = true;
+  }
+  cv_in.notify_all();
+  for (auto & t: thr) t.join();
+}
+
+/***********************************************************/
+bool
+GrapheneWorkers::take(Batch * b, size_t & n){
+  if (b->next >= b->jobs->size()) return false;
+  n = b->next++;
+  // all jobs are taken: remove the batch from the queue
+  if (b->next == b->jobs->size()){
+    auto i = std::find(batches.begin(), batches.end(), b);
+    if (i!=batches.end()) batches.erase(i);
+  }
+  return true;
+}
+
+void
+GrapheneWorkers::run_job(Batch * b, const size_t n, GrapheneEnv * env){
+  std::string err;
+  try { (*b->jobs)[n](env); }
+  catch (Err & e) { err = e.str(); }
+  catch (std::exception & e) { err = e.what(); }
+
+  std::lock_guard<std::mutex> lk(m);
+  if (err!="" && n < b->err_n) { b->err_n = n; b->err = err; }
+  b->done++;
+  if (b->done == b->jobs->size()) cv_done.notify_all();
+}
+
+void
+GrapheneWorkers::run_thread(const GrapheneEnv * parent, const std::string tcllib){
+  // environment is created in the thread which uses it
+  // (without it jobs are run by other threads)
+  std::unique_ptr<GrapheneEnv> env;
+  try { env.reset(new GrapheneEnv(*parent, tcllib)); }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return;
+  }
+
+  std::unique_lock<std::mutex> lk(m);
+  while (1){
+    cv_in.wait(lk, [this]{return stop || batches.size();});
+    if (stop) return;
+    Batch * b = batches.front();
+    size_t n;
+    if (!take(b, n)) continue;
+    lk.unlock();
+    run_job(b, n, env.get());
+    lk.lock();
+  }
+}
+
+/***********************************************************/
+void
+GrapheneWorkers::run(std::vector<job_t> & jobs, GrapheneEnv * env){
+  if (jobs.size()==0) return;
+  Batch b;
+  b.jobs = &jobs;
+  b.next = 0;
+  b.done = 0;
+  b.err_n = jobs.size();
+
+  std::unique_lock<std::mutex> lk(m);
+  if (jobs.size()>1 && thr.size()){
+    batches.push_back(&b);
+    cv_in.notify_all();
+  }
+
+  // run jobs in this thread too
+  size_t n;
+  while (take(&b, n)){
+    lk.unlock();
+    run_job(&b, n, env);
+    lk.lock();
+  }
+  cv_done.wait(lk, [&b]{return b.done == b.jobs->size();});
+  if (b.err_n < jobs.size()) throw Err() << b.err;
+}
@@ -0,0 +1,71 @@
+/* GrapheneWorkers class: run independent jobs in parallel
+ */
+
+#ifndef GR_WORKERS_H
+#define GR_WORKERS_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "gr_env.h"
+
+/***********************************************************/
+// A pool of threads, each with its own GrapheneEnv (database pool
+// and TCL interpreter) sharing the DB environment with the parent
+// one. The parent environment should be opened with thread=true
+// and should live longer than the pool.
+//
+// Jobs of a batch are run by the pool threads and by the calling
+// thread (with its own GrapheneEnv). Batches from many threads can
+// be run at the same time.
+class GrapheneWorkers {
+  public:
+  typedef std::function<void(GrapheneEnv *)> job_t;
+
+  private:
+  // a batch of jobs
+  struct Batch {
+    std::vector<job_t> * jobs;
+    size_t next;  // next job to run
+    size_t done;  // number of finished jobs
+    size_t err_n;    // number of the first failed job
+    std::string err; // its error
+  };
+
+  std::mutex m;
+  std::condition_variable cv_in;   // new batches or stop
+  std::condition_variable cv_done; // jobs are finished
+  std::deque<Batch*> batches;      // batches with jobs to run
+  bool stop;
+  std::vector<std::thread> thr;
+
+  // thread function
+  void run_thread(const GrapheneEnv * parent, const std::string tcllib);
+
+  // Take the next job of a batch, return false if there is nothing
+  // to run (should be called with locked mutex).
+  bool take(Batch * b, size_t & n);
+
+  // run the job, count it as finished
+  void run_job(Batch * b, const size_t n, GrapheneEnv * env);
+
+  public:
+
+  // Start nthreads threads (0 - jobs are run by the calling thread).
+  GrapheneWorkers(const GrapheneEnv & parent, const std::string & tcllib,
+                  const int nthreads);
+
+  // Stop threads.
+  ~GrapheneWorkers();
+
+  // Run all jobs and wait until they are finished. If some of them
+  // failed throw the first error (in the order of jobs).
+  void run(std::vector<job_t> & jobs, GrapheneEnv * env);
+};
+
+#endif
@@ -6,6 +6,11 @@
 #define GRAPHENE_DEF_DPOLICY "replace"
 #define GRAPHENE_DEF_DBPATH  "."
 #define GRAPHENE_DEF_TCLLIB  "/usr/share/graphene/tcllib/"
+#define GRAPHENE_DEF_F0SYNC  10
+#define GRAPHENE_DEF_CHUNK   64
+#define GRAPHENE_DEF_THREADS 4
+#define GRAPHENE_DEF_MAXDBS  DEF_POOL_SIZE
+#define GRAPHENE_BIN_MAXLEN  (1<<28)
 
 #include <cstdlib>
 #include <stdint.h>
@@ -17,19 +22,30 @@
 #include <setjmp.h>
 
 #include <map>
+#include <deque>
 #include <string>
 #include <vector>
+#include <memory>
+#include <limits>
+#include <sstream>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "gr_env.h"
 
 #include "err/err.h"
 #include "read_words/read_words.h"
 
-#include <ext/stdio_filebuf.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
 
 using namespace std;
 
@@ -50,6 +66,148 @@ out_cb_spp(const std::string &t,  const std::vector<std::string> &d, void * cb_d
   *out << graphene_spp_text(s);
 }
 
+/**********************************************************/
+// Binary protocol (see Readme). Request: 4-byte length, then words,
+// each of them is 4-byte length and bytes. Response: status byte
+// (0 - OK, 1 - error), 4-byte length, data.
+
+static std::string
+spp_bin_frame(const char st, const std::string & d){
+  uint32_t n = d.size();
+  std::string ret(1, st);
+  ret.append((const char *)&n, sizeof(n));
+  return ret + d;
+}
+
+// split request data into words
+static std::vector<std::string>
+spp_bin_words(const std::string & d){
+  std::vector<std::string> ret;
+  size_t p = 0;
+  while (p < d.size()){
+    uint32_t n;
+    if (d.size()-p < sizeof(n)) throw Err() << "broken binary request";
+    memcpy(&n, d.data()+p, sizeof(n));
+    p += sizeof(n);
+    if (d.size()-p < n) throw Err() << "broken binary request";
+    ret.push_back(d.substr(p, n));
+    p += n;
+  }
+  return ret;
+}
+
+// Read request data from a stream, return false at the end of input.
+static bool
+spp_bin_read(std::istream & in, std::string & d){
+  uint32_t n;
+  if (!in.read((char *)&n, sizeof(n))) return false;
+  if (n > GRAPHENE_BIN_MAXLEN) throw Err() << "binary request is too long";
+  d.resize(n);
+  return (bool)in.read(&d[0], n);
+}
+
+// Formatter for the binary protocol: points in the packed form,
+// 8-byte timestamp (GrapheneTime::val()), 4-byte value size, value.
+class GrapheneBinFormatter: public GrapheneFormatter {
+  std::ostream & out;
+  public:
+  GrapheneBinFormatter(std::ostream & out_): out(out_) {}
+  void proc_point(const GrapheneTime &k, const GrapheneView &v,
+                  const TimeType ttype, const DataType dtype) override {
+    uint64_t t = k.val();
+    uint32_t n = v.size();
+    out.write((const char *)&t, sizeof(t));
+    out.write((const char *)&n, sizeof(n));
+    out.write(v.data(), n);
+  }
+};
+
+/**********************************************************/
+// Socket server data (see Pars::run_socket)
+
+// A command for a worker thread and its answer.
+struct SppJob {
+  int fd;                      // connection
+  uint64_t conn;               // connection number (caller id for the put queue)
+  std::vector<std::string> cmd;
+  std::string err;             // parsing error (command is not executed)
+  std::string res;             // answer, including #OK/#Error line
+  bool binary;                 // binary protocol
+  SppJob(): fd(-1), conn(0), binary(false) {}
+};
+
+// A client connection.
+struct SppConn {
+  uint64_t num;                // connection number
+  std::string in, out;         // input and output buffers
+  std::deque<SppJob> cmds;     // commands waiting for execution
+  bool busy;   // a command is executed by a worker
+  bool eof;    // input is closed
+  bool broken; // output is closed, answers are dropped
+  bool binary; // binary protocol
+  uint32_t ev; // events registered in epoll (0 - not registered)
+  SppConn(): num(0), busy(false), eof(false), broken(false), binary(false), ev(0) {}
+};
+
+// Job queue shared between the main loop and worker threads.
+struct SppQueue {
+  std::mutex m;
+  std::condition_variable cv;
+  std::deque<SppJob> jobs, done;
+  bool stop;
+  int efd;     // eventfd for waking up the main loop
+  SppQueue(): stop(false), efd(-1) {}
+};
+
+// Extract complete commands from the connection input buffer.
+// If fin is true there will be no more input.
+static void
+spp_parse(SppConn & c, int fd, const bool fin){
+  std::istringstream ss(c.in);
+  size_t pos = 0; // end of the last complete command
+  while (!c.binary){
+    SppJob j;
+    j.fd = fd;
+    j.conn = c.num;
+    try { j.cmd = read_words(ss); }
+    catch(Err & e){
+      if (!ss.eof()) ss.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+      j.err = e.str();
+    }
+    if (ss.eof() && !fin) break; // incomplete command
+    if (j.cmd.size()==0 && j.err=="") {pos = c.in.size(); break;}
+    c.cmds.push_back(j);
+    if (ss.eof()) {pos = c.in.size(); break;}
+    pos = ss.tellg();
+    // the rest of input is in the binary protocol
+    if (j.cmd.size()==1 && strcasecmp(j.cmd[0].c_str(), "binary")==0) c.binary = true;
+  }
+
+  // binary requests
+  while (c.binary && c.in.size()-pos >= sizeof(uint32_t)){
+    uint32_t n;
+    memcpy(&n, c.in.data()+pos, sizeof(n));
+    SppJob j;
+    j.fd = fd;
+    j.conn = c.num;
+    j.binary = true;
+    if (n > GRAPHENE_BIN_MAXLEN){
+      // can not find the next request, stop reading
+      j.err = "binary request is too long";
+      c.cmds.push_back(j);
+      c.eof = true;
+      pos = c.in.size();
+      break;
+    }
+    if (c.in.size()-pos-sizeof(n) < n) break;
+    try { j.cmd = spp_bin_words(c.in.substr(pos+sizeof(n), n)); }
+    catch(Err & e){ j.err = e.str(); }
+    c.cmds.push_back(j);
+    pos += sizeof(n) + n;
+  }
+  c.in.erase(0, pos);
+}
+
 /**********************************************************/
 /* global parameters */
 class Pars{
@@ -63,6 +221,13 @@ class Pars{
   vector<string> pars; /* non-option parameters */
   TimeFMT timefmt;     /* output time format */
   bool readonly;       /* open databases in read-only mode */
+  size_t bulk;         /* buffer size for bulk reads */
+  int f0sync;          /* interval for writing input filter storage */
+  size_t maxdbs;       /* max number of opened databases */
+  int dbversion;       /* version for new databases */
+  int threads;         /* number of worker threads in the socket mode */
+  GrapheneEnvCfg cfg;  /* libdb tuning parameters */
+  GrapheneQueueCfg qcfg; /* put queue parameters */
 
   // get options and parameters from argc/argv
   Pars(const int argc, char **argv){
@@ -73,10 +238,15 @@ class Pars{
     interactive = false;
     timefmt = TFMT_DEF;
     readonly  = false;
+    bulk = 0;
+    f0sync = GRAPHENE_DEF_F0SYNC;
+    maxdbs = GRAPHENE_DEF_MAXDBS;
+    dbversion = DEF_DBVERSION;
+    threads = GRAPHENE_DEF_THREADS;
     if (argc<1) return; // needed for print_help()
     /* parse  options */
     int c;
-    while((c = getopt(argc, argv, "+d:T:D:E:his:rR"))!=-1){
+    while((c = getopt(argc, argv, "+d:T:D:E:B:F:O:V:C:M:L:P:t:Q:N:S:Ahis:rR"))!=-1){
       switch (c){
         case '?':
         case ':': throw Err(); /* error msg is printed by getopt*/
@@ -84,6 +254,19 @@ class Pars{
         case 'T': tcllib = optarg; break;
         case 'D': dpolicy = optarg; break;
         case 'E': env_type = optarg; break;
+        case 'B': bulk = str_to_type<size_t>(optarg); break;
+        case 'F': f0sync = str_to_type<int>(optarg); break;
+        case 'O': maxdbs = str_to_type<size_t>(optarg); break;
+        case 'V': dbversion = str_to_type<int>(optarg); break;
+        case 'C': cfg.cache_size = str_to_type<size_t>(optarg); break;
+        case 'M': cfg.mmap_size  = str_to_type<size_t>(optarg); break;
+        case 'L': cfg.lk_max     = str_to_type<uint32_t>(optarg); break;
+        case 'P': cfg.page_size  = str_to_type<uint32_t>(optarg); break;
+        case 't': threads = str_to_type<int>(optarg); break;
+        case 'Q': qcfg.window = str_to_type<uint32_t>(optarg); break;
+        case 'N': qcfg.maxn = str_to_type<size_t>(optarg); break;
+        case 'S': qcfg.durability = graphene_durability_parse(optarg); break;
+        case 'A': qcfg.ack = true; break;
         case 'h': print_help();
         case 'i': interactive = true; break;
         case 's': sockname = optarg; break;
@@ -124,6 +307,12 @@ class Pars{
             "  delete <name> -- delete a database\n"
             "  rename <old_name> <new_name> -- rename a database\n"
             "  set_descr <name> <description> -- set/change database description\n"
+            "  set_rollup <name> [<L1> <L2> ...] -- set rollup tiers (lengths in seconds,\n"
+            "         each one a multiple of the previous one), no tiers to switch rollups off\n"
+            "  get_rollup <name> -- print rollup tiers\n"
+            "  set_regular <name> [<start> <period> [<n>]] -- set regular-interval mode\n"
+            "         (chunks of n points, default 64), no parameters to switch it off\n"
+            "  get_regular <name> -- print start time, period and chunk size\n"
             "  set_filter <name> <N> <tcl code> -- set/change filter N\n"
             "  print_filter <name> <N> -- print code of the filter N\n"
             "  print_f0data <name> -- print data of the input filter\n"
@@ -131,12 +320,20 @@ class Pars{
             "  info <name> -- print database information, tab-separated time format,\n"
             "         data format and description (if it is not empty)\n"
             "  list -- list all databases in the data folder\n"
+            "  search <pattern> -- list databases with names starting with the pattern,\n"
+            "         or matching a regular expression if the pattern is /<re>/\n"
+            "  list_info [<pattern>] -- list databases (all or found by the pattern) with\n"
+            "         data type, numbers of filters ('-' if none) and description, tab-separated\n"
             "  put <name> <time> <value1> ... <valueN> -- write a data point\n"
+            "  put_many <name> <N> <time1> <value1> ... <valueN> <time2> ... -- write many data points\n"
+            "         with N values each in a single transaction\n"
             "  put_flt <name> <time> <value1> ... <valueN> -- write a data point using input filter (number 0)\n"
             "  get <name>[:N] <time> -- get previous or interpolated point\n"
             "  get_next <name>[:N] [<time1>] -- get next point after time1\n"
             "  get_prev <name>[:N] [<time2>] -- get previous point before time2\n"
-            "  get_range <name>[:N] [<time1>] [<time2>] [<dt>] -- get points in the time range\n"
+            "  get_many <name>[:N] <time1> ... <timeN> -- same as get for many timestamps\n"
+            "  get_prev_many <name>[:N] <time1> ... <timeN> -- same as get_prev for many timestamps\n"
+            "  get_range <name>[:N] [<time1>] [<time2>] [<dt>] [<agg>] -- get points in the time range\n"
             "  get_wrange <name>[:N] [<time1>] [<time2>] [<dt>] -- do get_prev, get_range, get_next\n"
             "  get_count <name>[:N] [<time1>] [<cnt>] -- get up to cnt points starting from t1\n"
             "  del <name> <time> -- delete one data point\n"
@@ -149,7 +346,12 @@ class Pars{
             "  dump <name> <file> -- dump the database into a file (same as db_dump utility)\n"
             "  list_dbs -- print environment database files for archiving (same as db_archive -s)"
             "  list_logs -- print environment log files (same as db_archive -l)"
-            "  lock_stat -- print environment lock statistics"
+            "  lock_stat -- print environment lock statistics\n"
+            "  mpool_stat -- print environment cache statistics\n"
+            "  queue_flush -- wait until points queued in this connection are written, report errors\n"
+            "  queue_stat -- print put queue statistics\n"
+            "  pool_stat -- print statistics of the pool of opened databases\n"
+            "  binary -- switch to the binary protocol (interactive and socket modes)\n"
             "  cmdlist -- print this list of commands\n"
             "  help -- same as cmdlist\n"
             "  *idn?   -- print intentifier: Graphene database " << VERSION << "\n"
@@ -177,9 +379,31 @@ class Pars{
             "               replace, skip, error, sshift, nsshift (default: " << p.dpolicy << ")\n"
             "  -E <word> -- environment type:\n"
             "               none, lock, txn (default: " << p.env_type << ")\n"
+            "  -B <size> -- buffer size for bulk reads in get_range, get_count, del_range\n"
+            "               and dump commands, 1024..2^30 bytes, 0 to switch bulk reads off\n"
+            "               (default: " << p.bulk << ")\n"
+            "  -F <sec>  -- interval for writing input filter storage to databases,\n"
+            "               0 to write it after each put_flt command (default: " << p.f0sync << ")\n"
+            "  -O <num>  -- max number of opened databases, least recently used ones are closed,\n"
+            "               0 for no limit (default: " << p.maxdbs << ")\n"
+            "  -V <ver>  -- version of new databases: 2, or 3 for compressed blocks of points\n"
+            "               (default: " << p.dbversion << ")\n"
+            "  -C <size> -- cache size for a new environment, bytes (default: libdb default)\n"
+            "  -M <size> -- max size of a read-only database mapped into memory, bytes\n"
+            "               (default: libdb default)\n"
+            "  -L <num>  -- max number of locks, lockers and lock objects for a new\n"
+            "               environment (default: libdb default)\n"
+            "  -P <size> -- page size for new databases, bytes, power of 2 in 512..65536\n"
+            "               (default: libdb default)\n"
+            "  -Q <ms>   -- use put queue: collect points during the time window and write them\n"
+            "               in a single transaction, 0 to write each point immediately (default: 0)\n"
+            "  -N <num>  -- write queued points when this number is collected (default: " << p.qcfg.maxn << ")\n"
+            "  -S <word> -- durability of queue writes: sync, write_nosync, nosync (default: sync)\n"
+            "  -A        -- put commands wait until queued points are written and report errors\n"
             "  -h        -- write this help message and exit\n"
             "  -i        -- interactive mode, read commands from stdin\n"
             "  -s <name> -- socket mode: use unix socket <name> for communications\n"
+            "  -t <num>  -- number of worker threads in the socket mode (default: " << p.threads << ")\n"
             "  -r        -- output relative times (seconds from requested time) instead of absolute timestamps\n"
             "  -R        -- read-only mode\n"
             "Commands:\n"
@@ -200,12 +424,36 @@ class Pars{
     // Outer try -- exit on errors with #Error message
     // For SPP2 it should be #Fatal
     try {
-      GrapheneEnv env(dbpath, readonly, env_type, tcllib);
+      GrapheneEnv env(dbpath, readonly, env_type, tcllib, qcfg.window>0, cfg);
+      env.set_bulk(bulk);
+      env.set_f0sync(f0sync);
+      env.set_pool_size(maxdbs);
+      env.set_queue(qcfg);
       if (setjmp(sig_jmp_buf)) throw 0;
       out << "#OK\n";
       out.flush();
 
+      bool binary = false;
       while (1){
+
+        // binary protocol
+        if (binary){
+          std::string d;
+          if (!spp_bin_read(in, d)) break;
+          std::ostringstream ss;
+          try {
+            pars = spp_bin_words(d);
+            run_command_bin(&env, ss);
+            out << spp_bin_frame(0, ss.str());
+          }
+          catch(Err & e){
+            out << spp_bin_frame(1, e.str());
+            env.close();
+          }
+          out.flush();
+          continue;
+        }
+
         // inner try -- continue to a new command with #Error message
         try {
           pars = read_words(in);
@@ -213,6 +461,7 @@ class Pars{
           run_command(&env, out);
           out << "#OK\n";
           out.flush();
+          if (strcasecmp(pars[0].c_str(), "binary")==0) binary = true;
         }
         catch(Err & e){
           if (e.str()!="") out << "#Error: " << e.str() << "\n";
@@ -229,53 +478,358 @@ class Pars{
     return;
   }
 
-  // Socket mode
+  // Worker thread for the socket mode: execute commands from the queue.
+  // Each worker has its own database pool and TCL interpreter.
+  void run_worker(const GrapheneEnv & penv, SppQueue & q){
+    Pars p(*this);
+    p.interactive = true; // SPP output
+    std::unique_ptr<GrapheneEnv> env;
+    std::string env_err;
+    try { env.reset(new GrapheneEnv(penv, tcllib)); }
+    catch(Err & e){ env_err = e.str(); }
+
+    while (1){
+      SppJob j;
+      {
+        std::unique_lock<std::mutex> lk(q.m);
+        q.cv.wait(lk, [&q]{return q.stop || q.jobs.size();});
+        if (q.stop) return;
+        j = q.jobs.front();
+        q.jobs.pop_front();
+      }
+      std::ostringstream out;
+      try {
+        if (!env) throw Err() << env_err;
+        if (j.err!="") throw Err() << j.err;
+        p.pars = j.cmd;
+        env->set_caller(j.conn);
+        if (j.binary) p.run_command_bin(env.get(), out);
+        else p.run_command(env.get(), out);
+        j.res = j.binary? spp_bin_frame(0, out.str()) : out.str() + "#OK\n";
+      }
+      catch(Err & e){
+        j.res = j.binary? spp_bin_frame(1, e.str()) :
+                          out.str() + "#Error: " + e.str() + "\n";
+        // close all databases. In case of an error which needs recovery/reopening.
+        if (env) try { env->close(); } catch(Err & e){}
+      }
+      {
+        std::lock_guard<std::mutex> lk(q.m);
+        q.done.push_back(j);
+      }
+      uint64_t one = 1;
+      if (write(q.efd, &one, sizeof(one))<0) {}
+    }
+  }
+
+  // Socket mode.
+  // The environment is opened once and shared by all connections.
+  // The main loop accepts connections, reads commands and sends answers,
+  // commands are executed by a pool of worker threads. Commands of
+  // one connection are executed in order, one at a time, different
+  // connections are served in parallel.
   void run_socket(const string & name){
     if (pars.size() !=0) throw Err() << "too many argumens for the socket mode";
-    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (threads<1) throw Err() << "positive number of threads expected";
+
+    // Signals are received by the main loop through signalfd. Block
+    // them before starting threads, they will be inherited.
+    sigset_t sigs, oldsigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGQUIT);
+    sigaddset(&sigs, SIGHUP);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+
+    // Without an environment a database can not be used by
+    // different threads.
+    int nthreads = env_type=="none" ? 1 : threads;
+    GrapheneEnv env(dbpath, readonly, env_type, tcllib, true, cfg);
+    env.set_bulk(bulk);
+    env.set_f0sync(f0sync);
+    env.set_pool_size(maxdbs);
+    env.set_queue(qcfg);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (sock < 0) throw Err() << "Can't create a socket";
 
     struct sockaddr_un server;
     server.sun_family = AF_UNIX;
     strcpy(server.sun_path, name.c_str());
-    if (bind(sock, (struct sockaddr *) &server, sizeof(struct sockaddr_un)))
+    if (bind(sock, (struct sockaddr *) &server, sizeof(struct sockaddr_un))){
+      close(sock);
       throw Err() << "can't bind socket to a file: " << name;
+    }
+    listen(sock, SOMAXCONN);
+
+    SppQueue q;
+    std::map<int, SppConn> conns;
+    uint64_t nconn = 0; // number of accepted connections
+    std::vector<std::thread> workers;
+    int ep = epoll_create1(0);
+    int sfd = signalfd(-1, &sigs, 0);
+    q.efd = eventfd(0, 0);
+
+    // register connection in epoll with events needed in its state
+    auto set_events = [&](int fd, SppConn & c){
+      uint32_t ev = (c.eof? 0:EPOLLIN) | (c.out.size()? EPOLLOUT:0);
+      if (ev == c.ev) return;
+      struct epoll_event e;
+      e.events = ev;
+      e.data.fd = fd;
+      epoll_ctl(ep, c.ev==0? EPOLL_CTL_ADD : ev==0? EPOLL_CTL_DEL : EPOLL_CTL_MOD, fd, &e);
+      c.ev = ev;
+    };
+
+    // send output, start the next command, close finished connection
+    auto update = [&](int fd){
+      SppConn & c = conns[fd];
+      if (c.broken) c.out.clear();
+      while (c.out.size()){
+        ssize_t n = send(fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (n<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) break;
+        if (n<=0) {c.broken = c.eof = true; c.out.clear(); break;}
+        c.out.erase(0, n);
+      }
+      if (!c.busy && c.cmds.size() && !c.broken){
+        c.busy = true;
+        {
+          std::lock_guard<std::mutex> lk(q.m);
+          q.jobs.push_back(c.cmds.front());
+        }
+        c.cmds.pop_front();
+        q.cv.notify_one();
+      }
+      if (c.broken) c.cmds.clear();
+      if (c.eof && !c.busy && c.cmds.empty() && c.out.empty()){
+        set_events(fd, c); // remove from epoll
+        close(fd);
+        conns.erase(fd);
+        return;
+      }
+      set_events(fd, c);
+    };
+
+    // stop workers, close connections and the socket
+    auto cleanup = [&](){
+      {
+        std::lock_guard<std::mutex> lk(q.m);
+        q.stop = true;
+      }
+      q.cv.notify_all();
+      for (auto & t: workers) t.join();
+      for (auto const & c: conns) close(c.first);
+      close(q.efd);
+      close(sfd);
+      close(ep);
+      close(sock);
+      unlink(name.c_str());
+      pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+    };
 
-    listen(sock, 10);
-    while (1) {
-
-      // wait connection on the socket or a enter on stdin
-      fd_set rfds;
-      FD_ZERO(&rfds);
-      FD_SET(sock, &rfds);
-      FD_SET(0, &rfds);
-      int ret = select(sock+1, &rfds, NULL, NULL, NULL);
-      if (ret && FD_ISSET(0, &rfds)) break;
-      if (ret == -1) throw Err() << "select error";
-
-      // accept a connection
-      int msgsock = accept(sock, 0, 0);
-      if (msgsock == -1) throw Err() << "Socket accept error";
-
-      // create in/out streams and run interactive mode
-      __gnu_cxx::stdio_filebuf<char> filebuf_in(msgsock, std::ios::in);
-      __gnu_cxx::stdio_filebuf<char> filebuf_out(msgsock, std::ios::out);
-      ostream out(&filebuf_out);
-      istream in(&filebuf_in);
-      pars.clear();
-      run_interactive(in, out);
-    }
-    close(sock);
-    unlink(name.c_str());
+    try {
+      if (ep<0 || sfd<0 || q.efd<0) throw Err() << "can't start socket server";
+      for (int fd: {sock, sfd, q.efd, 0}){
+        struct epoll_event e;
+        e.events = EPOLLIN;
+        e.data.fd = fd;
+        // stdin may be not pollable (e.g. a file), then it is not used
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &e) && fd!=0)
+          throw Err() << "can't start socket server";
+      }
+      for (int i=0; i<nthreads; i++)
+        workers.push_back(std::thread(&Pars::run_worker, this, std::cref(env), std::ref(q)));
+
+      bool stop = false;
+      while (!stop){
+        struct epoll_event evs[64];
+        int n = epoll_wait(ep, evs, 64, -1);
+        if (n<0 && errno==EINTR) continue;
+        if (n<0) throw Err() << "epoll error";
+
+        for (int i=0; i<n; i++){
+          int fd = evs[i].data.fd;
+
+          // enter on stdin or a signal: exit
+          if (fd==0) {stop = true; break;}
+          if (fd==sfd){
+            struct signalfd_siginfo si;
+            if (read(sfd, &si, sizeof(si))<0) {}
+            stop = true;
+            break;
+          }
+
+          // new connections
+          if (fd==sock){
+            int cfd;
+            while ((cfd = accept4(sock, 0, 0, SOCK_NONBLOCK))>=0){
+              SppConn & c = conns[cfd];
+              c.num = ++nconn;
+              c.out = "#SPP001\n" // command-line protocol, version 001.
+                      "Graphene database. Type cmdlist to see list of commands\n"
+                      "#OK\n";
+              update(cfd);
+            }
+            continue;
+          }
+
+          // answers from workers
+          if (fd==q.efd){
+            uint64_t cnt;
+            if (read(q.efd, &cnt, sizeof(cnt))<0) {}
+            std::deque<SppJob> done;
+            {
+              std::lock_guard<std::mutex> lk(q.m);
+              done.swap(q.done);
+            }
+            for (auto & j: done){
+              SppConn & c = conns[j.fd];
+              c.busy = false;
+              c.out += j.res;
+              update(j.fd);
+            }
+            continue;
+          }
+
+          // client input
+          if (conns.count(fd)==0) continue;
+          SppConn & c = conns[fd];
+          if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR) && !c.eof){
+            char buf[65536];
+            ssize_t r;
+            while ((r = read(fd, buf, sizeof(buf)))>0) c.in.append(buf, r);
+            if (r==0 || (errno!=EAGAIN && errno!=EWOULDBLOCK)) c.eof = true;
+            spp_parse(c, fd, c.eof);
+          }
+          update(fd);
+        }
+      }
+    }
+    catch(...){
+      cleanup();
+      throw;
+    }
+    cleanup();
   }
 
 
   // Cmdline mode.
   void run_cmdline(){
     if (pars.size() < 1) throw Err() << "command is expected";
-    GrapheneEnv env(dbpath, readonly, env_type, tcllib);
+    GrapheneEnv env(dbpath, readonly, env_type, tcllib, qcfg.window>0, cfg);
+    env.set_bulk(bulk);
+    env.set_f0sync(f0sync);
+    env.set_pool_size(maxdbs);
+    env.set_queue(qcfg);
     if (setjmp(sig_jmp_buf)) throw 0;
     run_command(&env, cout);
+    env.queue_flush();
+  }
+
+  // Run command in the binary protocol. Points are written in the packed
+  // form (see GrapheneBinFormatter), put commands get 8-byte timestamps
+  // (GrapheneTime::val()) and packed values, other parameters are same
+  // as in the text protocol. Commands which do not transfer points
+  // are processed by run_command.
+  void run_command_bin(GrapheneEnv* env, ostream & out){
+    if (pars.size() < 1) throw Err() << "command is expected";
+    string cmd = pars[0];
+    GrapheneBinFormatter fmt(out);
+
+    // database name without column or filter
+    auto getdb = [&](){
+      if (pars.size()<2) throw Err() << "database name expected";
+      if (pars[1].find(':')!=string::npos)
+        throw Err() << "columns and filters are not supported in binary protocol";
+      return env->getdb(pars[1], DB_RDONLY);
+    };
+
+    // write data points
+    // args: put <name> <time> <value> [<time> <value> ...]
+    //       put_many <name> <time> <value> [<time> <value> ...]
+    if (strcasecmp(cmd.c_str(), "put")==0 ||
+        strcasecmp(cmd.c_str(), "put_many")==0){
+      if (pars.size()<4 || pars.size()%2 != 0)
+        throw Err() << "database name and pairs of timestamp and value expected";
+      vector<GrapheneTime> ts;
+      vector<string> vs;
+      for (size_t i=2; i<pars.size(); i+=2){
+        uint64_t t;
+        if (pars[i].size() != sizeof(t)) throw Err() << "8-byte timestamp expected";
+        memcpy(&t, pars[i].data(), sizeof(t));
+        ts.push_back(GrapheneTime(t));
+        vs.push_back(pars[i+1]);
+      }
+      env->put_packed(pars[1], ts, vs, dpolicy);
+      return;
+    }
+
+    // args: get_next <name> [<time1>]
+    if (strcasecmp(cmd.c_str(), "get_next")==0){
+      if (pars.size()>3) throw Err() << "too many parameters";
+      getdb()->get_next(pars.size()>2? pars[2]: "0", fmt);
+      return;
+    }
+
+    // args: get_prev <name> [<time2>]
+    if (strcasecmp(cmd.c_str(), "get_prev")==0){
+      if (pars.size()>3) throw Err() << "too many parameters";
+      getdb()->get_prev(pars.size()>2? pars[2]: "inf", fmt);
+      return;
+    }
+
+    // args: get <name> [<time>]
+    if (strcasecmp(cmd.c_str(), "get")==0){
+      if (pars.size()>3) throw Err() << "too many parameters";
+      getdb()->get(pars.size()>2? pars[2]: "inf", fmt);
+      return;
+    }
+
+    // args: get_many <name> <time1> ... <timeN>
+    if (strcasecmp(cmd.c_str(), "get_many")==0){
+      auto db = getdb();
+      db->get_many(vector<string>(pars.begin()+2, pars.end()), fmt);
+      return;
+    }
+
+    // args: get_prev_many <name> <time1> ... <timeN>
+    if (strcasecmp(cmd.c_str(), "get_prev_many")==0){
+      auto db = getdb();
+      db->get_prev_many(vector<string>(pars.begin()+2, pars.end()), fmt);
+      return;
+    }
+
+    // args: get_range <name> [<time1>] [<time2>] [<dt>]
+    if (strcasecmp(cmd.c_str(), "get_range")==0){
+      if (pars.size()>5) throw Err() << "too many parameters (aggregation is not supported in binary protocol)";
+      getdb()->get_range(pars.size()>2? pars[2]: "0", pars.size()>3? pars[3]: "inf",
+                         pars.size()>4? pars[4]: "0", fmt);
+      return;
+    }
+
+    // args: get_wrange <name> [<time1>] [<time2>] [<dt>]
+    if (strcasecmp(cmd.c_str(), "get_wrange")==0){
+      if (pars.size()>5) throw Err() << "too many parameters";
+      auto db = getdb();
+      string t1 = pars.size()>2? pars[2]: "0";
+      string t2 = pars.size()>3? pars[3]: "inf";
+      db->get_prev(t1, fmt);
+      db->get_range(t1, t2, pars.size()>4? pars[4]: "0", fmt);
+      db->get_next(t2, fmt);
+      return;
+    }
+
+    // args: get_count <name> [<time1>] [<cnt>]
+    if (strcasecmp(cmd.c_str(), "get_count")==0){
+      if (pars.size()>4) throw Err() << "too many parameters";
+      getdb()->get_count(pars.size()>2? pars[2]: "0", pars.size()>3? pars[3]: "1000", fmt);
+      return;
+    }
+
+    if (strcasecmp(cmd.c_str(), "binary")==0) throw Err() << "binary protocol is already on";
+    run_command(env, out);
   }
 
   // Run command, using parameters
@@ -285,19 +839,27 @@ class Pars{
   void run_command(GrapheneEnv* env, ostream & out){
     string cmd = pars[0];
 
+    // switch to the binary protocol (see run_interactive and run_socket)
+    // args: binary
+    if (strcasecmp(cmd.c_str(), "binary")==0){
+      if (pars.size()>1) throw Err() << "too many parameters";
+      if (!interactive) throw Err() << "binary protocol can be used only in interactive or socket mode";
+      return;
+    }
+
     // print current time (unix seconds with ms precision)
     if (strcasecmp(cmd.c_str(), "get_time")==0){
       if (pars.size()>1) throw Err() << "too many parameters";
       struct timeval tv;
       gettimeofday(&tv, NULL);
-      cout << tv.tv_sec << "." << setfill('0') << setw(6) << tv.tv_usec << "\n";
+      out << tv.tv_sec << "." << setfill('0') << setw(6) << tv.tv_usec << "\n";
       return;
     }
 
     // print libdb version (<major>.<minor>.<patch>)
     if (strcasecmp(cmd.c_str(), "libdb_version")==0){
       if (pars.size()>1) throw Err() << "too many parameters";
-      cout << db_version(NULL,NULL,NULL) << "\n";
+      out << db_version(NULL,NULL,NULL) << "\n";
       return;
     }
 
@@ -308,7 +870,7 @@ class Pars{
       DataType dtype = pars.size()<3 ? DATA_DOUBLE : graphene_dtype_parse(pars[2]);
       std::string descr = pars.size()<4 ? "": pars[3];
       for (int i=4; i<pars.size(); i++) descr+=" "+pars[i];
-      env->dbcreate(pars[1], descr, dtype);
+      env->dbcreate(pars[1], descr, dtype, dbversion);
       return;
     }
 
@@ -340,6 +902,54 @@ class Pars{
       return;
     }
 
+    // set rollup tiers
+    // args: set_rollup <name> [<L1> <L2> ...]
+    if (strcasecmp(cmd.c_str(), "set_rollup")==0){
+      if (pars.size()<2) throw Err() << "database name expected";
+      std::vector<uint32_t> tiers;
+      for (int i=2; i<pars.size(); i++)
+        tiers.push_back(str_to_type<uint32_t>(pars[i]));
+      env->set_rollup(pars[1], tiers);
+      return;
+    }
+
+    // print rollup tiers
+    // args: get_rollup <name>
+    if (strcasecmp(cmd.c_str(), "get_rollup")==0){
+      if (pars.size()<2) throw Err() << "database name expected";
+      if (pars.size()>2) throw Err() << "too many parameters";
+      auto tiers = env->get_rollup(pars[1]);
+      for (size_t i=0; i<tiers.size(); i++)
+        out << (i>0? " ":"") << tiers[i];
+      out << "\n";
+      return;
+    }
+
+    // set regular-interval mode
+    // args: set_regular <name> [<start> <period> [<n>]]
+    if (strcasecmp(cmd.c_str(), "set_regular")==0){
+      if (pars.size()<2) throw Err() << "database name expected";
+      if (pars.size()==3) throw Err() << "period expected";
+      if (pars.size()>5) throw Err() << "too many parameters";
+      uint32_t n = pars.size()<3? 0 : pars.size()<5? GRAPHENE_DEF_CHUNK :
+                   str_to_type<uint32_t>(pars[4]);
+      if (pars.size()==5 && n==0) throw Err() << "non-zero chunk size expected";
+      env->set_regular(pars[1], pars.size()<3? "":pars[2], pars.size()<4? "":pars[3], n);
+      return;
+    }
+
+    // print regular-interval mode parameters
+    // args: get_regular <name>
+    if (strcasecmp(cmd.c_str(), "get_regular")==0){
+      if (pars.size()<2) throw Err() << "database name expected";
+      if (pars.size()>2) throw Err() << "too many parameters";
+      auto r = env->get_regular(pars[1]);
+      if (r.n) out << graphene_time_print(r.start(), r.ttype) << " "
+                   << graphene_time_print(r.period(), r.ttype) << " " << r.n;
+      out << "\n";
+      return;
+    }
+
     // print database info
     // args: info <name>
     if (strcasecmp(cmd.c_str(), "info")==0){
@@ -347,7 +957,7 @@ class Pars{
       if (pars.size()>2) throw Err() << "too many parameters";
       auto dtype = env->get_dtype(pars[1]);
       auto descr = env->get_descr(pars[1]);
-      cout << graphene_dtype_name(dtype);
+      out << graphene_dtype_name(dtype);
       if (descr!="") out << '\t' << descr;
       out << "\n";
       return;
@@ -362,6 +972,31 @@ class Pars{
       return;
     }
 
+    // find databases by name prefix or regular expression /<re>/
+    // args: search <pattern>
+    if (strcasecmp(cmd.c_str(), "search")==0){
+      if (pars.size()<2) throw Err() << "pattern expected";
+      if (pars.size()>2) throw Err() << "too many parameters";
+      for (auto const &n: env->dbsearch(pars[1])) out << n << "\n";
+      return;
+    }
+
+    // print database list with information
+    // args: list_info [<pattern>]
+    if (strcasecmp(cmd.c_str(), "list_info")==0){
+      if (pars.size()>2) throw Err() << "too many parameters";
+      for (auto const &n: env->dbsearch(pars.size()>1? pars[1]:"")){
+        auto info = env->dbinfo(n);
+        out << n << '\t' << graphene_dtype_name(info.dtype) << '\t';
+        for (size_t i=0; i<info.filters.size(); i++)
+          out << (i? ",":"") << info.filters[i];
+        if (info.filters.size()==0) out << '-';
+        if (info.descr!="") out << '\t' << info.descr;
+        out << "\n";
+      }
+      return;
+    }
+
     // backup start: notify that we are going to start backup.
     // - reset temporary backup timer
     // - return value of the main backup timer
@@ -418,6 +1053,24 @@ class Pars{
       return;
     }
 
+    // write many data points in a single transaction
+    // args: put_many <name> <N> <time1> <value1> ... <valueN> <time2> ...
+    if (strcasecmp(cmd.c_str(), "put_many")==0){
+      if (pars.size()<5) throw Err() << "database name, number of values, timestamp and some values expected";
+      int n = str_to_type<int>(pars[2]);
+      if (n<1) throw Err() << "positive number of values expected: " << pars[2];
+      if ((pars.size()-3) % (n+1) != 0)
+        throw Err() << "number of parameters does not match number of values: " << pars[2];
+      vector<string> ts;
+      vector<vector<string> > dats;
+      for (size_t i=3; i<pars.size(); i+=n+1){
+        ts.push_back(pars[i]);
+        dats.push_back(vector<string>(pars.begin()+i+1, pars.begin()+i+1+n));
+      }
+      env->put_batch(pars[1], ts, dats, dpolicy);
+      return;
+    }
+
     // write data using input filter
     // args: put_flt <name> <time> <value1> ...
     if (strcasecmp(cmd.c_str(), "put_flt")==0){
@@ -460,16 +1113,37 @@ class Pars{
       return;
     }
 
+    // get previous or interpolated points for many timestamps
+    // args: get_many <name>[:N] <time1> ... <timeN>
+    if (strcasecmp(cmd.c_str(), "get_many")==0){
+      if (pars.size()<2) throw Err() << "database name expected";
+      vector<string> ts(pars.begin()+2, pars.end());
+      env->get_many(pars[1], ts, timefmt,
+                    interactive? out_cb_spp: out_cb_simple, &out);
+      return;
+    }
+
+    // get previous points for many timestamps
+    // args: get_prev_many <name>[:N] <time1> ... <timeN>
+    if (strcasecmp(cmd.c_str(), "get_prev_many")==0){
+      if (pars.size()<2) throw Err() << "database name expected";
+      vector<string> ts(pars.begin()+2, pars.end());
+      env->get_prev_many(pars[1], ts, timefmt,
+                    interactive? out_cb_spp: out_cb_simple, &out);
+      return;
+    }
+
     // get data range
-    // args: get_range <name>[:N] [<time1>] [<time2>] [<dt>]
+    // args: get_range <name>[:N] [<time1>] [<time2>] [<dt>] [<agg>]
     if (strcasecmp(cmd.c_str(), "get_range")==0){
       if (pars.size()<2) throw Err() << "database name expected";
-      if (pars.size()>5) throw Err() << "too many parameters";
+      if (pars.size()>6) throw Err() << "too many parameters";
       string t1 = pars.size()>2? pars[2]: "0";
       string t2 = pars.size()>3? pars[3]: "inf";
       string dt = pars.size()>4? pars[4]: "0";
+      AggMode agg = graphene_agg_parse(pars.size()>5? pars[5]: "none");
       env->get_range(pars[1], t1,t2,dt, timefmt,
-                     interactive? out_cb_spp: out_cb_simple, &out);
+                     interactive? out_cb_spp: out_cb_simple, &out, agg);
       return;
     }
 
@@ -540,7 +1214,7 @@ class Pars{
     if (strcasecmp(cmd.c_str(), "load")==0){
       if (pars.size()<3) throw Err() << "database name and dump file expected";
       if (pars.size()>3) throw Err() << "too many parameters";
-      GrapheneEnv simple_env(dbpath, false, "none", "");
+      GrapheneEnv simple_env(dbpath, false, "none", "", false, cfg);
       if (setjmp(sig_jmp_buf)) throw 0;
       simple_env.load(pars[1], pars[2]);
       return;
@@ -551,7 +1225,7 @@ class Pars{
     if (strcasecmp(cmd.c_str(), "dump")==0){
       if (pars.size()<3) throw Err() << "database name and dump file expected";
       if (pars.size()>3) throw Err() << "too many parameters";
-      GrapheneEnv simple_env(dbpath, false, "none", "");
+      GrapheneEnv simple_env(dbpath, false, "none", "", false, cfg);
       if (setjmp(sig_jmp_buf)) throw 0;
       simple_env.dump(pars[1], pars[2]);
       return;
@@ -615,7 +1289,39 @@ class Pars{
     // args: lock_stat
     if (strcasecmp(cmd.c_str(), "lock_stat")==0){
       if (pars.size()>1) throw Err() << "too many parameters";
-      env->lock_stat(false);
+      env->lock_stat(out, false);
+      return;
+    }
+
+    // print environment cache statistics
+    // args: mpool_stat
+    if (strcasecmp(cmd.c_str(), "mpool_stat")==0){
+      if (pars.size()>1) throw Err() << "too many parameters";
+      env->mpool_stat(out, false);
+      return;
+    }
+
+    // wait until all queued points are written
+    // args: queue_flush
+    if (strcasecmp(cmd.c_str(), "queue_flush")==0){
+      if (pars.size()>1) throw Err() << "too many parameters";
+      env->queue_flush();
+      return;
+    }
+
+    // print put queue statistics
+    // args: queue_stat
+    if (strcasecmp(cmd.c_str(), "queue_stat")==0){
+      if (pars.size()>1) throw Err() << "too many parameters";
+      env->queue_stat(out);
+      return;
+    }
+
+    // print database pool statistics
+    // args: pool_stat
+    if (strcasecmp(cmd.c_str(), "pool_stat")==0){
+      if (pars.size()>1) throw Err() << "too many parameters";
+      env->pool_stat(out);
       return;
     }
 
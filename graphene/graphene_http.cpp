@@ -21,6 +21,9 @@
 #include <stdint.h>
 #include <cstring>
 #include <cstdio>
+#include <memory>
+#include <algorithm>
+#include <sstream>
 #include <csignal>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -80,19 +83,100 @@ mhs_get_pars(struct MHD_Connection * connection){
 }
 
 /**********************************************************/
+// server parameters
+struct ServerPars {
+  GrapheneEnv *env;   // main environment
+  int threads;        // number of threads in the thread pool (0 - no pool)
+  std::string tcllib; // TCL library path
+  GrapheneWorkers *workers; // threads for parallel queries (NULL - not used)
+};
+
+// Get GrapheneEnv for the current thread. In the thread pool mode each
+// thread has its own GrapheneEnv (database pool and TCL interpreter)
+// which shares the DB environment with the main one.
+static GrapheneEnv *
+get_env(ServerPars * pars){
+  if (pars->threads == 0) return pars->env;
+  static thread_local std::unique_ptr<GrapheneEnv> env;
+  if (!env) env.reset(new GrapheneEnv(*pars->env, pars->tcllib));
+  return env.get();
+}
+
+/* libmicrohttpd callback for cleaning up a finished request. */
+static void
+request_completed(void * cls, struct MHD_Connection * connection,
+                  void ** con_cls, enum MHD_RequestTerminationCode toe) {
+  delete (string *)*con_cls;
+  *con_cls = NULL;
+}
+
+/**********************************************************/
+// Streaming output of get_range. Data are read in parts of
+// STREAM_CHUNK points (or aggregation intervals) when the client
+// is ready to get them, each part in a separate transaction.
+// Memory usage does not depend on the range size.
+#define STREAM_CHUNK 1000
+
+struct RangeReader {
+  ServerPars *pars;
+  std::string name, t1, t2, dt, time0; // t1 is empty when the range is finished
+  TimeFMT tfmt;
+  AggMode agg;
+  std::string buf; // current part of the output
+  size_t bpos;     // position in the buffer
+
+  // read next part of data into the buffer
+  void read(){
+    std::ostringstream out;
+    t1 = get_env(pars)->get_range(name, t1,t2,dt, tfmt,
+           out_cb_simple, &out, agg, STREAM_CHUNK, time0);
+    buf = out.str();
+    bpos = 0;
+  }
+};
+
+/* libmicrohttpd callback for reading streamed data */
+static ssize_t
+range_reader(void * cls, uint64_t pos, char * out, size_t max){
+  auto r = (RangeReader *)cls;
+  try {
+    while (r->bpos >= r->buf.size()){
+      if (r->t1 == "") return MHD_CONTENT_READER_END_OF_STREAM;
+      r->read();
+    }
+  }
+  catch (const Err & e) {
+    // headers are already sent, just close the connection
+    Log(1) << "Error: " << e.str() << "\n";
+    get_env(r->pars)->close();
+    return MHD_CONTENT_READER_END_WITH_ERROR;
+  }
+  size_t n = std::min(max, r->buf.size() - r->bpos);
+  memcpy(out, r->buf.data() + r->bpos, n);
+  r->bpos += n;
+  return n;
+}
+
+/* libmicrohttpd callback for deleting the reader */
+static void
+range_reader_free(void * cls){
+  delete (RangeReader *)cls;
+}
+
 /* libmicrohttpd callback for processing a requent. */
 static MHD_Result
 request_answer(void * cls, struct MHD_Connection * connection, const char * url,
                const char * method, const char * version,
                const char * upload_data, size_t * upload_data_size, void ** con_cls) {
   struct MHD_Response * response;
-  static string in_data; // data recieved in POST requests
   int code = MHD_HTTP_OK;
-  GrapheneEnv *env = (GrapheneEnv *) cls; /* server parameters */
+  GrapheneEnv *env = NULL;
 
   Log(2) << "> " << method << " " << url << "\n";
 
   try {
+    env = get_env((ServerPars *) cls);
+
     // simple-json interface: GET method with empty URL
     if (strcmp(method, "GET")==0 && strcmp(url, "/")==0){
       response = MHD_create_response_from_buffer(0,0,MHD_RESPMEM_MUST_COPY);
@@ -105,19 +189,19 @@ request_answer(void * cls, struct MHD_Connection * connection, const char * url,
     }
     // simple-json interface: POST method
     else if (strcmp(method, "POST")==0){
-      if (*con_cls == NULL){ // first connection - reset input data
-        in_data = string();
-        *con_cls = &in_data;
+      if (*con_cls == NULL){ // first connection - create input data buffer
+        *con_cls = new string;
         return MHD_YES;
       }
+      string & in_data = *(string *)*con_cls; // data recieved in POST requests
       if (*upload_data_size){ // data came -- append to input data
-        in_data += string(upload_data, upload_data + *upload_data_size);
+        in_data.append(upload_data, *upload_data_size);
         *upload_data_size = 0;
         return MHD_YES;
       }
       else{ // Process the query by graphene_json() and answer
         string out_data;
-        out_data = graphene_json(env, url, in_data);
+        out_data = graphene_json(env, url, in_data, ((ServerPars *) cls)->workers);
 
         Log(3) << ">>> " << in_data << "\n";
         Log(4) << "<<< " << out_data << "\n";
@@ -140,7 +224,9 @@ request_answer(void * cls, struct MHD_Connection * connection, const char * url,
       auto t2   = pars.get("t2",   "inf");
       auto dt   = pars.get("dt",   "0");
       auto cnt  = pars.get("cnt",  "1000");
+      auto agg  = graphene_agg_parse(pars.get("agg", "none"));
       std::ostringstream out;
+      response = NULL;
 
       if (strcasecmp(cmd.c_str(),"get")==0){
         pars.check_unknown({"name","tfmt","t2"});
@@ -154,9 +240,35 @@ request_answer(void * cls, struct MHD_Connection * connection, const char * url,
         pars.check_unknown({"name","tfmt","t2"});
         env->get_prev(n, t2, tfmt, out_cb_simple, &out);
       }
+      else if (strcasecmp(cmd.c_str(),"get_many")==0 ||
+               strcasecmp(cmd.c_str(),"get_prev_many")==0){
+        pars.check_unknown({"name","tfmt","ts"});
+        std::vector<std::string> ts;
+        std::istringstream ss(pars.get("ts", ""));
+        std::string t;
+        while (std::getline(ss, t, ',')) if (t!="") ts.push_back(t);
+        if (strcasecmp(cmd.c_str(),"get_many")==0)
+          env->get_many(n, ts, tfmt, out_cb_simple, &out);
+        else
+          env->get_prev_many(n, ts, tfmt, out_cb_simple, &out);
+      }
       else if (strcasecmp(cmd.c_str(),"get_range")==0){
-        pars.check_unknown({"name","tfmt","t1","t2","dt"});
-        env->get_range(n, t1,t2,dt, tfmt, out_cb_simple, &out);
+        pars.check_unknown({"name","tfmt","t1","t2","dt","agg"});
+
+        // Read the first part. Errors are reported here, as for
+        // other commands. If the range is not finished, stream the rest.
+        std::unique_ptr<RangeReader> r(new RangeReader);
+        r->pars = (ServerPars *) cls;
+        r->name = n; r->t1 = t1; r->t2 = t2; r->dt = dt; r->time0 = t1;
+        r->tfmt = tfmt; r->agg = agg;
+        r->read();
+        if (r->t1 != ""){
+          response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN,
+            64*1024, range_reader, r.get(), range_reader_free);
+          if (response==NULL) return MHD_NO;
+          r.release();
+        }
+        else out << r->buf;
       }
       else if (strcasecmp(cmd.c_str(),"get_wrange")==0){
         pars.check_unknown({"name","tfmt","t1","t2","dt"});
@@ -167,8 +279,8 @@ request_answer(void * cls, struct MHD_Connection * connection, const char * url,
         env->get_count(n, t1,cnt, tfmt, out_cb_simple, &out);
       }
       else if (strcasecmp(cmd.c_str(), "list")==0){
-        pars.check_unknown({});
-        for (auto const & n: env->dblist()) out << n << "\n";
+        pars.check_unknown({"name"});
+        for (auto const & d: env->dbsearch(n)) out << d << "\n";
       }
       else if (strcasecmp(cmd.c_str(), "help")==0 ||
                strcasecmp(cmd.c_str(), "cmdlist")==0)
@@ -179,23 +291,32 @@ request_answer(void * cls, struct MHD_Connection * connection, const char * url,
           " * get(name, t2, tfmt) -- get previous of interpolated value\n"
           " * get_prev(name, t2, tfmt) -- get previous value\n"
           " * get_next(name, t1, tfmt) -- get next value\n"
-          " * get_range(name, t1, t2, dt, tfmt) -- get all values in the range t1..t2\n"
+          " * get_many(name, ts, tfmt) -- get previous or interpolated values for many timestamps\n"
+          " * get_prev_many(name, ts, tfmt) -- get previous values for many timestamps\n"
+          " * get_range(name, t1, t2, dt, tfmt, agg) -- get all values in the range t1..t2\n"
           " * get_count(name, t1, cnt, tfmt) -- get cnt values starting from t1\n"
-          " * list -- list all databases\n"
+          " * list(name) -- list all databases, or databases with names starting\n"
+          "          with name (or matching a regular expression if name is /<re>/)\n"
           " * help or cmdlist -- print this text\n"
           "Parameters:\n"
           " * name -- database name\n"
           " * t1 -- timestamp in seconds (default 0)\n"
           " * t2 -- timestamp in seconds (default inf)\n"
           " * dt -- time step in seconds (default 0)\n"
+          " * ts -- comma-separated list of timestamps, preferably sorted\n"
           " * count -- number of records (default 1000)\n"
+          " * agg -- aggregation mode for get_range: none (default), min, max,\n"
+          "          mean, first, last, count, minmax, or interp (values on the\n"
+          "          regular grid t1+k*dt)\n"
           " * tfmt -- output time format, 'def' (default) or 'rel'\n"
         ;
       else throw Err() << "bad command: " << cmd.c_str();
 
-      string out_data = out.str();
-      response = MHD_create_response_from_buffer(
-          out_data.size(), (void *)out_data.data(), MHD_RESPMEM_MUST_COPY);
+      if (response == NULL){
+        string out_data = out.str();
+        response = MHD_create_response_from_buffer(
+            out_data.size(), (void *)out_data.data(), MHD_RESPMEM_MUST_COPY);
+      }
       MHD_add_response_header (response, "Content-Type", "text/plain");
     }
     else {
@@ -208,7 +329,7 @@ request_answer(void * cls, struct MHD_Connection * connection, const char * url,
     MHD_add_response_header(response, "Error", e.str().c_str());
     code = 400;
     // close all databases. In case of an error which needs recovery/reopening.
-    env->close();
+    if (env) env->close();
   }
 
   // this allowes external grafana server make requests
@@ -238,7 +359,22 @@ int main(int argc, char ** argv) {
     options.add("tcllib",   1,'T', "GR", "TCL library path (default: /usr/share/graphene/tcllib/)");
     options.add("env_type", 1,'E', "GR", "environment type: none, lock, txn "
        "(default: lock)");
+    options.add("cache_size", 1,'C', "GR", "Cache size for a new environment, bytes "
+       "(default: libdb default).");
+    options.add("mmap_size",  1,'M', "GR", "Max size of a read-only database mapped "
+       "into memory, bytes (default: libdb default).");
+    options.add("lk_max",     1,'L', "GR", "Max number of locks, lockers and lock "
+       "objects for a new environment (default: libdb default).");
+    options.add("max_dbs", 1,'O', "GR", "Max number of opened databases in each "
+       "database pool, least recently used ones are closed, 0 for no limit (default: 256).");
     options.add("port",    1,'p', "GR", "TCP port for connections (default: 8081).");
+    options.add("threads", 1,'t', "GR", "Number of threads for processing requests. "
+      "Each thread uses its own database pool and TCL interpreter. Can not be used "
+      "with env_type=none (default: 0, process all requests in a single thread).");
+    options.add("query_threads", 1,'q', "GR", "Number of additional threads for processing "
+      "targets of /query requests in parallel, shared by all requests. Each thread uses "
+      "its own database pool and TCL interpreter. Can not be used with env_type=none "
+      "(default: 0, process targets one by one).");
     options.add("dofork",  0,'f', "GR", "Do fork and run as a daemon.");
     options.add("stop",    0,'S', "GR", "Stop running daemon (found by pid-file).");
     options.add("verbose", 1,'v', "GR", "Verbosity level: 0 - write nothing; "
@@ -265,7 +401,15 @@ int main(int argc, char ** argv) {
     string tcllib   = opts.get("tcllib",   "/usr/share/graphene/tcllib/");
     string env_type = opts.get("env_type", "lock");
 
+    GrapheneEnvCfg cfg;
+    cfg.cache_size = opts.get<size_t>("cache_size", 0);
+    cfg.mmap_size  = opts.get<size_t>("mmap_size",  0);
+    cfg.lk_max     = opts.get<uint32_t>("lk_max",   0);
+
+    size_t maxdbs = opts.get<size_t>("max_dbs", DEF_POOL_SIZE);
     int port    = opts.get("port",  8081);
+    int threads = opts.get("threads", 0);
+    int qthreads = opts.get("query_threads", 0);
     int verb    = opts.get("verbose", 0);
     logfile     = opts.get("logfile",  "");
     pidfile     = opts.get("pidfile", "/var/run/graphene_http.pid");
@@ -362,12 +506,23 @@ int main(int argc, char ** argv) {
       mypid = true;
     }
 
-    GrapheneEnv env(dbpath, true, env_type, tcllib);
+    if (threads<0) throw Err() << "non-negative number of threads expected";
+    if (threads>0 && env_type=="none")
+      throw Err() << "thread pool can not be used without DB environment";
+    if (qthreads>0 && env_type=="none")
+      throw Err() << "parallel queries can not be used without DB environment";
+    GrapheneEnv env(dbpath, true, env_type, tcllib, threads>0 || qthreads>0, cfg);
+    env.set_pool_size(maxdbs);
+    std::unique_ptr<GrapheneWorkers> workers;
+    if (qthreads>0) workers.reset(new GrapheneWorkers(env, tcllib, qthreads));
+    ServerPars pars = {&env, threads, tcllib, workers.get()};
 
     // start server
     d = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY,
                          port, NULL, NULL,
-                         &request_answer, &env,
+                         &request_answer, &pars,
+                         MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+                         MHD_OPTION_THREAD_POOL_SIZE, (unsigned int)threads,
                          MHD_OPTION_END);
     if (d == NULL)
       throw Err() << "can't start the http server";
@@ -387,6 +542,8 @@ int main(int argc, char ** argv) {
 
     Log(1) << "Starting the server:\n"
            << "  Port: " <<  port << "\n"
+           << "  Threads: " <<  threads << "\n"
+           << "  Query threads: " <<  qthreads << "\n"
            << "  Pid file: " <<  pidfile << "\n"
            << "  Log file: " <<  logfile << "\n"
            << "  DB environment type: " <<  env_type << "\n"
@@ -397,6 +554,9 @@ int main(int argc, char ** argv) {
     catch(int ret){}
 
     Log(1) << "Stopping HTTP server";
+    // stop the server before destroying the environment
+    MHD_stop_daemon(d);
+    d = NULL;
     ret=0;
   }
 
@@ -73,12 +73,42 @@ main(){
     }
     std::cerr << "Get " << NVAL << " values using get(): " << tc.meas() << "\n";
 
+    tc.reset();
+    {
+      std::vector<std::string> ts;
+      for (int i = 0; i<NVAL; i++){
+        std::ostringstream st;
+        st << i*0.001;
+        ts.push_back(st.str());
+      }
+      env.get_many(DBNAME, ts, TFMT, NULL, NULL);
+    }
+    std::cerr << "Get " << NVAL << " values using get_many(): " << tc.meas() << "\n";
+
     tc.reset();
     env.get_range(DBNAME, "0", "inf", "0", TFMT, NULL, NULL);
     std::cerr << "Get " << NVAL << " values using get_range(): " << tc.meas() << "\n";
 
     env.del_range(DBNAME, "0", "inf");
 
+    tc.reset();
+    {
+      std::vector<std::string> ts;
+      std::vector<std::vector<std::string> > dats;
+      for (int i = 0; i<NVAL; i++){
+        std::ostringstream st;
+        std::ostringstream sd;
+        st << i*0.001;
+        sd << i*0.001;
+        ts.push_back(st.str());
+        dats.push_back(std::vector<std::string>(1, sd.str()));
+      }
+      env.put_batch(DBNAME, ts, dats, DPOLICY);
+    }
+    std::cerr << "Put " << NVAL << " values using put_batch(): " << tc.meas() << "\n";
+
+    env.del_range(DBNAME, "0", "inf");
+
     // input filter
     env.set_filter(DBNAME, 0, "set data [expr $data**2]");
 
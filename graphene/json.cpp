@@ -21,6 +21,7 @@
 
 #include "jsonxx/jsonxx.h"
 #include "gr_env.h"
+#include "gr_workers.h"
 
 using namespace std;
 
@@ -127,7 +128,7 @@ out_cb_json_txt(const std::string &t, const std::vector<std::string> &d, void *
 
 /***************************************************************************/
 // process /query
-Json json_query(GrapheneEnv * env, const Json & ji){
+Json json_query(GrapheneEnv * env, const Json & ji, GrapheneWorkers * workers){
 
   /*
   /query input:
@@ -160,29 +161,47 @@ Json json_query(GrapheneEnv * env, const Json & ji){
   uint64_t maxpt = ji["maxDataPoints"].as_integer();
   if (maxpt==0) throw Err() << "Bad maxDataPoints";
 
-  /* parse targets and run command */
-  Json ret = Json::array();
-
-  for (int i=0; i<ji["targets"].size(); i++){
-
-    std::string name = ji["targets"][i]["target"].as_string();
-
-    // Get a database, check format
-    int col,flt;
-    std::string n = parse_ext_name(name, col, flt);
-    if (env->get_dtype(n) == DATA_TEXT)
-      throw Err() << "Can not do query from TEXT database. Use annotations";
+  /* Parse targets. Json objects are not shared between threads,
+     names and aggregation modes are extracted here. */
+  size_t nt = ji["targets"].size();
+  std::vector<std::string> names(nt);
+  std::vector<std::string> aggs(nt);
+  for (size_t i=0; i<nt; i++){
+    names[i] = ji["targets"][i]["target"].as_string();
+    // aggregation mode (optional)
+    aggs[i]  = ji["targets"][i].exists("agg")?
+               ji["targets"][i]["agg"].as_string() : "none";
+  }
 
-    Json data = Json::array();
-    // Get data from the database
-    env->get_range(name, t1,t2,dt, TFMT_DEF, out_cb_json_num, &data);
+  /* Run commands, in parallel if workers are available.
+     Each job uses its own environment and fills its own array. */
+  std::vector<Json> data(nt);
+  std::vector<GrapheneWorkers::job_t> jobs;
+  for (size_t i=0; i<nt; i++){
+    jobs.push_back([&,i](GrapheneEnv * env){
+      // Get a database, check format
+      int col,flt;
+      std::string n = parse_ext_name(names[i], col, flt);
+      if (env->dbinfo(n, false).dtype == DATA_TEXT)
+        throw Err() << "Can not do query from TEXT database. Use annotations";
+
+      AggMode agg = graphene_agg_parse(aggs[i]);
+
+      // Get data from the database
+      data[i] = Json::array();
+      env->get_range(names[i], t1,t2,dt, TFMT_DEF, out_cb_json_num, &data[i], agg);
+    });
+  }
+  if (workers) workers->run(jobs, env);
+  else for (auto & j: jobs) j(env);
 
+  Json ret = Json::array();
+  for (size_t i=0; i<nt; i++){
     Json jt = Json::object();
     jt.set("target", ji["targets"][i]["target"]);
-    jt.set("datapoints", data);
+    jt.set("datapoints", data[i]);
     ret.append(jt);
   }
-
   return ret;
 }
 
@@ -216,7 +235,7 @@ Json json_annotations(GrapheneEnv * env, const Json & ji){
   // Get a database, check format
   int col,flt;
   std::string n = parse_ext_name(name, col, flt);
-  if (env->get_dtype(n) != DATA_TEXT)
+  if (env->dbinfo(n, false).dtype != DATA_TEXT)
     throw Err() << "Annotations can be found only in TEXT databases";
 
   ostringstream ss; ss << fixed << (atof(t2.c_str())-atof(t1.c_str()))/MAX_ANNOTATIONS;
@@ -231,9 +250,10 @@ Json json_annotations(GrapheneEnv * env, const Json & ji){
 
 /***************************************************************************/
 // process /search
+// Target (optional) is a name prefix or a regular expression /<re>/.
 Json json_search(GrapheneEnv * env, const Json & ji){
   Json out = Json::array();
-  auto names = env->dblist();
+  auto names = env->dbsearch(ji["target"].as_string());
   for (auto const & n:names)
     out.append(Json(n));
   return out;
@@ -243,7 +263,8 @@ Json json_search(GrapheneEnv * env, const Json & ji){
 /* Process a JSON request to the database. */
 string graphene_json(GrapheneEnv * env,
                      const string & url,     /* /query, /annotations, etc. */
-                     const string & data){    /* input data */
+                     const string & data,    /* input data */
+                     GrapheneWorkers * workers){
 
   /* parse input JSON */
   Json ji = Json::load_string(data);
@@ -251,7 +272,7 @@ string graphene_json(GrapheneEnv * env,
   int out_fl = JSON_PRESERVE_ORDER;
 
   if (url == "/query")
-    return json_query(env, ji).save_string(out_fl);
+    return json_query(env, ji, workers).save_string(out_fl);
 
   if (url == "/search")
     return json_search(env, ji).save_string(out_fl);
@@ -8,13 +8,16 @@
 #include "jsonxx/jsonxx.h"
 
 #include "gr_env.h"
+#include "gr_workers.h"
 
 /* Process a JSON request to the database. */
 /* Returns allocated buffer with the data, set dsize to its size */
 /* Returns NULL on errors, dsize in unspecified then.*/
+/* If workers are set, targets of /query are processed in parallel. */
 
 std::string graphene_json(GrapheneEnv * env,
                           const std::string & url,      /* /query, /annotations, etc. */
-                          const std::string & data      /* input data */
+                          const std::string & data,     /* input data */
+                          GrapheneWorkers * workers = NULL
                          );
 #endif
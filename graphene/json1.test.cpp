@@ -22,19 +22,28 @@ using namespace std;
 
 int
 main(int argc, char *argv[]){
-  if (argc != 3){
-    cerr << "Usage: graphene_json <dbpath> <url> < <json_input> > <json_output>\n";
+  if (argc != 3 && argc != 4){
+    cerr << "Usage: graphene_json <dbpath> <url> [<threads>] < <json_input> > <json_output>\n";
     return 1;
   }
   string dbpath(argv[1]);
   string url(argv[2]);
+  int threads = argc>3? atoi(argv[3]) : 0;
 
   string in_data;
   while (!cin.eof()){ string s; getline(cin, s); in_data +=s+'\n'; }
 
   try {
-    GrapheneEnv env(dbpath, true, "none", "");
-    cout << graphene_json(&env, url, in_data);
+    if (threads==0) {
+      GrapheneEnv env(dbpath, true, "none", "");
+      cout << graphene_json(&env, url, in_data);
+    }
+    else {
+      // parallel processing of /query targets
+      GrapheneEnv env(dbpath, true, "lock", "", true);
+      GrapheneWorkers workers(env, "", threads);
+      cout << graphene_json(&env, url, in_data, &workers);
+    }
   }
   catch (Err e){
     cout << "Error: " << e.str();
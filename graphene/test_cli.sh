@@ -69,6 +69,27 @@ assert_cmd "./graphene -d . info test_4" "UINT32	Uint 32 database"
 assert_cmd "./graphene -d . list a" "Error: too many parameters" 1
 assert_cmd "./graphene -d . list | sort" "$(printf "test_1\ntest_2\ntest_3\ntest_4")"
 
+# search, list_info
+assert_cmd "./graphene -d . search" "Error: pattern expected" 1
+assert_cmd "./graphene -d . search test_" "$(printf "test_1\ntest_2\ntest_3\ntest_4")"
+assert_cmd "./graphene -d . search test_1" "test_1"
+assert_cmd "./graphene -d . search x" ""
+assert_cmd "./graphene -d . search '/_[24]/'" "$(printf "test_2\ntest_4")"
+assert_cmd "./graphene -d . search '/[/'" "Error: bad regular expression: [" 1
+assert_cmd "./graphene -d . list_info a b" "Error: too many parameters" 1
+assert_cmd "./graphene -d . list_info '/[12]/'" "$(printf "test_1\tDOUBLE\t-\ntest_2\tUINT16\t-")"
+assert_cmd "./graphene -d . set_filter test_4 2 \"return 1\"" ""
+assert_cmd "./graphene -d . list_info test_4" "$(printf "test_4\tUINT32\t2\tUint 32 database")"
+# information is updated after changes
+assert_cmd "printf 'list_info test_3\nset_descr test_3 abc\nlist_info test_3\nrename test_3 test_5\nsearch /[35]/\nrename test_5 test_3\n' |\
+  ./graphene -d . -i | grep test_"\
+  "$(printf "test_3\tUINT32\t-\tUint 32 database\ntest_3\tUINT32\t-\tabc\ntest_5")"
+# changes made by another program are seen
+assert_cmd "(printf 'list_info test_3\n'; sleep 1; ./graphene -d . set_descr test_3 def; printf 'list_info test_3\n') |\
+  ./graphene -d . -i | grep test_"\
+  "$(printf "test_3\tUINT32\t-\tabc\ntest_3\tUINT32\t-\tdef")"
+assert_cmd "./graphene -d . set_descr test_3 Uint 32 database" ""
+
 # list_dbs
 assert_cmd "./graphene -d . list_dbs a" "Error: too many parameters" 1
 assert_cmd "./graphene -E lock -d . list_dbs" "Error: list_dbs can not by run in this environment type: lock" 1
@@ -79,6 +100,16 @@ assert_cmd "./graphene -d . list_logs a" "Error: too many parameters" 1
 assert_cmd "./graphene -E lock -d . list_logs" "Error: list_logs can not by run in this environment type: lock" 1
 assert_cmd "./graphene -R -d . list_logs" "Error: list_logs can not by run in this environment type: lock" 1
 
+# mpool_stat, page size
+assert_cmd "./graphene -d . mpool_stat a" "Error: too many parameters" 1
+assert_cmd "./graphene -E none -d . mpool_stat" "Error: Command can not be run without DB environment" 1
+assert_cmd "./graphene -d . mpool_stat | grep -c '^cache hit ratio'" "1"
+assert_cmd "./graphene -d . -P 1000 create test_5" "Error: test_5.db: can't set page size 1000: Invalid argument" 1
+assert_cmd "./graphene -d . -P 1024 create test_5" ""
+assert_cmd "printf 'get_next test_5\nmpool_stat\n' | ./graphene -d . -i | grep -A1 '^test_5.db$'" "test_5.db
+  page size: 1024"
+assert_cmd "./graphene -d . delete test_5" ""
+
 # delete
 assert_cmd "./graphene -d . delete" "Error: database name expected" 1
 assert_cmd "./graphene -d . delete a b" "Error: too many parameters" 1
@@ -157,6 +188,21 @@ assert_cmd "./graphene -d . get_prev test_1 inf"            "2234567890.12300000
 assert_cmd "./graphene -d . get_prev test_1 3234567895"     "2234567890.123000000 0.2"
 assert_cmd "./graphene -r -d . get_prev test_1 2234567895"     "-4.877000000 0.2" # relative
 
+# get_many, get_prev_many
+assert_cmd "./graphene -d . get_many test_1" ""
+assert_cmd "./graphene -d . get_many test_1 0 1234567890 1734567890 2234567890.123 inf" "1234567890.000000000 0.1
+1734567890.000000000 0.14999999999385
+2234567890.123000000 0.2
+2234567890.123000000 0.2"
+assert_cmd "./graphene -d . get_many test_1 inf 1734567890" "2234567890.123000000 0.2
+1734567890.000000000 0.14999999999385" # unsorted
+assert_cmd "./graphene -d . get_prev_many test_1 0 1234567890 1734567890 inf" "1234567890.000000000 0.1
+1234567890.000000000 0.1
+2234567890.123000000 0.2"
+assert_cmd "./graphene -r -d . get_prev_many test_1 1234567895 2234567895" "-5.000000000 0.1
+-4.877000000 0.2" # relative to each timestamp
+assert_cmd "./graphene -d . get_many" "Error: database name expected" 1
+
 # get_range
 assert_cmd "./graphene -d . get_range test_1 0 1234567880"   ""
 assert_cmd "./graphene -d . get_range test_1 0 1234567880 2" ""
@@ -272,11 +318,248 @@ assert_cmd "./graphene -d . get test_1+test_2+test_1:1+test_3 2"     "2.00000000
 assert_cmd "./graphene -d . get_range test_1+test_2+test_1:1+test_3" "1.000000000 1 2 3 10 20 2 TEXT 1
 2.000000000 2 3 4 15 25 3 TEXT 1
 3.000000000 3 4 5 20 30 4 TEXT2"
+assert_cmd "./graphene -d . get_range test_1+test_2 0 inf 2" "1.000000000 1 2 3 10 20
+3.000000000 3 4 5 20 30"
+assert_cmd "./graphene -d . get_range test_2+test_1:2+test_3" "1.000000000 10 20 3 TEXT 1
+3.000000000 20 30 5 TEXT2"
 
 assert_cmd "./graphene -d . delete test_1" ""
 assert_cmd "./graphene -d . delete test_2" ""
 assert_cmd "./graphene -d . delete test_3" ""
 
+###########################################################################
+# aggregation in get_range
+assert_cmd "./graphene -d . create test_1 INT16" ""
+assert_cmd "./graphene -d . create test_2 TEXT" ""
+assert_cmd "./graphene -d . put test_1 10    5 1" ""
+assert_cmd "./graphene -d . put test_1 10.5  3 2" ""
+assert_cmd "./graphene -d . put test_1 11.9  7 3" ""
+assert_cmd "./graphene -d . put test_1 12    1 4" ""
+assert_cmd "./graphene -d . put test_1 15.1  2 6" ""
+assert_cmd "./graphene -d . put test_2 10    text1" ""
+assert_cmd "./graphene -d . put test_2 11    text2" ""
+
+assert_cmd "./graphene -d . get_range test_1 10 20 2 min" "10.000000000 3 1
+12.000000000 1 4
+14.000000000 2 6"
+assert_cmd "./graphene -d . get_range test_1 10 20 2 max" "10.000000000 7 3
+12.000000000 1 4
+14.000000000 2 6"
+assert_cmd "./graphene -d . get_range test_1 10 20 2 mean" "10.000000000 5 2
+12.000000000 1 4
+14.000000000 2 6"
+assert_cmd "./graphene -d . get_range test_1 10 20 2 minmax" "10.000000000 3 7 1 3
+12.000000000 1 1 4 4
+14.000000000 2 2 6 6"
+assert_cmd "./graphene -d . get_range test_1 10 20 2 first" "10.000000000 5 1
+12.000000000 1 4
+15.100000000 2 6"
+assert_cmd "./graphene -d . get_range test_1 10 20 2 last" "11.900000000 7 3
+12.000000000 1 4
+15.100000000 2 6"
+assert_cmd "./graphene -d . get_range test_1 10 20 2 count" "10.000000000 3
+12.000000000 1
+14.000000000 1"
+assert_cmd "./graphene -d . get_range test_1 10 20 2 none" "10.000000000 5 1
+12.000000000 1 4
+15.100000000 2 6"
+
+# dt=0: one interval
+assert_cmd "./graphene -d . get_range test_1 0 inf 0 mean" "10.000000000 3.6 3.2"
+# column
+assert_cmd "./graphene -d . get_range test_1:1 10 20 2 max" "10.000000000 3
+12.000000000 4
+14.000000000 6"
+assert_cmd "./graphene -d . get_range test_1:1 10 20 2 minmax" "10.000000000 1 3
+12.000000000 4 4
+14.000000000 6 6"
+assert_cmd "./graphene -d . get_range test_1:3 10 20 2 max" "10.000000000 NaN
+12.000000000 NaN
+14.000000000 NaN"
+
+assert_cmd "./graphene -d . get_range test_2 0 inf 0 last" "11.000000000 text2"
+assert_cmd "./graphene -d . get_range test_2 0 inf 0 count" "10.000000000 2"
+assert_cmd "./graphene -d . get_range test_2 0 inf 0 mean"\
+  "Error: Can not do mean aggregation of TEXT data" 1
+assert_cmd "./graphene -d . get_range test_1 0 inf 0 xxx"\
+  "Error: Unknown aggregation mode: xxx" 1
+
+# resampling on a regular grid
+assert_cmd "./graphene -d . get_range test_1 9 16 2 interp" "11.000000000 3 2
+13.000000000 1 4
+15.000000000 1 4"
+assert_cmd "./graphene -d . get_range test_1:1 9 16 2 interp" "11.000000000 2
+13.000000000 4
+15.000000000 4"
+assert_cmd "./graphene -d . get_range test_1 0 inf 4 interp" "12.000000000 1 4"
+assert_cmd "./graphene -d . get_range test_2 0 inf 0.5 interp" "10.000000000 text1
+10.500000000 text1
+11.000000000 text2"
+assert_cmd "./graphene -d . get_range test_1 0 inf 0 interp"\
+  "Error: Non-zero time step is needed for interpolation" 1
+assert_cmd "./graphene -d . create test_3 DOUBLE" ""
+assert_cmd "./graphene -d . put test_3 10 1" ""
+assert_cmd "./graphene -d . put test_3 12 2" ""
+assert_cmd "./graphene -d . get_range test_3 9 13 0.5 interp" "10.000000000 1
+10.500000000 1.25
+11.000000000 1.5
+11.500000000 1.75
+12.000000000 2"
+assert_cmd "./graphene -d . get_range test_3 0 inf 1000 interp" ""
+assert_cmd "./graphene -d . delete test_3" ""
+
+# rollup tiers
+assert_cmd "./graphene -d . get_rollup test_1" ""
+assert_cmd "./graphene -d . set_rollup test_1 2 3"\
+  "Error: Rollup tier length should be a multiple of the previous one: 2 3" 1
+assert_cmd "./graphene -d . set_rollup test_1 0"\
+  "Error: Rollup tier length should be positive" 1
+assert_cmd "./graphene -d . set_rollup test_1 2 4" ""
+assert_cmd "./graphene -d . get_rollup test_1" "2 4"
+assert_cmd "ls | grep rollup" "test_1.rollup"
+
+assert_cmd "./graphene -d . get_range test_1 10 20 2 mean" "10.000000000 5 2
+12.000000000 1 4
+14.000000000 2 6"
+assert_cmd "./graphene -d . get_range test_1 10 20 2 minmax" "10.000000000 3 7 1 3
+12.000000000 1 1 4 4
+14.000000000 2 2 6 6"
+assert_cmd "./graphene -d . get_range test_1 0 inf 4 count" "8.000000000 3
+12.000000000 2"
+assert_cmd "./graphene -d . get_range test_1 0 inf 0 mean" "10.000000000 3.6 3.2"
+assert_cmd "./graphene -d . get_range test_1:1 10 20 2 max" "10.000000000 3
+12.000000000 4
+14.000000000 6"
+
+# rollups are updated on put/del/del_range
+assert_cmd "./graphene -d . put test_1 10.5 6 5" ""
+assert_cmd "./graphene -d . put test_1 13 3 3" ""
+assert_cmd "./graphene -d . del test_1 12" ""
+assert_cmd "./graphene -d . del_range test_1 15 16" ""
+assert_cmd "./graphene -d . get_range test_1 10 20 2 mean" "10.000000000 6 3
+12.000000000 3 3"
+assert_cmd "./graphene -d . get_range test_1 0 inf 4 count" "8.000000000 3
+12.000000000 1"
+
+# rename/delete
+assert_cmd "./graphene -d . rename test_1 test_3" ""
+assert_cmd "ls | grep rollup" "test_3.rollup"
+assert_cmd "./graphene -d . get_rollup test_3" "2 4"
+assert_cmd "./graphene -d . get_range test_3 0 inf 4 count" "8.000000000 3
+12.000000000 1"
+assert_cmd "./graphene -d . rename test_3 test_1" ""
+
+# missing rollup database: raw points are read in readonly mode,
+# in writable mode it is created and rebuilt
+rm -f test_1.rollup
+assert_cmd "./graphene -d . -R get_range test_1 0 inf 4 count" "8.000000000 3
+12.000000000 1"
+assert_cmd "ls | grep rollup" "" 1
+assert_cmd "./graphene -d . get_range test_1 0 inf 4 count" "8.000000000 3
+12.000000000 1"
+assert_cmd "ls | grep rollup" "test_1.rollup"
+assert_cmd "./graphene -d . get_range test_1 10 20 2 mean" "10.000000000 6 3
+12.000000000 3 3"
+
+# switch rollups off
+assert_cmd "./graphene -d . set_rollup test_1" ""
+assert_cmd "./graphene -d . get_rollup test_1" ""
+assert_cmd "./graphene -d . get_range test_1 10 20 2 mean" "10.000000000 6 3
+12.000000000 3 3"
+assert_cmd "./graphene -d . set_rollup test_2 10" ""
+
+assert_cmd "./graphene -d . delete test_1" ""
+assert_cmd "./graphene -d . delete test_2" ""
+assert_cmd "ls | grep rollup" "" 1
+
+###########################################################################
+# blocks of points (database version 3)
+assert_cmd "./graphene -d . -V 4 create test_1" "Error: unsupported database version: 4" 1
+assert_cmd "./graphene -d . -V 3 create test_1 DOUBLE \"blocks\"" ""
+assert_cmd "./graphene -d . info test_1" "DOUBLE	blocks"
+
+assert_cmd "./graphene -d . put test_1 20 2" ""
+assert_cmd "./graphene -d . put test_1 10 1" ""
+assert_cmd "./graphene -d . put test_1 30 3 3" ""
+assert_cmd "./graphene -d . -D error put test_1 30 4" "Error: test_1.db: Timestamp exists" 1
+assert_cmd "./graphene -d . -D sshift put test_1 30 4" ""
+assert_cmd "./graphene -d . get_range test_1" "10.000000000 1
+20.000000000 2
+30.000000000 3 3
+31.000000000 4"
+assert_cmd "./graphene -d . get_next test_1 11" "20.000000000 2"
+assert_cmd "./graphene -d . get_prev test_1 29" "20.000000000 2"
+assert_cmd "./graphene -d . get test_1 15" "15.000000000 1.5"
+assert_cmd "./graphene -d . get test_1 40" "31.000000000 4"
+assert_cmd "./graphene -d . del test_1 10" ""
+assert_cmd "./graphene -d . del test_1 10" "Error: test_1.db: No such record: 10" 1
+assert_cmd "./graphene -d . get_range test_1 0 inf 5" "20.000000000 2
+30.000000000 3 3"
+
+# many points (several records)
+assert_cmd "seq 1000 | sed 's/.*/put test_1 & &/' | ./graphene -i -d . > /dev/null" ""
+assert_cmd "./graphene -d . get_count test_1 499 3" "499.000000000 499
+500.000000000 500
+501.000000000 501"
+assert_cmd "./graphene -d . del_range test_1 100 899" ""
+assert_cmd "./graphene -d . get_range test_1 98 902" "98.000000000 98
+99.000000000 99
+900.000000000 900
+901.000000000 901
+902.000000000 902"
+assert_cmd "./graphene -d . get_range test_1 0 inf 0 count" "1.000000000 200"
+
+assert_cmd "./graphene -d . delete test_1" ""
+
+###########################################################################
+# regular-interval mode
+assert_cmd "./graphene -d . create test_1 DOUBLE" ""
+assert_cmd "./graphene -d . get_regular test_1" ""
+assert_cmd "./graphene -d . set_regular test_1 100" "Error: period expected" 1
+assert_cmd "./graphene -d . set_regular test_1 100 0" "Error: non-zero period expected" 1
+assert_cmd "./graphene -d . set_regular test_1 100 10 4" ""
+assert_cmd "./graphene -d . get_regular test_1" "100.000000000 10.000000000 4"
+
+assert_cmd "./graphene -d . put test_1 50 0.5" ""
+assert_cmd "./graphene -d . put test_1 100 1" ""
+assert_cmd "./graphene -d . put test_1 110 2" ""
+assert_cmd "./graphene -d . put test_1 115 2.5 1" ""
+assert_cmd "./graphene -d . put test_1 150 5" ""
+assert_cmd "./graphene -d . put test_1 190 9" ""
+assert_cmd "./graphene -d . set_regular test_1" \
+  "Error: test_1.db: can't change regular-interval mode of a database with data" 1
+assert_cmd "./graphene -d . get_range test_1" "50.000000000 0.5
+100.000000000 1
+110.000000000 2
+115.000000000 2.5 1
+150.000000000 5
+190.000000000 9"
+assert_cmd "./graphene -d . get_next test_1 151" "190.000000000 9"
+assert_cmd "./graphene -d . get_prev test_1 149" "115.000000000 2.5 1"
+assert_cmd "./graphene -d . get test_1 170" "170.000000000 7"
+assert_cmd "./graphene -d . get test_1 75" "75.000000000 0.75"
+assert_cmd "./graphene -d . get_range test_1 0 inf 40" "50.000000000 0.5
+100.000000000 1
+150.000000000 5
+190.000000000 9"
+assert_cmd "./graphene -d . del test_1 150" ""
+assert_cmd "./graphene -d . del_range test_1 60 112" ""
+assert_cmd "./graphene -d . get_range test_1" "50.000000000 0.5
+115.000000000 2.5 1
+190.000000000 9"
+assert_cmd "./graphene -d . -D sshift put test_1 190 10" ""
+assert_cmd "./graphene -d . get_count test_1 180 2" "190.000000000 9
+191.000000000 10"
+assert_cmd "./graphene -d . del_range test_1 0 inf" ""
+assert_cmd "./graphene -d . set_regular test_1" ""
+assert_cmd "./graphene -d . get_regular test_1" ""
+assert_cmd "./graphene -d . delete test_1" ""
+
+assert_cmd "./graphene -d . -V 3 create test_1" ""
+assert_cmd "./graphene -d . set_regular test_1 100 10" \
+  "Error: test_1.db: regular-interval mode is not supported in version 3" 1
+assert_cmd "./graphene -d . delete test_1" ""
+
 ###########################################################################
 # precision (DOUBLE database)
 assert_cmd "./graphene -d . create test_2 DOUBLE \"double database\"" ""
@@ -345,6 +628,9 @@ assert_cmd "./graphene -d . get_prev test_4 2000" "2000.000000000 text2
 assert_cmd "./graphene -d . get_prev test_4 1500" "1000.000000000 text1"
 assert_cmd "./graphene -d . get_prev test_4 2001" "2000.000000000 text2
 2"
+assert_cmd "./graphene -d . get_prev_many test_4 0 1500 2001" "1000.000000000 text1
+2000.000000000 text2
+2"
 
 # get - same
 assert_cmd "./graphene -d . get test_4"      "2000.000000000 text2
@@ -409,6 +695,10 @@ assert_cmd "printf 'create test_2\n
                   get test_1 15\n
                   get test_2 38\n' | ./graphene -i -d ."\
         "$(printf "$prompt\n#OK\n#OK\n#OK\n#OK\n#OK\n15.000000000 5\n#OK\n38.000000000 28\n#OK")"
+
+# an opened database can not be created again
+assert_cmd "printf 'get test_2 38\ncreate test_2 INT8\ninfo test_2\n' | ./graphene -i -d ."\
+        "$(printf "$prompt\n38.000000000 28\n#OK\n#Error: test_2.db: File exists\nDOUBLE\n#OK")"
 assert_cmd "./graphene -d . delete test_1" ""
 assert_cmd "./graphene -d . delete test_2" ""
 
@@ -433,6 +723,62 @@ assert_cmd "cat test_data/commands1 | ./graphene -i -d ."\
 
 ./graphene -d . delete text_3
 
+# binary protocol: put 10s 5 (INT8), get_next; answers: status, length, data
+assert_cmd "./graphene -d . binary" "Error: binary protocol can be used only in interactive or socket mode" 1
+assert_cmd "./graphene -d . create test_1 INT8" ""
+assert_cmd "printf 'binary\n\042\0\0\0\003\0\0\0put\006\0\0\0test_1\010\0\0\0\0\0\0\0\012\0\0\0\001\0\0\0\005'\
+'\026\0\0\0\010\0\0\0get_next\006\0\0\0test_1' | ./graphene -i -d . | tail -c 23 | od -An -v -tx1 | tr -d ' \n'"\
+  "0000000000000d000000000000000a0000000100000005"
+assert_cmd "./graphene -d . get_range test_1" "10.000000000 5"
+assert_cmd "./graphene -d . delete test_1" ""
+
+# put queue
+assert_cmd "./graphene -d . -E none -Q 100 list" "Error: put queue can not be used without DB environment" 1
+assert_cmd "./graphene -d . -S abc list" "Error: Unknown durability level: abc" 1
+assert_cmd "./graphene -d . queue_stat" "Error: put queue is not used" 1
+assert_cmd "./graphene -d . create test_1" ""
+assert_cmd "printf 'put test_1 10 1\nput test_1 10 2\nput_many test_1 1 20 2 30 3\nqueue_flush\nqueue_flush\nget_range test_1\n' |\
+  ./graphene -d . -D error -Q 100 -S write_nosync -i"\
+  "$(printf "$prompt\n#OK\n#OK\n#OK\n#Error: test_1.db: Timestamp exists\n#OK\n10.000000000 1\n20.000000000 2\n30.000000000 3\n#OK")"
+assert_cmd "printf 'queue_stat\n' | ./graphene -d . -Q 100 -N 10 -i | grep 'max number'" "max number of points in a group: 10"
+assert_cmd "./graphene -d . -Q 100 put test_1 40 4" ""
+assert_cmd "./graphene -d . -Q 100 -D error put test_1 40 5" "Error: test_1.db: Timestamp exists" 1
+assert_cmd "./graphene -d . get_range test_1 35" "40.000000000 4"
+# with -A put commands wait for writing and report errors
+assert_cmd "printf 'put test_1 50 1\nput test_1 50 2\nget_range test_1 45\n' |\
+  ./graphene -d . -D error -Q 100 -A -i"\
+  "$(printf "$prompt\n#OK\n#Error: test_1.db: Timestamp exists\n50.000000000 1\n#OK")"
+# the group transaction fails: other requests of the group are written once
+# and acknowledged, only the broken one reports an error
+assert_cmd "printf 'put_many test_1 1 61 1 62 2\nput test_1 50 3\nput_many test_1 1 63 3 64 4\nqueue_flush\nget_range test_1 60\n' |\
+  ./graphene -d . -D error -Q 1000 -S write_nosync -i"\
+  "$(printf "$prompt\n#OK\n#OK\n#OK\n#Error: test_1.db: Timestamp exists\n61.000000000 1\n62.000000000 2\n63.000000000 3\n64.000000000 4\n#OK")"
+assert_cmd "./graphene -d . delete test_1" ""
+
+# the queue keeps databases open between groups,
+# a database can be removed and created again
+assert_cmd "printf 'create a\ncreate b\nput a 1 1\nput b 1 2\nqueue_flush\nput a 2 1\nput b 2 2\nqueue_flush\n
+                  delete a\ncreate a\nput a 3 3\nqueue_flush\nget_range a\nget_range b\n' |\
+  ./graphene -d . -Q 10 -O 2 -i"\
+  "$(printf "$prompt\n#OK\n#OK\n#OK\n#OK\n#OK\n#OK\n#OK\n#OK\n#OK\n#OK\n#OK\n#OK\n\
+3.000000000 3\n#OK\n1.000000000 2\n2.000000000 2\n#OK")"
+assert_cmd "./graphene -d . delete a" ""
+assert_cmd "./graphene -d . delete b" ""
+
+# database pool: with 2 opened databases a, b, c are reopened,
+# secondary databases do not close the primary one
+assert_cmd "printf 'create a\ncreate b\ncreate c\nput a 1 1\nput b 1 2\nput c 1 3\nget_range a+b+c\nget a 1\npool_stat\n' |\
+  ./graphene -d . -O 2 -i"\
+  "$(printf "$prompt\n#OK\n#OK\n#OK\n#OK\n#OK\n#OK\n1.000000000 1 2 3\n#OK\n1.000000000 1\n#OK\n\
+max number of opened databases: 2\nopened databases: 2\ndatabases found in the pool: 1\n\
+databases opened: 9\ndatabases closed to free the pool: 7\n#OK")"
+assert_cmd "printf 'get a 1\nget b 1\nget a 1\npool_stat\n' | ./graphene -d . -O 0 -i | grep pool"\
+  "databases found in the pool: 1
+databases closed to free the pool: 0"
+assert_cmd "./graphene -d . delete a" ""
+assert_cmd "./graphene -d . delete b" ""
+assert_cmd "./graphene -d . delete c" ""
+
 ###########################################################################
 # duplicated keys (replace by default)
 
@@ -467,6 +813,73 @@ assert_cmd "./graphene -d . -D aaa put test_1 1 8" "Error: Unknown dpolicy setti
 assert_cmd "./graphene -d . -D error put test_1 1 8" "Error: test_1.db: Timestamp exists" 1
 assert_cmd "./graphene -d . delete test_1" ""
 
+###########################################################################
+# put_many
+
+assert_cmd "./graphene -d . create test_1 UINT32" ""
+assert_cmd "./graphene -d . put_many test_1" "Error: database name, number of values, timestamp and some values expected" 1
+assert_cmd "./graphene -d . put_many test_1 0 1 2" "Error: positive number of values expected: 0" 1
+assert_cmd "./graphene -d . put_many test_1 2 1 2" "Error: number of parameters does not match number of values: 2" 1
+assert_cmd "./graphene -d . put_many test_1 2 1 2 3 4 5" "Error: number of parameters does not match number of values: 2" 1
+assert_cmd "./graphene -d . put_many test_1 1 3 30 1 10 2 20" ""
+assert_cmd "./graphene -d . get_range test_1" "\
+1.000000000 10
+2.000000000 20
+3.000000000 30"
+assert_cmd "./graphene -d . put_many test_1 2 4 40 41 5 50 51" ""
+assert_cmd "./graphene -d . get_range test_1 4" "\
+4.000000000 40 41
+5.000000000 50 51"
+
+# dpolicy is applied to each point
+assert_cmd "./graphene -d . -D sshift put_many test_1 1 1 11 1 12" ""
+assert_cmd "./graphene -d . get_range test_1 1 3" "\
+1.000000000 10
+2.000000000 20
+3.000000000 30"
+assert_cmd "./graphene -d . get_range test_1 6 7" "\
+6.000000000 11
+7.000000000 12"
+
+# error in the batch: nothing is written
+assert_cmd "./graphene -d . -D error put_many test_1 1 8 80 1 100" "Error: test_1.db: Timestamp exists" 1
+assert_cmd "./graphene -d . put_many test_1 1 9 90 10 a" "Error: Bad UINT32 value: a" 1
+assert_cmd "./graphene -d . get_next test_1 8" ""
+assert_cmd "./graphene -d . delete test_1" ""
+
+###########################################################################
+# bulk reads (small buffer to have many portions of data)
+
+assert_cmd "./graphene -d . create test_1 UINT32" ""
+assert_cmd "./graphene -d . put_many test_1 1 $(seq 1 1000 | sed 's/.*/& &/')" ""
+assert_cmd "./graphene -d . get_range test_1 | wc -l" "1000"
+assert_cmd "./graphene -d . -B -1 get_range test_1" "Error: bulk buffer size should be 0 or 1024..1073741824: 18446744073709551615" 1
+assert_cmd "./graphene -d . -B 100 get_range test_1" "Error: bulk buffer size should be 0 or 1024..1073741824: 100" 1
+assert_cmd "./graphene -d . -B 1024 get_range test_1 | md5sum" "$(./graphene -d . get_range test_1 | md5sum)"
+assert_cmd "./graphene -d . -B 1024 get_range test_1 10.5 20" "$(./graphene -d . get_range test_1 10.5 20)"
+assert_cmd "./graphene -d . -B 1024 get_range test_1 10 100 20" "$(./graphene -d . get_range test_1 10 100 20)"
+assert_cmd "./graphene -d . -B 1024 get_count test_1 500 300 | md5sum" "$(./graphene -d . get_count test_1 500 300 | md5sum)"
+assert_cmd "./graphene -d . -B 1024 get_count test_1 999" "$(./graphene -d . get_count test_1 999)"
+
+./graphene -d . dump test_1 test_1.tmp
+./graphene -d . -B 1024 dump test_1 test_2.tmp
+assert_cmd "diff test_1.tmp test_2.tmp" ""
+rm -f test_*.tmp
+
+assert_cmd "./graphene -d . backup_start test_1" "0.000000000"
+assert_cmd "./graphene -d . backup_end test_1" ""
+assert_cmd "./graphene -d . -B 1024 del_range test_1 100.5 899" ""
+assert_cmd "./graphene -d . backup_start test_1" "101.000000000"
+assert_cmd "./graphene -d . get_range test_1 | wc -l" "201"
+assert_cmd "./graphene -d . get_range test_1 99 901" "\
+99.000000000 99
+100.000000000 100
+900.000000000 900
+901.000000000 901"
+assert_cmd "./graphene -d . -B 1024 del_range test_1 0 inf" ""
+assert_cmd "./graphene -d . get_range test_1" ""
+assert_cmd "./graphene -d . delete test_1" ""
+
 ###########################################################################
 # 32- and 64-bit timestamps
 
@@ -606,6 +1019,21 @@ assert_cmd "./graphene -d . print_f0data test_1" ""
 assert_cmd "./graphene -d . put_flt test_1 200 1" ""
 assert_cmd "./graphene -d . print_f0data test_1" "1"
 
+# storage is kept in memory and written on exit
+assert_cmd "printf 'put_flt test_1 300 1\n
+                  put_flt test_1 301 1\n
+                  print_f0data test_1\n' | ./graphene -i -d . -F 100"\
+        "$(printf "$prompt\n#OK\n#OK\n3\n#OK")"
+assert_cmd "./graphene -d . print_f0data test_1" "3"
+
+# changing database information with unwritten storage
+assert_cmd "printf 'put_flt test_1 302 1\n
+                  put_flt test_1 303 1\n
+                  set_descr test_1 flt\n
+                  print_f0data test_1\n' | timeout 10 ./graphene -i -d . -E txn -F 100"\
+        "$(printf "$prompt\n#OK\n#OK\n#OK\n5\n#OK")"
+assert_cmd "./graphene -d . print_f0data test_1" "5"
+
 # setting of the filter resets also storage information
 ./graphene -d . set_filter test_1 0 "$code"
 assert_cmd "./graphene -d . put_flt test_1 523.456 10 20 30" ""
@@ -643,6 +1071,46 @@ assert_cmd "./graphene -d . get_range test_1:f5" \
 202 4
 204 36"
 
+# same as a batch filter
+code='#batch
+  set t {}
+  set d {}
+  foreach tm $times v $data {
+    set tm [expr int($tm)+2]
+    if {$tm >= 500} continue
+    lappend t $tm
+    lappend d [list [expr [lindex $v 0]*2]]
+  }
+  set times $t
+  set data $d'
+./graphene -d . set_filter test_1 6 "$code"
+assert_cmd "./graphene -d . get_range test_1:f6" \
+"125 22
+202 4
+204 36"
+assert_cmd "./graphene -d . get_count test_1:f6 200 2" \
+"202 4
+204 36"
+# batch filter in a secondary database
+assert_cmd "./graphene -d . get_range test_1+test_1:f6" \
+"123.000000000 11 1 22
+200.000000000 2 1 4
+202.000000000 18 4 36
+523.000000000 11 1"
+
+# filter modified by another process is seen in a running session
+./graphene -d . set_filter test_1 7 'return [expr $time < 200]'
+assert_cmd "(printf 'get_range test_1:f7\n'; sleep 1;
+             ./graphene -d . set_filter test_1 7 'return [expr \$time > 500]';
+             printf 'get_range test_1:f7\n') | ./graphene -d . -i"\
+  "$(printf "$prompt\n123.000000000 11 1\n#OK\n523.000000000 11 1\n#OK")"
+
+code='#batch
+  set times {}'
+./graphene -d . set_filter test_1 6 "$code"
+assert_cmd "./graphene -d . get_range test_1:f6" \
+"Error: filter: different length of times and data lists: 0 4" 1
+
 ###
 
 code='unset time; return 1'
@@ -667,6 +1135,51 @@ assert_cmd "./graphene -d . get_range test_1:f1" \
 
 assert_cmd "./graphene -d . delete test_1" ""
 
+###########################################################################
+## socket mode: two connections. Database information and input filter
+## storage are shared by worker threads.
+sock=graphene_test.sock
+rm -f $sock
+./graphene -d . create test_s UINT16
+./graphene -d . set_filter test_s 0 'append storage x; return 1'
+./graphene -d . -s $sock -t 2 < /dev/null &
+pid=$!
+for i in $(seq 50); do [ -S $sock ] && break; sleep 0.1; done
+
+(printf 'put_flt test_s 1 1\nget_rollup test_s\n'; sleep 1
+ printf 'put_flt test_s 2 1\nget_rollup test_s\nprint_f0data test_s\n') |\
+  socat -t 5 - UNIX-CONNECT:$sock > graphene_test.out &
+cpid=$!
+sleep 0.5
+assert_cmd "printf 'set_rollup test_s 10\nput_flt test_s 3 1\n' | socat -t 5 - UNIX-CONNECT:$sock"\
+  "$(printf "$prompt\n#OK\n#OK")"
+wait $cpid
+assert_cmd "cat graphene_test.out" "$(printf "$prompt\n#OK\n\n#OK\n#OK\n10\n#OK\nxxx\n#OK")"
+assert_cmd "./graphene -d . get_range test_s 0 inf 10 mean" "0.000000000 1"
+# statistics are sent to the connection
+assert_cmd "printf 'mpool_stat\nlock_stat\n' | socat -t 5 - UNIX-CONNECT:$sock | grep -c '^cache hit ratio\|^number of deadlocks'" "2"
+
+kill $pid; wait $pid
+
+## socket mode with put queue: errors are reported to the connection
+## which queued the points, queue_flush waits for points of the connection
+./graphene -d . -D error -Q 200 -s $sock -t 2 < /dev/null &
+pid=$!
+for i in $(seq 50); do [ -S $sock ] && break; sleep 0.1; done
+
+(printf 'put test_s 1 2\n'; sleep 1; printf 'queue_flush\n') |\
+  socat -t 5 - UNIX-CONNECT:$sock > graphene_test.out &
+cpid=$!
+sleep 0.5
+assert_cmd "printf 'put test_s 20 2\nqueue_flush\nget_range test_s 15\n' | socat -t 5 - UNIX-CONNECT:$sock"\
+  "$(printf "$prompt\n#OK\n#OK\n20.000000000 2\n#OK")"
+wait $cpid
+assert_cmd "cat graphene_test.out" "$(printf "$prompt\n#OK\n#Error: test_s.db: Timestamp exists")"
+
+kill $pid; wait $pid
+rm -f $sock graphene_test.out
+assert_cmd "./graphene -d . delete test_s" ""
+
 ###########################################################################
 # remove all test databases
 for i in *.db; do